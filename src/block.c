@@ -12,6 +12,7 @@
  * <http://www.gnu.org/licenses/> 
  *--------------------------------------------------------------*/
 
+#include <unistd.h>
 #include "bounds.h"
 
 /* Get the minimum and maximum values from a set of points
@@ -127,339 +128,1184 @@ pl_match (point_t p1, point_t p2, point_t p3)
     return 0;
 }
 
-/* "Bounding Block"
- * Generates a grid at `inc` cell-size and polygonizes it into a boundary.
+/* Block Grid
  */
 int
-bbs_block(FILE *infile, double inc, region_t region, int vflag, int jflag) {
-  int i, j, xpos, ypos, edge, l, lxi, lyi;
-  int bp = 0, done = 0, pdone = 0, bcount = 0, fcount = 0, fyi = 0, dflag = 0;
-  point_t rpnt, bb1, bb2, bb3;
-  region_t xyi;
-  ssize_t npr = 0;
-  char* delim;
-  char* ptrec = "xy";
-  int forp_flag = 0;
-  point_t* pnts;
-  pnts = (point_t*) malloc (sizeof (point_t));
-  
-  /* Gather region info 
-   */
-  if (region_valid_p(&region)) 
+bgrid_init (bgrid_t* bg, int nx, int ny)
+{
+  size_t ncells = (size_t) max (nx, 0) * max (ny, 0);
+
+  bgrid_init_sparse (bg);
+  bg->nx = nx, bg->ny = ny;
+  bg->occ = (uint64_t*) calloc (ncells / 64 + 1, sizeof (uint64_t));
+  bg->edge = (uint8_t*) calloc (ncells / 16 + 1, sizeof (uint64_t));
+  if (!bg->occ || !bg->edge)
+    {
+      bgrid_free (bg);
+      return -1;
+    }
+  return 0;
+}
+
+void
+bgrid_init_sparse (bgrid_t* bg)
+{
+  bg->nx = 0, bg->ny = 0;
+  bg->occ = NULL, bg->edge = NULL;
+  bg->tiles = NULL, bg->ntiles = 0, bg->tcap = 0;
+  bg->hash = NULL, bg->hcap = 0;
+  bg->tx0 = 0, bg->ty0 = 0;
+  bg->cnt = NULL, bg->cmax = 0;
+}
+
+void
+bgrid_free (bgrid_t* bg)
+{
+  ssize_t t;
+
+  free (bg->occ);
+  free (bg->edge);
+  free (bg->cnt);
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      free (bg->tiles[t]->cnt);
+      free (bg->tiles[t]);
+    }
+  free (bg->tiles);
+  free (bg->hash);
+  bg->occ = NULL, bg->edge = NULL, bg->tiles = NULL, bg->hash = NULL, bg->cnt = NULL;
+  bg->ntiles = 0, bg->tcap = 0, bg->hcap = 0;
+}
+
+/* The hash slot to start looking for tile (tx, ty) from
+ */
+static size_t
+bgrid_slot (bgrid_t* bg, int64_t tx, int64_t ty)
+{
+  uint64_t h = (uint64_t) tx * 0x9E3779B97F4A7C15ull ^ (uint64_t) ty * 0xC2B2AE3D27D4EB4Full;
+  return (size_t) (h ^ (h >> 29)) & (bg->hcap - 1);
+}
+
+/* Rebuild the tile hash at `hcap` slots
+ */
+static void
+bgrid_rehash (bgrid_t* bg, size_t hcap)
+{
+  ssize_t t;
+  size_t h;
+
+  free (bg->hash);
+  bg->hcap = hcap;
+  bg->hash = (ssize_t*) calloc (hcap, sizeof (ssize_t));
+  if (!bg->hash)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+      exit (EXIT_FAILURE);
+    }
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      for (h = bgrid_slot (bg, bg->tiles[t]->tx, bg->tiles[t]->ty); bg->hash[h]; h = (h + 1) & (hcap - 1));
+      bg->hash[h] = t + 1;
+    }
+}
+
+btile_t*
+bgrid_tile (bgrid_t* bg, int64_t tx, int64_t ty, int create)
+{
+  btile_t* tile;
+  size_t h;
+
+  if (bg->hcap > 0)
+    for (h = bgrid_slot (bg, tx, ty); bg->hash[h]; h = (h + 1) & (bg->hcap - 1))
+      {
+	tile = bg->tiles[bg->hash[h] - 1];
+	if (tile->tx == tx && tile->ty == ty)
+	  return tile;
+      }
+  if (!create) return NULL;
+
+  /* Keep the hash no more than half full */
+  if (bg->ntiles == bg->tcap)
     {
-      xyi = region;
-      if (vflag > 0) fprintf (stderr, "bounds: using user supplied region: %f/%f/%f/%f\n", 
-			      xyi.xmin, xyi.xmax, xyi.ymin, xyi.ymax);
+      bg->tcap = bg->tcap ? bg->tcap * 2 : 256;
+      bg->tiles = (btile_t**) realloc (bg->tiles, bg->tcap * sizeof (btile_t*));
+      if (!bg->tiles)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+	  exit (EXIT_FAILURE);
+	}
     }
+  tile = (btile_t*) calloc (1, sizeof (btile_t));
+  if (!tile)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+      exit (EXIT_FAILURE);
+    }
+  tile->tx = tx, tile->ty = ty;
+  bg->tiles[bg->ntiles++] = tile;
+  if ((size_t) bg->ntiles * 2 > bg->hcap)
+    bgrid_rehash (bg, bg->hcap ? bg->hcap * 2 : 1024);
   else
     {
-      fprintf (stderr, "bounds: scanning xy data for region\n");
-      load_pnts (infile, &pnts, &npr, ptrec, vflag);
-      minmax(pnts, npr, &xyi);
-      forp_flag = 1;
+      for (h = bgrid_slot (bg, tx, ty); bg->hash[h]; h = (h + 1) & (bg->hcap - 1));
+      bg->hash[h] = bg->ntiles;
     }
-  
-  /* Set the rows and columns of the internal grid 
-   */
-  int ysize = fabs((xyi.ymax - xyi.ymin) / inc);// + 1;
-  int xsize = fabs((xyi.xmax - xyi.xmin) / inc);// + 1;
-  ssize_t xys = ((xsize * ysize) * 3) + 1;
+  return tile;
+}
 
-  if (vflag > 0) {
-    fprintf(stderr, "bounds: region is %f/%f/%f/%f\n", xyi.xmin, xyi.xmax, xyi.ymin, xyi.ymax);
-    fprintf(stderr,"bounds: size of internal grid: %d/%d\n", 
-	    ysize, xsize);
-  }
+void
+bgrid_set (bgrid_t* bg, int64_t cx, int64_t cy)
+{
+  btile_t* tile = bgrid_tile (bg, cx >> BTILE_SHIFT, cy >> BTILE_SHIFT, 1);
 
-  /* Allocate memory for arrays 
-   * `blockarray` will hold the point data location information
-   * `edgearray` wll hold the edge information for each edge cell
-   */
-  int** blockarray;
-  blockarray = (int**) malloc (ysize * sizeof(int*));
-  for (i = 0; i < ysize; i++) blockarray[i] = (int*) malloc (xsize * sizeof (int));
-  
-  if (!blockarray)
+  tile->occ[cy & (BTILE - 1)] |= (uint64_t) 1 << (cx & (BTILE - 1));
+}
+
+/* Add a point to count `k` of `cnt`, of counts up to `cmax`; the counts of
+ * a dense grid are added to from several threads at once.
+ */
+static void
+bgrid_count_add (void* cnt, size_t k, int cmax)
+{
+#if defined (__GNUC__)
+  uint8_t* c8 = (uint8_t*) cnt + k;
+  uint16_t* c16 = (uint16_t*) cnt + k;
+  uint8_t v8;
+  uint16_t v16;
+
+  if (cmax <= UINT8_MAX)
     {
-      if (vflag > 0) 
-	fprintf (stderr,"bounds: failed to allocate needed memory, try increasing the distance value (%f)\n", inc);
+      v8 = __atomic_load_n (c8, __ATOMIC_RELAXED);
+      while (v8 < cmax && !__atomic_compare_exchange_n (c8, &v8, (uint8_t) (v8 + 1), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+  else
+    {
+      v16 = __atomic_load_n (c16, __ATOMIC_RELAXED);
+      while (v16 < cmax && !__atomic_compare_exchange_n (c16, &v16, (uint16_t) (v16 + 1), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+#else
+  if (cmax <= UINT8_MAX)
+    {
+      if (((uint8_t*) cnt)[k] < cmax) ((uint8_t*) cnt)[k]++;
+    }
+  else if (((uint16_t*) cnt)[k] < cmax)
+    ((uint16_t*) cnt)[k]++;
+#endif
+}
+
+/* Count `k` of `cnt`, of counts up to `cmax`
+ */
+static int
+bgrid_count_at (void* cnt, size_t k, int cmax)
+{
+  return (cmax <= UINT8_MAX) ? ((uint8_t*) cnt)[k] : ((uint16_t*) cnt)[k];
+}
+
+void
+bgrid_count_init (bgrid_t* bg, int cmax)
+{
+  bg->cmax = cmax;
+  if (!bg->occ) return;
+  bg->cnt = calloc ((size_t) bg->nx * bg->ny + 1, cmax <= UINT8_MAX ? 1 : 2);
+  if (!bg->cnt)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block counts\n");
       exit (EXIT_FAILURE);
     }
+}
 
-  g_edges_t** edgearray;
-  edgearray = (g_edges_t**) malloc (ysize * sizeof (g_edges_t*));
-  for (i = 0; i < ysize; i++) edgearray[i] = (g_edges_t*) malloc (xsize * sizeof (g_edges_t));
+void
+bgrid_count (bgrid_t* bg, int64_t cx, int64_t cy)
+{
+  btile_t* tile = bgrid_tile (bg, cx >> BTILE_SHIFT, cy >> BTILE_SHIFT, 1);
 
-  if (!edgearray) 
+  if (!tile->cnt && (tile->cnt = calloc (BTILE * BTILE, bg->cmax <= UINT8_MAX ? 1 : 2)) == NULL)
     {
-      if (vflag > 0) 
-	fprintf (stderr,"bounds: failed to allocate needed memory, try increasing the distance value (%f)\n", inc);
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block counts\n");
       exit (EXIT_FAILURE);
     }
+  bgrid_count_add (tile->cnt, (size_t) (cy & (BTILE - 1)) * BTILE + (cx & (BTILE - 1)), bg->cmax);
+}
 
-  /* Assign all blockarray values to zero
-   */
-  for (i = 0; i < ysize; i++) 
-    for (j = 0; j < xsize; j++) 
-      blockarray[i][j] = 0;
+void
+bgrid_threshold (bgrid_t* bg, int min_count)
+{
+  btile_t* tile;
+  ssize_t t, n;
+  size_t k, ncells = (size_t) bg->nx * bg->ny;
+  int r, c, keep;
 
-  if (vflag > 0) fprintf(stderr,"bounds: gridding points\n");
+  if (bg->occ)
+    {
+      for (k = 0; bg->cnt && k < ncells; k++)
+	if (bgrid_count_at (bg->cnt, k, bg->cmax) >= min_count)
+	  bgrid_occ_set (bg, k);
+      free (bg->cnt);
+      bg->cnt = NULL;
+      return;
+    }
 
-  if (forp_flag == 0)
+  for (t = 0, n = 0; t < bg->ntiles; t++)
     {
-      while (read_point(infile, &rpnt, &delim, ptrec, dflag, vflag) == 0) 
+      tile = bg->tiles[t];
+      for (r = 0, keep = 0; r < BTILE && tile->cnt; r++)
+	for (c = 0; c < BTILE; c++)
+	  if (bgrid_count_at (tile->cnt, (size_t) r * BTILE + c, bg->cmax) >= min_count)
+	    tile->occ[r] |= (uint64_t) 1 << c, keep = 1;
+      free (tile->cnt);
+      tile->cnt = NULL;
+      if (keep) bg->tiles[n++] = tile;
+      else free (tile);
+    }
+  bg->ntiles = n;
+  if (bg->hcap > 0)
+    bgrid_rehash (bg, bg->hcap);
+}
+
+static int
+compare_tiles (const void* a, const void* b)
+{
+  const btile_t* t1 = *(btile_t* const*) a;
+  const btile_t* t2 = *(btile_t* const*) b;
+
+  if (t1->ty != t2->ty) return (t1->ty < t2->ty) ? -1 : 1;
+  if (t1->tx != t2->tx) return (t1->tx < t2->tx) ? -1 : 1;
+  return 0;
+}
+
+int
+bgrid_seal (bgrid_t* bg)
+{
+  int64_t tx1, ty1;
+  ssize_t t;
+
+  if (bg->ntiles == 0)
+    {
+      bg->nx = 0, bg->ny = 0;
+      return 0;
+    }
+  qsort (bg->tiles, bg->ntiles, sizeof (btile_t*), compare_tiles);
+  bgrid_rehash (bg, bg->hcap);
+
+  bg->tx0 = tx1 = bg->tiles[0]->tx;
+  bg->ty0 = bg->tiles[0]->ty, ty1 = bg->tiles[bg->ntiles - 1]->ty;
+  for (t = 1; t < bg->ntiles; t++)
+    bg->tx0 = min (bg->tx0, bg->tiles[t]->tx), tx1 = max (tx1, bg->tiles[t]->tx);
+
+  if (tx1 - bg->tx0 >= (INT_MAX >> BTILE_SHIFT) || ty1 - bg->ty0 >= (INT_MAX >> BTILE_SHIFT))
+    return -1;
+  bg->nx = (int) (tx1 - bg->tx0 + 1) << BTILE_SHIFT;
+  bg->ny = (int) (ty1 - bg->ty0 + 1) << BTILE_SHIFT;
+  return 0;
+}
+
+/* Add the existing tile `tile` to a sparse grid; the grid doesn't take it over.
+ */
+void
+bgrid_insert (bgrid_t* bg, btile_t* tile)
+{
+  size_t h;
+
+  if (bg->ntiles == bg->tcap)
+    {
+      bg->tcap = bg->tcap ? bg->tcap * 2 : 256;
+      bg->tiles = (btile_t**) realloc (bg->tiles, bg->tcap * sizeof (btile_t*));
+      if (!bg->tiles)
 	{
-	  xpos = (rpnt.x - xyi.xmin) / inc;
-	  ypos = (rpnt.y - xyi.ymin) / inc;
-	  if (xpos >= 0 && xpos < xsize)
-	    if (ypos >= 0 && ypos < ysize)
-	      blockarray[ypos][xpos] = 1;
-	  npr++;
-	  if (npr>0)
-	    dflag++;
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+	  exit (EXIT_FAILURE);
 	}
     }
+  bg->tiles[bg->ntiles++] = tile;
+  if ((size_t) bg->ntiles * 2 > bg->hcap)
+    bgrid_rehash (bg, bg->hcap ? bg->hcap * 2 : 1024);
   else
     {
-      /* Loop through the point records and grid them 
-       */
-      for (i = 0; i < npr; i++) 
-	{
-	  xpos = (pnts[i].x - xyi.xmin) / inc;
-	  ypos = (pnts[i].y - xyi.ymin) / inc;
-	  if (xpos >= 0 && xpos < xsize)
-	    if (ypos >= 0 && ypos < ysize)
-	      blockarray[ypos][xpos] = 1;
-	}
+      for (h = bgrid_slot (bg, tile->tx, tile->ty); bg->hash[h]; h = (h + 1) & (bg->hcap - 1));
+      bg->hash[h] = bg->ntiles;
     }
-  
-  if (vflag > 0) 
-    fprintf (stderr,"bounds: %d points gridded\nbounds: recording edges from grid\n", npr);
+}
 
-  /* Allocate memory for the edge points.
-   * There may be more boundary points than input points,
-   * so a new array is used
-   */
-  point_t* bnds;
-  bnds = (point_t*) malloc (sizeof (point_t) * xys);
+/* Drop the tiles of a sparse grid without freeing them
+ */
+void
+bgrid_clear (bgrid_t* bg)
+{
+  bg->ntiles = 0;
+  if (bg->hash) memset (bg->hash, 0, bg->hcap * sizeof (ssize_t));
+}
+
+int
+bgrid_occ_at (bgrid_t* bg, int xi, int yi)
+{
+  btile_t* tile;
+
+  if (xi < 0 || yi < 0 || xi >= bg->nx || yi >= bg->ny)
+    return 0;
+  if (!bg->tiles)
+    return bgrid_occ_p (bg, (size_t) yi * bg->nx + xi);
+  tile = bgrid_tile (bg, bg->tx0 + (xi >> BTILE_SHIFT), bg->ty0 + (yi >> BTILE_SHIFT), 0);
+  return tile ? (int) ((tile->occ[yi & (BTILE - 1)] >> (xi & (BTILE - 1))) & 1) : 0;
+}
+
+uint8_t*
+bgrid_cell (bgrid_t* bg, int xi, int yi, int* shift)
+{
+  btile_t* tile;
+  size_t k;
 
-  if (!bnds) 
+  if (!bg->tiles)
+    k = (size_t) yi * bg->nx + xi;
+  else
     {
-      if (vflag > 0) 
-	fprintf (stderr,"bounds: failed to allocate needed memory, try increasing the distance value (%f) or shrinking the region\n", inc);
+      tile = bgrid_tile (bg, bg->tx0 + (xi >> BTILE_SHIFT), bg->ty0 + (yi >> BTILE_SHIFT), 0);
+      if (!tile) return NULL;
+      k = ((yi & (BTILE - 1)) << BTILE_SHIFT) | (xi & (BTILE - 1));
+      *shift = (k & 1) << 2;
+      return &tile->edge[k >> 1];
+    }
+  *shift = (k & 1) << 2;
+  return &bg->edge[k >> 1];
+}
+
+void
+bgrid_record_edges (bgrid_t* bg, ssize_t t0, ssize_t t1)
+{
+  btile_t* tile;
+  ssize_t t;
+  size_t k;
+  int i, j, r, c, xsize = bg->nx, ysize = bg->ny;
+
+  if (!bg->tiles)
+    {
+      for (i = 0, k = 0; i < ysize; i++) 
+	for (j = 0; j < xsize; j++, k++) 
+	  if (bgrid_occ_p (bg, k)) 
+	    {
+	      if (i == 0 || !bgrid_occ_p (bg, k - xsize)) 
+		bgrid_edges_set (bg, k, BGRID_B);
+
+	      if (j == 0 || !bgrid_occ_p (bg, k - 1)) 
+		bgrid_edges_set (bg, k, BGRID_L);
+
+	      if (i == ysize-1 || !bgrid_occ_p (bg, k + xsize)) 
+		bgrid_edges_set (bg, k, BGRID_T);
+
+	      if (j == xsize-1 || !bgrid_occ_p (bg, k + 1)) 
+		bgrid_edges_set (bg, k, BGRID_R);
+	    }
+      return;
+    }
+
+  /* Neighbours inside the tile are read off its own rows */
+  for (t = t0; t < t1; t++)
+    {
+      tile = bg->tiles[t];
+      for (r = 0; r < BTILE; r++)
+	for (c = 0; c < BTILE; c++)
+	  if ((tile->occ[r] >> c) & 1)
+	    {
+	      j = (int) ((tile->tx - bg->tx0) << BTILE_SHIFT) + c;
+	      i = (int) ((tile->ty - bg->ty0) << BTILE_SHIFT) + r;
+	      k = (r << BTILE_SHIFT) | c;
+
+	      if (!(r > 0 ? (int) ((tile->occ[r - 1] >> c) & 1) : bgrid_occ_at (bg, j, i - 1)))
+		tile->edge[k >> 1] |= BGRID_B << ((k & 1) << 2);
+
+	      if (!(c > 0 ? (int) ((tile->occ[r] >> (c - 1)) & 1) : bgrid_occ_at (bg, j - 1, i)))
+		tile->edge[k >> 1] |= BGRID_L << ((k & 1) << 2);
+
+	      if (!(r < BTILE - 1 ? (int) ((tile->occ[r + 1] >> c) & 1) : bgrid_occ_at (bg, j, i + 1)))
+		tile->edge[k >> 1] |= BGRID_T << ((k & 1) << 2);
+
+	      if (!(c < BTILE - 1 ? (int) ((tile->occ[r] >> (c + 1)) & 1) : bgrid_occ_at (bg, j + 1, i)))
+		tile->edge[k >> 1] |= BGRID_R << ((k & 1) << 2);
+	    }
+    }
+}
+
+/* Batches of points for gridding
+ */
+void
+bbatch_init (bbatch_t* b)
+{
+  b->tcap = (ssize_t) BBATCH * 64;
+  b->text = (char*) malloc (b->tcap);
+  b->line = (ssize_t*) malloc ((BBATCH + 1) * sizeof (ssize_t));
+  b->pnts = (point_t*) malloc (BBATCH * sizeof (point_t));
+  b->cx = (int64_t*) malloc (BBATCH * sizeof (int64_t));
+  b->cy = (int64_t*) malloc (BBATCH * sizeof (int64_t));
+  if (!b->text || !b->line || !b->pnts || !b->cx || !b->cy)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the points\n");
       exit (EXIT_FAILURE);
     }
-  
-  /* Loop through the grid and record the cell edges into edgearray
+  b->delim = NULL;
+  b->last.x = NAN, b->last.y = NAN;
+  b->tcx = b->tcy = INT64_MIN;
+  b->pre = NULL, b->npre = 0, b->ipre = 0;
+  b->quantum = 0, b->qinc = 1;
+  b->n = 0, b->done = 0;
+}
+
+void
+bbatch_free (bbatch_t* b)
+{
+  free (b->text);
+  free (b->line);
+  free (b->pnts);
+  free (b->cx);
+  free (b->cy);
+  free (b->pre);
+}
+
+/* The work of one batch thread: records `lo` to `hi-1` of `b`, with the
+ * cell parameters of bbatch_cells.
+ */
+typedef struct
+{
+  bbatch_t* b;
+  char* pnt_recr;
+  int lo;
+  int hi;
+  double inc;
+  double xmin;
+  double ymin;
+  int nx;
+  int ny;
+  bgrid_t* bg;
+} bbatch_job_t;
+
+/* A NaN no record parses to, marking the fields a record is missing */
+static const uint64_t bbatch_missing = 0x7FF8B0D5B0D5B0D5ull;
+
+static int
+bbatch_missing_p (double v)
+{
+  uint64_t u;
+
+  memcpy (&u, &v, sizeof (u));
+  return u == bbatch_missing;
+}
+
+static void*
+bbatch_parse_run (void* arg)
+{
+  bbatch_job_t* job = (bbatch_job_t*) arg;
+  bbatch_t* b = job->b;
+  int i;
+
+  for (i = job->lo; i < job->hi; i++)
+    {
+      memcpy (&b->pnts[i].x, &bbatch_missing, sizeof (double));
+      memcpy (&b->pnts[i].y, &bbatch_missing, sizeof (double));
+      parse_point (b->text + b->line[i], &b->pnts[i], b->delim, job->pnt_recr);
+    }
+  return NULL;
+}
+
+#if defined (__GNUC__)
+typedef double bvdbl_t __attribute__ ((vector_size (4 * sizeof (double))));
+typedef long long bvint_t __attribute__ ((vector_size (4 * sizeof (long long))));
+#endif
+
+/* The cell of `q` increments from the origin: truncated as bbs_block
+ * truncates it, and kept if it is below `n`, with `n` 0 or more; or
+ * else floored; INT64_MIN if there is none.
+ */
+static int64_t
+bbatch_cell (double q, int n)
+{
+  if (n >= 0)
+    return (q > -1.0 && q < (double) n) ? (int64_t) q : INT64_MIN;
+  if (!(fabs (q) < 4.0e18))
+    return INT64_MIN;
+  return (int64_t) floor (q);
+}
+
+/* The floor of `a` over `b`, for `b` more than 0
+ */
+static int64_t
+floor_div (int64_t a, int64_t b)
+{
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+/* The cell of `v` from the origin, snapped to the nearest of the steps of
+ * `b`: a point on a cell border, in steps, is in the cell above it.
+ * INT64_MIN if there is none, or it isn't below `n` with `n` 0 or more.
+ */
+static int64_t
+bbatch_qcell (bbatch_t* b, double v, int n)
+{
+  double q = round (v / b->quantum);
+  int64_t c;
+
+  if (!(fabs (q) < 4.0e18))
+    return INT64_MIN;
+  c = floor_div ((int64_t) q, b->qinc);
+  return (n >= 0 && (c < 0 || c >= n)) ? INT64_MIN : c;
+}
+
+static void*
+bbatch_cells_run (void* arg)
+{
+  bbatch_job_t* job = (bbatch_job_t*) arg;
+  bbatch_t* b = job->b;
+  point_t* p = b->pnts;
+  uint64_t bit;
+  size_t k;
+  int i = job->lo;
+
+  if (b->quantum > 0)
+    for (; i < job->hi; i++)
+      {
+	b->cx[i] = bbatch_qcell (b, p[i].x - job->xmin, job->nx);
+	b->cy[i] = bbatch_qcell (b, p[i].y - job->ymin, job->ny);
+	if (b->cx[i] == INT64_MIN || b->cy[i] == INT64_MIN)
+	  b->cx[i] = b->cy[i] = INT64_MIN;
+      }
+
+#if defined (__GNUC__)
+  /* Four points at a time; the division is kept so that points on a cell
+   * border fall in the same cell as the scalar path puts them.
    */
-  for (i = 0; i < ysize; i++) 
-    for (j = 0; j < xsize; j++) 
-      if (blockarray[i][j] == 1) 
+  const bvdbl_t vinc = {job->inc, job->inc, job->inc, job->inc};
+  const bvdbl_t vxmin = {job->xmin, job->xmin, job->xmin, job->xmin};
+  const bvdbl_t vymin = {job->ymin, job->ymin, job->ymin, job->ymin};
+  const bvdbl_t lo = {-1.0, -1.0, -1.0, -1.0}, big = {4.0e18, 4.0e18, 4.0e18, 4.0e18};
+  const bvdbl_t vnx = {job->nx, job->nx, job->nx, job->nx}, vny = {job->ny, job->ny, job->ny, job->ny};
+  const bvint_t none = {INT64_MIN, INT64_MIN, INT64_MIN, INT64_MIN};
+  bvdbl_t qx, qy;
+  bvint_t ok, ix, iy;
+
+  for (; i + 4 <= job->hi; i += 4)
+    {
+      qx = (bvdbl_t) {p[i].x, p[i + 1].x, p[i + 2].x, p[i + 3].x};
+      qy = (bvdbl_t) {p[i].y, p[i + 1].y, p[i + 2].y, p[i + 3].y};
+      qx = (qx - vxmin) / vinc;
+      qy = (qy - vymin) / vinc;
+      if (job->nx >= 0)
+	ok = (qx > lo) & (qx < vnx) & (qy > lo) & (qy < vny);
+      else
+	ok = (qx < big) & (qx > -big) & (qy < big) & (qy > -big);
+
+      /* Zero the lanes without a cell before converting them */
+      qx = (bvdbl_t) ((bvint_t) qx & ok), qy = (bvdbl_t) ((bvint_t) qy & ok);
+      ix = __builtin_convertvector (qx, bvint_t);
+      iy = __builtin_convertvector (qy, bvint_t);
+      if (job->nx < 0)
 	{
-	  if (i == 0 || blockarray[i-1][j] == 0) 
-	    edgearray[i][j].b = 1;
+	  ix += (qx < __builtin_convertvector (ix, bvdbl_t));
+	  iy += (qy < __builtin_convertvector (iy, bvdbl_t));
+	}
+      ix = (ix & ok) | (none & ~ok), iy = (iy & ok) | (none & ~ok);
+      memcpy (b->cx + i, &ix, sizeof (ix)), memcpy (b->cy + i, &iy, sizeof (iy));
+    }
+#endif
+  for (; i < job->hi; i++)
+    {
+      b->cx[i] = bbatch_cell ((p[i].x - job->xmin) / job->inc, job->nx);
+      b->cy[i] = bbatch_cell ((p[i].y - job->ymin) / job->inc, job->ny);
+      if (b->cx[i] == INT64_MIN || b->cy[i] == INT64_MIN)
+	b->cx[i] = b->cy[i] = INT64_MIN;
+    }
 
-	  if (j == 0 || blockarray[i][j-1] == 0) 
-	    edgearray[i][j].l = 1;
+  if (job->bg)
+    for (i = job->lo; i < job->hi; i++)
+      if (b->cx[i] != INT64_MIN)
+	{
+	  k = (size_t) b->cy[i] * job->bg->nx + (size_t) b->cx[i];
+	  if (job->bg->cnt)
+	    {
+	      bgrid_count_add (job->bg->cnt, k, job->bg->cmax);
+	      continue;
+	    }
+	  bit = (uint64_t) 1 << (k & 63);
+#if defined (__GNUC__)
+	  if (!(job->bg->occ[k >> 6] & bit))
+	    __atomic_fetch_or (&job->bg->occ[k >> 6], bit, __ATOMIC_RELAXED);
+#else
+	  job->bg->occ[k >> 6] |= bit;
+#endif
+	}
+  return NULL;
+}
 
-	  if (i == ysize-1 || blockarray[i+1][j] == 0) 
-	    edgearray[i][j].t = 1;
+/* Run `fn` over the records of a batch, split over the threads
+ */
+static void
+bbatch_run (bbatch_job_t* proto, void* (*fn) (void*), int nthreads)
+{
+  bbatch_job_t jobs[64];
+  int t, threads, n = proto->b->n;
 
-	  if (j == xsize-1 || blockarray[i][j+1] == 0) 
-	    edgearray[i][j].r = 1;
+  threads = max (1, min (min (nthreads, 64), n / 4096));
+  for (t = 0; t < threads; t++)
+    {
+      jobs[t] = *proto;
+      jobs[t].lo = (int) ((long long) n * t / threads);
+      jobs[t].hi = (int) ((long long) n * (t + 1) / threads);
+    }
+  run_jobs (jobs, sizeof (bbatch_job_t), threads, fn);
+}
 
-	  /* Set the cell to 2 if there are no edges recorded.
-	   */
-	  if (g_edges_p (edgearray[i][j]) == 0)
-	    blockarray[i][j] = 2;
-	}
+int
+bbatch_read (bbatch_t* b, FILE* infile, char* pnt_recr, int nthreads, int vflag)
+{
+  bbatch_job_t job;
+  ssize_t tn;
+  int i, n;
 
-  /* Scan the edgearray and arrange and output the edges into polygon(s).
-   * pdone is 1 when we can't find any more edge cells.
-   */
-  while (pdone == 0)
+  b->n = 0;
+
+  /* The points read ahead come first, already parsed */
+  if (b->ipre < b->npre)
+    {
+      b->n = (int) min ((ssize_t) BBATCH, b->npre - b->ipre);
+      memcpy (b->pnts, b->pre + b->ipre, b->n * sizeof (point_t));
+      b->ipre += b->n;
+      return b->n;
+    }
+
+  if (b->done) return 0;
+  for (n = 0, tn = 0; n < BBATCH; n++)
     {
-      /* Find the first edge in the polygon; add it to bnds and record it's position.
-       */
-      for (i = int_or_zero (fyi - 2); i < ysize; i++) 
-	for (j = 0; j < xsize; j++) 
-	  if (blockarray[i][j] == 1)
+      if (b->tcap - tn < MAX_RECORD_LENGTH)
+	{
+	  b->tcap *= 2;
+	  if ((b->text = (char*) realloc (b->text, b->tcap)) == NULL)
 	    {
-	      if (edgearray[i][j].b == 1)
-		{
-		  bb3 = pixel_to_point (j, i, inc, xyi);
-		  bnds[0].x = bb3.x, bnds[0].y = bb3.y;
-		  bnds[1].x = bb3.x + inc, bnds[1].y = bb3.y;
-		  edgearray[i][j].b = 0, bcount = 2;
-		  fyi = i, lxi = j, lyi = i, i = ysize, j = xsize;
-		}
-	      else if (edgearray[i][j].l == 1)
-		{
-		  bb3 = pixel_to_point (j, i, inc, xyi);
-		  bnds[0].x = bb3.x, bnds[0].y = bb3.y + inc;
-		  bnds[1].x = bb3.x, bnds[1].y = bb3.y;
-		  edgearray[i][j].l = 0, bcount = 2;
-		  fyi = i, lxi = j, lyi = i, i = ysize, j = xsize;
-		}
-	      else if (edgearray[i][j].t == 1)
-		{
-		  bb3 = pixel_to_point (j, i, inc, xyi);
-		  bnds[0].x = bb3.x + inc, bnds[0].y = bb3.y + inc;
-		  bnds[1].x = bb3.x, bnds[1].y = bb3.y + inc;
-		  edgearray[i][j].t = 0, bcount = 2;
-		  fyi = i, lxi = j, lyi = i, i = ysize, j = xsize;
-		}
-	      else if (edgearray[i][j].r == 1)
-		{
-		  bb3 = pixel_to_point (j, i, inc, xyi);
-		  bnds[0].x = bb3.x + inc, bnds[0].y = bb3.y + inc;
-		  bnds[1].x = bb3.x + inc, bnds[1].y = bb3.y;
-		  edgearray[i][j].r = 0, bcount = 2;
-		  fyi = i, lxi = j, lyi = i, i = ysize, j = xsize;
-		}
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the points\n");
+	      exit (EXIT_FAILURE);
 	    }
-    
-      if (bcount != 2) 
-	  done = 1, pdone = 1;
-      else
-	if (bp > 0)
-	  if (jflag > 0)
-	    printf ( "]],[[" );
-	  else
-	    printf ( ">\n" );
-      
-      /* Scan the nearby cells in the edgearray and build polygons.
-       * done is 1 when we match the first point found above.
-       */
-      while (done == 0)
+	}
+      if (fgets (b->text + tn, MAX_RECORD_LENGTH, infile) == NULL)
 	{
-	  for (i = int_or_zero (lyi-1); i < int_or_max (lyi + 2, ysize); i++)
-	    for (j = int_or_zero (lxi-1); j < int_or_max (lxi + 2, xsize); j++)
-	      if (blockarray[i][j] == 1)
-		{
-		  if (edgearray[i][j].b == 1)
-		    {
-		      bb3 = pixel_to_point (j, i, inc, xyi);
-		      bb1.x = bb3.x, bb1.y = bb3.y;
-		      bb2.x = bb3.x + inc, bb2.y = bb3.y;
-		      l = pl_match (bnds[bcount - 1], bb1, bb2);
-		      if (l)
-			{
-			  if (pl_match(bnds[0], bb1, bb2)) done = 1;
-			  if (l == 1) bnds[bcount].x = bb2.x, bnds[bcount].y = bb2.y;
-			  else bnds[bcount].x = bb1.x, bnds[bcount].y = bb1.y;
-
-			  edgearray[i][j].b = 0;
-			  lxi = j, lyi = i, bcount++;
-
-			  if (g_edges_p (edgearray[i][j]) == 0) blockarray[i][j] = 2;
-			}
-		    }
-		  if (edgearray[i][j].l == 1)
-		    {
-		      bb3 = pixel_to_point (j, i, inc, xyi);
-		      bb1.x = bb3.x, bb1.y = bb3.y + inc;
-		      bb2.x = bb3.x, bb2.y = bb3.y;
-		      l = pl_match (bnds[bcount - 1], bb1, bb2);
-		      if (l)
-			{
-			  if (pl_match(bnds[0], bb1, bb2)) done = 1;
-			  if (l == 1) bnds[bcount].x = bb2.x, bnds[bcount].y = bb2.y;
-			  else bnds[bcount].x = bb1.x, bnds[bcount].y = bb1.y;
-
-			  edgearray[i][j].l = 0;
-			  lxi = j, lyi = i, bcount++;
-			  
-			  if (g_edges_p (edgearray[i][j]) == 0) blockarray[i][j] = 2;
-			}
-		    }
-		  if (edgearray[i][j].t == 1)
-		    {
-		      bb3 = pixel_to_point (j, i, inc, xyi);
-		      bb1.x = bb3.x + inc, bb1.y = bb3.y + inc;
-		      bb2.x = bb3.x, bb2.y = bb3.y + inc;
-		      l = pl_match (bnds[bcount - 1], bb1, bb2);
-		      if (l)
-			{
-			  if (pl_match(bnds[0], bb1, bb2)) done = 1;
-			  if (l == 1) bnds[bcount].x = bb2.x, bnds[bcount].y = bb2.y;
-			  else bnds[bcount].x = bb1.x, bnds[bcount].y = bb1.y;
-
-			  edgearray[i][j].t = 0;
-			  lxi = j, lyi = i, bcount++;
-
-			  if (g_edges_p (edgearray[i][j]) == 0) blockarray[i][j] = 2;
-			}
-		    }
-		  if (edgearray[i][j].r == 1)
-		    {
-		      bb3 = pixel_to_point (j, i, inc, xyi);
-		      bb1.y = bb3.y + inc, bb1.x = bb3.x + inc;
-		      bb2.x = bb3.x + inc, bb2.y = bb3.y;
-		      l = pl_match (bnds[bcount - 1], bb1, bb2);
-		      if (l)
-			{
-			  if (pl_match(bnds[0], bb1, bb2)) done = 1;
-			  if (l == 1) bnds[bcount].x = bb2.x, bnds[bcount].y = bb2.y;
-			  else bnds[bcount].x = bb1.x, bnds[bcount].y = bb1.y;
-
-			  edgearray[i][j].r = 0;
-			  lxi = j, lyi = i, bcount++;
-
-			  if (g_edges_p (edgearray[i][j]) == 0) blockarray[i][j] = 2;
-			}
-		    }
-		}
+	  b->done = 1;
+	  break;
 	}
+      b->line[n] = tn;
+      tn += strlen (b->text + tn) + 1;
+    }
+  if (n == 0) return 0;
 
-      if (jflag > 0)
+  if (!b->delim)
+    {
+      b->delim = " \t";
+      auto_delim_l (b->text, &b->delim);
+      if (vflag > 0) fprintf (stderr, "bounds: delimiter is '%s'\n", b->delim);
+    }
+
+  b->n = n;
+  job.b = b, job.pnt_recr = pnt_recr, job.bg = NULL;
+  bbatch_run (&job, bbatch_parse_run, nthreads);
+
+  /* Carry the fields a record is missing over from the one before */
+  for (i = 0; i < n; i++)
+    {
+      if (bbatch_missing_p (b->pnts[i].x)) b->pnts[i].x = b->last.x;
+      if (bbatch_missing_p (b->pnts[i].y)) b->pnts[i].y = b->last.y;
+      b->last = b->pnts[i];
+    }
+  return n;
+}
+
+void
+bbatch_cells (bbatch_t* b, double inc, double xmin, double ymin, int nx, int ny, bgrid_t* bg, int nthreads)
+{
+  bbatch_job_t job;
+
+  job.b = b, job.pnt_recr = NULL, job.bg = bg;
+  job.inc = inc, job.xmin = xmin, job.ymin = ymin;
+  job.nx = nx < 0 ? -1 : nx, job.ny = nx < 0 ? -1 : ny;
+  bbatch_run (&job, bbatch_cells_run, nthreads);
+}
+
+/* Round `v` to the nearest of 1, 2 or 5 times a power of ten, or with
+ * `up`, to the next one up.
+ */
+static double
+nice_step (double v, int up)
+{
+  double p = pow (10, floor (log10 (v))), m = v / p;
+
+  if (up)
+    return m < 1.5 ? 2 * p : m < 3.5 ? 5 * p : 10 * p;
+  return m < M_SQRT2 ? p : m < sqrt (10) ? 2 * p : m < sqrt (50) ? 5 * p : 10 * p;
+}
+
+double
+bbatch_increment (bbatch_t* b, FILE* infile, char* pnt_recr, region_t region, size_t max_memory, double cellsize, int nthreads, int vflag)
+{
+  point_t* pts;
+  region_t ext = region;
+  double spacing, inc, least, budget;
+  ssize_t i, n, cap = BBATCH;
+
+  b->pre = (point_t*) malloc (cap * sizeof (point_t));
+  if (!b->pre)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the points\n");
+      exit (EXIT_FAILURE);
+    }
+  while (b->npre < BBATCH_AHEAD && bbatch_read (b, infile, pnt_recr, nthreads, vflag) > 0)
+    {
+      if (b->npre + b->n > cap)
 	{
-	  for (edge = 0; edge < bcount-1; edge++) 
-	    printf("[%.10f, %.10f],", bnds[edge].x, bnds[edge].y);
-	  //fprintf (stderr, "%d", bcount-1);
-	  if ( bcount > 1 )
+	  cap *= 2;
+	  if ((b->pre = (point_t*) realloc (b->pre, cap * sizeof (point_t))) == NULL)
 	    {
-	      printf("[%.10f, %.10f]", bnds[bcount-1].x, bnds[bcount-1].y);
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the points\n");
+	      exit (EXIT_FAILURE);
 	    }
 	}
-      else
+      memcpy (b->pre + b->npre, b->pnts, b->n * sizeof (point_t));
+      b->ipre = b->npre += b->n;
+    }
+  b->ipre = 0;
+
+  /* The spacing is of the points with both fields */
+  pts = (point_t*) malloc (max (b->npre, (ssize_t) 1) * sizeof (point_t));
+  if (!pts)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the spacing estimate\n");
+      exit (EXIT_FAILURE);
+    }
+  for (i = 0, n = 0; i < b->npre; i++)
+    if (isfinite (b->pre[i].x) && isfinite (b->pre[i].y))
+      pts[n++] = b->pre[i];
+  spacing = n > 1 ? nn_spacing (pts, (int) n, 4096, 0.9) : 0;
+  if (!region_valid_p (&ext) && n > 0)
+    minmax (pts, (int) n, &ext);
+  free (pts);
+
+  if (!(spacing > 0))
+    {
+      fprintf (stderr, "bounds: the points are too few to estimate a block increment from, give one to --block\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* The least increment whose grid fits the budget */
+  budget = max_memory > 0 ? (double) max_memory
+    : (double) sysconf (_SC_PHYS_PAGES) * sysconf (_SC_PAGESIZE) / 4;
+  least = sqrt ((ext.xmax - ext.xmin) * (ext.ymax - ext.ymin) * cellsize / budget);
+  least = max (least, max (ext.xmax - ext.xmin, ext.ymax - ext.ymin) / (double) (INT_MAX >> BTILE_SHIFT));
+
+  for (inc = nice_step (2 * spacing, 0); inc < least; inc = nice_step (inc, 1));
+  if (vflag > 0)
+    fprintf (stderr, "bounds: estimated a block increment of %g from a spacing of %f between %zd points\n",
+	     inc, spacing, n);
+  return inc;
+}
+
+/* Mark cell (cx, cy) of `bg` as a point would
+ */
+static void
+bgrid_mark (bgrid_t* bg, int64_t cx, int64_t cy)
+{
+  size_t k;
+
+  if (bg->occ)
+    {
+      k = (size_t) cy * bg->nx + (size_t) cx;
+      if (bg->cnt) bgrid_count_add (bg->cnt, k, bg->cmax);
+      else bgrid_occ_set (bg, k);
+    }
+  else if (bg->cmax > 0)
+    bgrid_count (bg, cx, cy);
+  else
+    bgrid_set (bg, cx, cy);
+}
+
+void
+bbatch_track (bbatch_t* b, int i, double gap, bgrid_t* bg)
+{
+  int64_t x0 = b->tcx, y0 = b->tcy, x1 = b->cx[i], y1 = b->cy[i], dx, dy, sx, sy, err, e2;
+  point_t p = b->tpnt;
+
+  b->tcx = x1, b->tcy = y1, b->tpnt = b->pnts[i];
+  if (x0 == INT64_MIN || x1 == INT64_MIN)
+    return;
+  if (!(hypot (b->tpnt.x - p.x, b->tpnt.y - p.y) <= gap))
+    return;
+
+  /* Bresenham's line, between the two cells */
+  dx = (x1 > x0) ? x1 - x0 : x0 - x1, sx = (x1 > x0) ? 1 : -1;
+  dy = (y1 > y0) ? y0 - y1 : y1 - y0, sy = (y1 > y0) ? 1 : -1;
+  err = dx + dy;
+  for (;;)
+    {
+      e2 = 2 * err;
+      if (e2 >= dy)
+	{
+	  if (x0 == x1) break;
+	  err += dy, x0 += sx;
+	}
+      if (e2 <= dx)
 	{
-	  for (edge = 0; edge < bcount; edge++) 
-	    printf("%.10f %.10f\n", bnds[edge].x, bnds[edge].y);
+	  if (y0 == y1) break;
+	  err += dx, y0 += sy;
 	}
+      if (x0 == x1 && y0 == y1) break;
+      bgrid_mark (bg, x0, y0);
+    }
+}
 
-      //if (pdone == 0)
-      //printf( ">\n" );
-      
-      /* Reset some values 
-       */
-      fcount = fcount + bcount;
-      bcount = 0, done = 0;
-      
-      if (pdone == 0) 
-	bp++;
+/* The corners each cell edge runs from and to, in increments from the
+ * cell's lower-left corner, and the direction it runs in (0 +x, 1 +y,
+ * 2 -x, 3 -y); edges run with their cell on the left.
+ */
+static const int bedge_x0[4] = {0, 0, 1, 1};
+static const int bedge_y0[4] = {0, 1, 1, 0};
+static const int bedge_x1[4] = {1, 0, 0, 1};
+static const int bedge_y1[4] = {0, 0, 1, 1};
+static const int bedge_dir[4] = {0, 3, 2, 1};
+
+/* The edges running out of and into the corner (xv, yv) and their
+ * directions; `ll`, `lr`, `ul` and `ur` are the occupancy of the cells
+ * around the corner.
+ */
+static int
+bedge_around (int xv, int yv, int ll, int lr, int ul, int ur, int out, bedge_t* e, int* d)
+{
+  int n = 0;
+
+  if (out)
+    {
+      if (ur && !lr) e[n] = BEDGE (xv, yv, 0), d[n++] = 0;
+      if (lr && !ll) e[n] = BEDGE (xv, yv - 1, 1), d[n++] = 3;
+      if (ll && !ul) e[n] = BEDGE (xv - 1, yv - 1, 2), d[n++] = 2;
+      if (ul && !ur) e[n] = BEDGE (xv - 1, yv, 3), d[n++] = 1;
     }
+  else
+    {
+      if (ul && !ll) e[n] = BEDGE (xv - 1, yv, 0), d[n++] = 0;
+      if (ur && !ul) e[n] = BEDGE (xv, yv, 1), d[n++] = 3;
+      if (lr && !ur) e[n] = BEDGE (xv, yv - 1, 2), d[n++] = 2;
+      if (ll && !lr) e[n] = BEDGE (xv - 1, yv - 1, 3), d[n++] = 1;
+    }
+  return n;
+}
 
-  /* Cleanup up and return.
+bedge_t
+block_next (bgrid_t* bg, bedge_t e)
+{
+  int f = BEDGE_F (e), n, k, d[4];
+  int xv = BEDGE_X (e) + bedge_x1[f], yv = BEDGE_Y (e) + bedge_y1[f];
+  bedge_t out[4];
+
+  n = bedge_around (xv, yv, bgrid_occ_at (bg, xv - 1, yv - 1), bgrid_occ_at (bg, xv, yv - 1),
+		    bgrid_occ_at (bg, xv - 1, yv), bgrid_occ_at (bg, xv, yv), 1, out, d);
+
+  /* Where two cells only meet at the corner, turn right to keep them together */
+  for (k = 0; k < n; k++)
+    if (n == 1 || d[k] == ((bedge_dir[f] + 3) & 3))
+      return out[k];
+  return e;
+}
+
+bedge_t
+block_prev (bgrid_t* bg, bedge_t e)
+{
+  int f = BEDGE_F (e), n, k, d[4];
+  int xv = BEDGE_X (e) + bedge_x0[f], yv = BEDGE_Y (e) + bedge_y0[f];
+  bedge_t in[4];
+
+  n = bedge_around (xv, yv, bgrid_occ_at (bg, xv - 1, yv - 1), bgrid_occ_at (bg, xv, yv - 1),
+		    bgrid_occ_at (bg, xv - 1, yv), bgrid_occ_at (bg, xv, yv), 0, in, d);
+  for (k = 0; k < n; k++)
+    if (n == 1 || d[k] == ((bedge_dir[f] + 1) & 3))
+      return in[k];
+  return e;
+}
+
+/* Return the start (or with `end` the end) corner of edge `e`
+ */
+static point_t
+bedge_corner (bedge_t e, int end, double inc, region_t xyi)
+{
+  int f = BEDGE_F (e);
+  point_t bb3 = pixel_to_point (BEDGE_X (e), BEDGE_Y (e), inc, xyi);
+
+  if (end ? bedge_x1[f] : bedge_x0[f]) bb3.x = bb3.x + inc;
+  if (end ? bedge_y1[f] : bedge_y0[f]) bb3.y = bb3.y + inc;
+  return bb3;
+}
+
+ssize_t
+block_print_ring (bedge_t* ring, ssize_t n, double inc, region_t xyi, int jflag, int sep)
+{
+  ssize_t k, j, np = 0;
+  int rev = (BEDGE_F (ring[0]) == 3);
+  point_t p;
+
+  if (sep == 1)
+    printf (jflag > 0 ? "]],[[" : ">\n");
+  else if (sep == 2)
+    printf (jflag > 0 ? "],[" : ">\n# @H\n");
+
+  /* A ring starting on a right edge is written the other way around;
+   * the corners between edges running the same way are left out.
    */
-  for (i = 0; i < ysize; i++) 
+  for (k = 0; k <= n; k++)
+    {
+      if (k > 0 && k < n)
+	{
+	  j = rev ? (k > 1 ? n + 1 - k : 0) : k;
+	  if (bedge_dir[BEDGE_F (ring[j])] == bedge_dir[BEDGE_F (ring[j > 0 ? j - 1 : n - 1])])
+	    continue;
+	}
+      if (!rev)
+	p = bedge_corner (ring[k ? k - 1 : 0], k > 0, inc, xyi);
+      else
+	p = bedge_corner (ring[k > 1 ? n + 1 - k : 0], k == 0, inc, xyi);
+
+      if (jflag > 0)
+	printf (k < n ? "[%.10f, %.10f]," : "[%.10f, %.10f]", p.x, p.y);
+      else
+	printf ("%.10f %.10f\n", p.x, p.y);
+      np++;
+    }
+  return np;
+}
+
+void
+bgrid_reduce (bgrid_t* bg, int factor, bgrid_t* coarse)
+{
+  btile_t* tile;
+  uint64_t w;
+  ssize_t t;
+  size_t k, words;
+  int r, c;
+
+  if (bg->occ)
+    {
+      if (bgrid_init (coarse, (int) (((int64_t) bg->nx + factor - 1) / factor),
+		      (int) (((int64_t) bg->ny + factor - 1) / factor)) != 0)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the block pyramid\n");
+	  exit (EXIT_FAILURE);
+	}
+
+      /* Take the set bits of each word in turn, skipping the empty words */
+      words = ((size_t) bg->nx * bg->ny + 63) / 64;
+      for (t = 0; (size_t) t < words; t++)
+	for (w = bg->occ[t]; w; w &= w - 1)
+	  {
+	    k = (size_t) t * 64 + __builtin_ctzll (w);
+	    bgrid_occ_set (coarse, (size_t) ((k / bg->nx) / factor) * coarse->nx + (k % bg->nx) / factor);
+	  }
+      return;
+    }
+
+  bgrid_init_sparse (coarse);
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      tile = bg->tiles[t];
+      for (r = 0; r < BTILE; r++)
+	for (w = tile->occ[r]; w; w &= w - 1)
+	  {
+	    c = __builtin_ctzll (w);
+	    bgrid_set (coarse, floor_div ((tile->tx << BTILE_SHIFT) + c, factor),
+		       floor_div ((tile->ty << BTILE_SHIFT) + r, factor));
+	  }
+    }
+  if (bgrid_seal (coarse) != 0)
+    {
+      fprintf (stderr, "bounds: the block pyramid spans too many cells\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Start the layer of the next level of a pyramid, of `inc` cells
+ */
+static void
+block_print_layer (bpyramid_t* pyr, double inc, int jflag)
+{
+  if (jflag > 0)
     {
-      free (blockarray[i]);
-      free (edgearray[i]);
-      blockarray[i] = NULL;
-      edgearray[i] = NULL;
+      printf ("]]]}},\n{ \"type\": \"Feature\", \"properties\": { \"Name\": \"%s_%g\" },", pyr->name, inc);
+      printf (" \"geometry\": { \"type\": \"MultiPolygon\",\n \"coordinates\": [[[");
+    }
+  else if (pyr->gflag > 0)
+    printf (">\n# @D%s_%g\n# @P\n", pyr->name, inc);
+  else
+    printf (">\n");
+}
+
+ssize_t
+block_levels (bgrid_t* bg, double inc, region_t xyi, int lattice, bpyramid_t* pyr, ssize_t min_area, int nthreads, int vflag, int jflag)
+{
+  bgrid_t levels[2];
+  bgrid_t* cur = bg;
+  ssize_t fcount = 0, n;
+  int l, nx, ny;
+
+  for (l = 0; ; l++)
+    {
+      if (l > 0)
+	block_print_layer (pyr, inc, jflag);
+
+      /* An empty sparse grid has no tiles to trace */
+      if (cur->occ || cur->ntiles > 0)
+	{
+	  bgrid_record_edges (cur, 0, cur->ntiles);
+	  n = block_trace_stripes (cur, inc, xyi, min_area, nthreads, jflag);
+	  if (vflag > 0 && pyr)
+	    fprintf (stderr, "bounds: level %d, %f: %zd boundary points\n", l, inc, n);
+	  fcount += n;
+	}
+      if (!pyr || l + 1 >= pyr->levels)
+	break;
+
+      /* OR-reduce the next level out of this one */
+      bgrid_reduce (cur, pyr->factor, &levels[l & 1]);
+      nx = cur->nx, ny = cur->ny;
+      if (cur != bg)
+	bgrid_free (cur);
+      cur = &levels[l & 1];
+      inc *= pyr->factor;
+      if (cur->tiles && lattice)
+	{
+	  xyi.xmin = (double) (cur->tx0 << BTILE_SHIFT) * inc;
+	  xyi.ymin = (double) (cur->ty0 << BTILE_SHIFT) * inc;
+	}
+      else if (cur->tiles)
+	{
+	  /* Cells counted from the region corner stay counted from it */
+	  cur->tx0 = 0, cur->ty0 = 0;
+	  cur->nx = (int) (((int64_t) nx + pyr->factor - 1) / pyr->factor);
+	  cur->ny = (int) (((int64_t) ny + pyr->factor - 1) / pyr->factor);
+	}
+      xyi.xmax = xyi.xmin + cur->nx * inc;
+      xyi.ymax = xyi.ymin + cur->ny * inc;
     }
+  if (cur != bg)
+    bgrid_free (cur);
+  return fcount;
+}
 
-  free (blockarray);
-  blockarray = NULL;
-  free (edgearray);
-  edgearray = NULL;
+/* "Bounding Block"
+ * Generates a grid at `inc` cell-size and polygonizes it into a boundary.
+ * Without a region, or with a `max_memory` limit, the grid is kept in
+ * sparse tiles (see bbs_block_tiles).
+ */
+int
+bbs_block(FILE *infile, double inc, double quantum, region_t region, size_t max_memory, bpyramid_t* pyr, bmorph_t* morph, int raster, int nthreads, int vflag, int jflag) {
+  ssize_t fcount;
+  region_t xyi;
+  ssize_t npr = 0;
+  char* ptrec = "xy";
+  bgrid_t bg;
+  bbatch_t bb;
+  int i, xsize, ysize, estimated, sparse = max_memory > 0 || !region_valid_p(&region);
   
+  if (raster && pyr && pyr->levels > 1)
+    {
+      fprintf (stderr, "bounds: a raster can't be written of a block pyramid\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Without an increment, one is estimated from the points read ahead */
+  bbatch_init (&bb);
+  if ((estimated = !(inc > 0)))
+    inc = bbatch_increment (&bb, infile, ptrec, region, max_memory,
+			    sparse ? (double) (sizeof (btile_t) + 4 * sizeof (ssize_t)) / (BTILE * BTILE) : 0.625,
+			    nthreads, vflag);
+
+  /* The cells are a whole number of steps; an estimate is made one */
+  if (quantum > 0)
+    {
+      bb.quantum = quantum, bb.qinc = (int64_t) round (inc / quantum);
+      if (bb.qinc < 1 || fabs (bb.qinc * quantum - inc) > 1e-9 * inc)
+	{
+	  if (estimated)
+	    {
+	      bb.qinc = max (1, (int64_t) ceil (inc / quantum));
+	      if (vflag > 0) fprintf (stderr, "bounds: using a block increment of %d steps of %g\n", (int) bb.qinc, quantum);
+	    }
+	  else
+	    {
+	      fprintf (stderr, "bounds: the block increment %g is not a whole number of --quantize steps of %g\n", inc, quantum);
+	      exit (EXIT_FAILURE);
+	    }
+	}
+      inc = bb.qinc * quantum;
+    }
+
+  if (sparse)
+    {
+      bbs_block_tiles (infile, &bb, inc, region, max_memory, pyr, morph, raster, nthreads, vflag, jflag);
+      bbatch_free (&bb);
+      return (0);
+    }
+
+  /* Gather region info 
+   */
+  xyi = region;
+  if (vflag > 0) fprintf (stderr, "bounds: using user supplied region: %f/%f/%f/%f\n", 
+			  xyi.xmin, xyi.xmax, xyi.ymin, xyi.ymax);
+
+  /* Set the rows and columns of the internal grid 
+   */
+  ysize = fabs((xyi.ymax - xyi.ymin) / inc);// + 1;
+  xsize = fabs((xyi.xmax - xyi.xmin) / inc);// + 1;
+
+  if (vflag > 0)
+    fprintf(stderr,"bounds: size of internal grid: %d/%d\n", 
+	    ysize, xsize);
+
+  /* Allocate memory for the grid; a bit for each cell's point data
+   * location information and four for its edges.
+   */
+  if (bgrid_init (&bg, xsize, ysize) != 0)
+    {
+      if (vflag > 0) 
+	fprintf (stderr,"bounds: failed to allocate needed memory, try increasing the distance value (%f)\n", inc);
+      exit (EXIT_FAILURE);
+    }
+
+  if (vflag > 0) fprintf(stderr,"bounds: gridding points\n");
+  if (morph && morph->min_count > 1)
+    bgrid_count_init (&bg, morph->min_count);
+
+  /* Points are read, parsed and gridded a batch at a time over the threads */
+  while (bbatch_read (&bb, infile, ptrec, nthreads, vflag) > 0)
+    {
+      bbatch_cells (&bb, inc, xyi.xmin, xyi.ymin, xsize, ysize, &bg, nthreads);
+      if (morph && morph->track > 0)
+	for (i = 0; i < bb.n; i++)
+	  bbatch_track (&bb, i, morph->track, &bg);
+      npr += bb.n;
+    }
+  bbatch_free (&bb);
+
   if (vflag > 0) 
-    fprintf (stderr,"bounds: found %d total boundary points\n", fcount);
+    fprintf (stderr,"bounds: %zd points gridded\n", npr);
+
+  if (morph)
+    {
+      if (vflag > 0) fprintf (stderr,"bounds: shaping the grid\n");
+      if (morph->min_count > 1)
+	bgrid_threshold (&bg, morph->min_count);
+      bgrid_morph (&bg, morph, 0);
+    }
+
+  if (raster)
+    fcount = block_raster (&bg, inc, xyi, 0, raster, vflag);
+  else
+    {
+      if (vflag > 0) fprintf (stderr,"bounds: recording edges from grid\n");
+      fcount = block_levels (&bg, inc, xyi, 0, pyr, morph ? morph->min_area : 0, nthreads, vflag, jflag);
+    }
 
-  free (bnds);
-  bnds = NULL;
+  /* Cleanup up and return.
+   */
+  bgrid_free (&bg);
+  
+  if (vflag > 0 && !raster)
+    fprintf (stderr,"bounds: found %zd total boundary points\n", fcount);
   
   return (0);
 }
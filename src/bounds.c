@@ -13,12 +13,16 @@
  *--------------------------------------------------------------*/
 
 #include <getopt.h>
+#include <unistd.h>
 #include "bounds.h"
 
 /* Flags set by `--version' and `--help' */
 static int version_flag;
 static int help_flag;
 static int verbose_flag;
+static int prefilter_flag;
+static int inside_flag;
+static int outside_flag;
 
 static void
 print_version(const char* command_name, const char* command_version) 
@@ -50,17 +54,55 @@ Generate a boundary of the set of xy points from FILE, or standard input, to sta
   -n, --name\t\tThe output layer name (only used with -g or -j).\n\
   -r, --record\t\tThe input record order, 'xy' should represent the locations\n\
               \t\tof the x and y records, respectively (e.g. --record zdyx).\n\
-  -s, --skip\t\tThe number of lines to skip from the input.\n\n\
+  -s, --skip\t\tThe number of lines to skip from the input.\n\
+      --quantize\tSnap the input xy to whole steps of this size (e.g. 0.001), held as\n\
+                \t32 bit integers from the first point (with -x, -v or -k).\n\n\
   ---- bounds ----\n\n\
   -b, --box\t\t'Bounding Box' boundary. \n\
   -k, --block\t\t'Bounding Block' boundary. Specify the blocking increment\n\
              \t\tin input units (e.g. --block 0.001). Specify a blocking region\n\
-             \t\tafter the increment if desired (e.g. --block 0.001/west/east/south/north).\n\
+             \t\tafter the increment if desired (e.g. --block 0.001/west/east/south/north);\n\
+             \t\twithout one, blocks are aligned to whole multiples of the increment.\n\
+             \t\tSpecify - as the increment to estimate one from the point spacing.\n\
+      --max-memory\tWith --block, keep the grid within about this many bytes (e.g. 512M),\n\
+                  \tspilling it to a temporary directory ($TMPDIR or /tmp) as it grows.\n\
+      --pyramid\t\tWith --block, output this many levels, each coarser by a factor\n\
+               \t\t(default 2) after a slash, as their own layers (e.g. --pyramid 3/10).\n\
+      --track\t\tWith --block, join consecutive points no more than this far apart\n\
+             \t\twith the blocks of the line between them, as along a ship's track.\n\
+      --min-count\tWith --block, only count a block holding at least this many points.\n\
+      --dilate\t\tWith --block, grow the blocks by this many cells all round.\n\
+      --erode\t\tWith --block, shrink the blocks by this many cells all round.\n\
+      --close\t\tWith --block, grow then shrink the blocks by this many cells,\n\
+             \t\tclosing the gaps between them narrower than twice that.\n\
+      --fill\t\tWith --block, fill the holes of fewer than this many cells.\n\
+      --min-area\tWith --block, leave out the polygons and holes of fewer than this many cells.\n\
+      --raster\t\tWith --block, write the blocks as a raster mask instead of a boundary:\n\
+              \t\t'asc' (ESRI ASCII grid), 'gmt' (GMT native binary grid of bytes, =bb)\n\
+              \t\tor 'rle' (the lengths of the empty and occupied runs of each row).\n\
   -v, --concave\t\t'Concave Hull' boundary using a distance weighted package wrap algorithm.\n\
-               \t\tSpecify distance value or - to estimate appropriate distance.\n\
+               \t\tSpecify distance value or - to estimate appropriate distance; the smallest\n\
+               \t\tdistance (from the given value up) whose boundary holds every point is used.\n\
+  -m, --multi\t\tWith --concave, output a polygon for each group of points linked by the\n\
+             \t\tdistance value instead of one polygon holding them all.\n\
+      --prefilter\tWith --concave, only hull the points in grid cells near empty cells;\n\
+                 \tmuch faster on dense data, though the boundary may differ slightly.\n\
+  -a, --alpha\t\t'Alpha Shape' boundary from a Delaunay triangulation, dropping triangles\n\
+             \t\twith an edge longer than the distance value; outputs every polygon and hole.\n\
+             \t\tSpecify distance value or - to estimate appropriate distance.\n\
+  -c, --dig\t\t'Concave Hull' boundary dug into the convex hull edges towards the nearest\n\
+           \t\tinner points. Specify the concavity and optionally a minimum edge length\n\
+           \t\tto dig (e.g. --dig 2/0), or - to use the defaults (2/0).\n\
   -x, --convex\t\t'Convex Hull' boundary using a monotone chain algorithm. [default]\n\
               \t\tUse twice to use a package wrap algorithm (e.g. -xx).\n\n\
+  ---- query ----\n\n\
+  -q, --query\t\tClassify the xy points against the boundary in the given file (GMT or\n\
+             \t\tGeoJSON, as output by bounds), appending 1 (inside) or 0 (outside) to\n\
+             \t\teach record instead of generating a boundary.\n\
+      --inside\t\tWith --query, output only the records inside the boundary.\n\
+      --outside\t\tWith --query, output only the records outside the boundary.\n\n\
   ---- et cetra ----\n\n\
+  -t, --threads\t\tThe number of threads to use. [default: the number of processors]\n\
       --verbose\t\tincrease the verbosity.\n\
       --help\t\tprint this help menu and exit.\n\
       --version\t\tprint version information and exit.\n\n\
@@ -72,6 +114,16 @@ Examples:\n\
   bounds -g -k0.0001\toutput a GMT formatted 'block' boundary from standard input.\n\
   bounds -v10 -d,\toutput a concave hull from comma-delimited standard input.\n\
   bounds -v- in.xyz\toutput a concave hull from file in.xyz\n\
+  bounds -a- -j in.xyz\toutput a GeoJSON alpha shape from file in.xyz\n\
+  bounds -v5 -m in.xyz\toutput a concave hull of each group of points in file in.xyz\n\
+  bounds -q b.gmt in.xyz\tflag the points of file in.xyz inside the boundary b.gmt\n\
+  bounds -g -k0.0001 --pyramid 3/10 in.xyz\toutput 'block' boundaries at 0.0001, 0.001 and 0.01\n\
+  bounds -g -k0.0001 --close 3 --fill 100 in.xyz\toutput a 'block' boundary bridging gaps of up to 6 cells\n\
+  bounds -g -k0.0001 --min-count 3 --min-area 10 in.xyz\toutput a 'block' boundary without stray soundings\n\
+  bounds -g -k0.0001 --track 0.01 in.xyz\toutput a 'block' boundary along single-beam tracks\n\
+  bounds -k0.0001 --raster asc in.xyz > mask.asc\twrite the 'blocks' as an ESRI ASCII grid\n\
+  bounds -g -k- --verbose in.xyz\toutput a 'block' boundary at an increment estimated from in.xyz\n\
+  bounds -v- --quantize 0.001 in.xyz\toutput a concave hull of millimetre points from file in.xyz\n\
 \n\
 Report bugs to <matthew.love@colorado.edu>\n\
 CIRES DEM home page: <http://ciresgroups.colorado.edu/coastalDEM>\n\
@@ -151,6 +203,20 @@ sort_min_x (const void* a, const void* b)
     return 0;
 }
 
+/* Parse a size in bytes, with an optional K, M or G suffix
+ */
+static size_t
+parse_size (char* str)
+{
+  char* end;
+  double size = strtod (str, &end);
+
+  if (*end == 'k' || *end == 'K') size *= 1024.0;
+  else if (*end == 'm' || *end == 'M') size *= 1024.0 * 1024.0;
+  else if (*end == 'g' || *end == 'G') size *= 1024.0 * 1024.0 * 1024.0;
+  return size > 0 ? (size_t) size : 0;
+}
+
 int
 region_valid_p (region_t *region) 
 {
@@ -163,30 +229,6 @@ region_valid_p (region_t *region)
   return 1;
 }
 
-/* Quick and Dirty Density
- * TODO: use a convex hull instaed of bb.
- */
-double
-qadd (point_t* points, int npoints)
-{
-  int i, xmin, xmax, ymin, ymax;
-  line_t l1, l2, l3, l4;
-  double w, l;
-  
-  for (ymin = 0, ymax = 0, xmin = 0, xmax = 0, i = 1; i < npoints; i++) 
-    {
-      if (points[i].y < points[ymin].y) ymin = i;
-      if (points[i].x < points[xmin].x) xmin = i;
-      if (points[i].y > points[ymax].y)	ymax = i;
-      if (points[i].x > points[xmax].x)	xmax = i;
-    }
-
-  w = points[xmax].x - points[xmin].x;
-  l = points[ymax].y - points[ymin].y;
-
-  return ((w * l) / npoints) ;
-}
-
 int
 main (int argc, char **argv) 
 {
@@ -195,12 +237,13 @@ main (int argc, char **argv)
 
   int c, i, status, min, j;
   int inflag = 0, vflag = 0, sflag = 0, dflag = 0, pc = 0, sl = 0;
-  int cflag = 0, kflag = 0, bflag = 0, gmtflag = 0, jsonflag = 0, nflag = 0;
-  double dist;
+  int cflag = 0, kflag = 0, bflag = 0, gmtflag = 0, jsonflag = 0, nflag = 0, aflag = 0, gflag = 0, mflag = 0, qflag = 0;
+  int nthreads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  int raster = 0;
+  double dist, quantum = 0;
 
-  point_t rpnt, pnt;
-  point_ptr_t hull0[MAX_HULLS];
-  point_ptr_t* hull = hull0;
+  point_t pnt;
+  ring_t hull;
   ssize_t hullsize;
   ssize_t npr = 0;
 
@@ -208,7 +251,14 @@ main (int argc, char **argv)
   char* delim;
   char* ptrec = "xy";
   char* kreg = "";
+  char* greg = "";
   char* lname = "bounds";
+  char* qfn = NULL;
+  size_t max_memory = 0;
+  bpyramid_t pyr = {0, 2, NULL, 0};
+  bmorph_t morph = {0, 0, 0, 0, 0, 0, 0};
+  char lbuf[MAX_RECORD_LENGTH];
+  char* slash;
   
   while (1) 
     {
@@ -218,6 +268,9 @@ main (int argc, char **argv)
 	  {"version", no_argument, &version_flag, 1},
 	  {"help", no_argument, &help_flag, 1},
 	  {"verbose", no_argument, &verbose_flag, 1},
+	  {"prefilter", no_argument, &prefilter_flag, 1},
+	  {"inside", no_argument, &inside_flag, 1},
+	  {"outside", no_argument, &outside_flag, 1},
 	  /* These options don't set a flag.
 	     We distinguish them by their indices. */
 	  {"delimiter", required_argument, 0, 'd'},
@@ -230,12 +283,28 @@ main (int argc, char **argv)
 	  {"block", required_argument, 0, 'k'},
 	  {"convex", no_argument, 0, 'x'},
 	  {"concave", required_argument, 0, 'v'},
+	  {"alpha", required_argument, 0, 'a'},
+	  {"dig", required_argument, 0, 'c'},
+	  {"threads", required_argument, 0, 't'},
+	  {"multi", no_argument, 0, 'm'},
+	  {"query", required_argument, 0, 'q'},
+	  {"max-memory", required_argument, 0, 'M'},
+	  {"pyramid", required_argument, 0, 'P'},
+	  {"track", required_argument, 0, 'T'},
+	  {"min-count", required_argument, 0, 'N'},
+	  {"dilate", required_argument, 0, 'D'},
+	  {"erode", required_argument, 0, 'E'},
+	  {"close", required_argument, 0, 'C'},
+	  {"fill", required_argument, 0, 'F'},
+	  {"min-area", required_argument, 0, 'A'},
+	  {"raster", required_argument, 0, 'R'},
+	  {"quantize", required_argument, 0, 'Q'},
 	  {0, 0, 0, 0}
 	};
       /* getopt_long stores the option index here. */
       int option_index = 0;
       
-      c = getopt_long (argc, argv, "gjd:n:r:s:bk:xv:",
+      c = getopt_long (argc, argv, "gjd:n:r:s:bk:xv:a:c:t:mq:",
 		       long_options, &option_index);
     
       /* Detect the end of the options. */
@@ -287,6 +356,78 @@ main (int argc, char **argv)
 	vflag++;
 	dist = atof(optarg);
 	break;
+      case 'a':
+	aflag++;
+	dist = atof(optarg);
+	break;
+      case 'c':
+	gflag++;
+	greg = optarg;
+	break;
+      case 't':
+	nthreads = atoi(optarg);
+	break;
+      case 'm':
+	mflag++;
+	break;
+      case 'q':
+	qflag++;
+	qfn = optarg;
+	break;
+      case 'M':
+	max_memory = parse_size (optarg);
+	break;
+      case 'P':
+	pyr.levels = atoi (optarg);
+	if ((slash = strchr (optarg, '/')) != NULL)
+	  pyr.factor = atoi (slash + 1);
+	if (pyr.levels < 1 || pyr.factor < 2)
+	  {
+	    fprintf (stderr, "bounds: --pyramid wants a number of levels and a factor of 2 or more (e.g. 3/10)\n");
+	    exit (1);
+	  }
+	break;
+      case 'T':
+	morph.track = atof (optarg);
+	break;
+      case 'N':
+	morph.min_count = atoi (optarg);
+	if (morph.min_count > UINT16_MAX)
+	  {
+	    fprintf (stderr, "bounds: --min-count can be at most %d\n", UINT16_MAX);
+	    exit (1);
+	  }
+	break;
+      case 'D':
+	morph.dilate = atoi (optarg);
+	break;
+      case 'E':
+	morph.erode = atoi (optarg);
+	break;
+      case 'C':
+	morph.close = atoi (optarg);
+	break;
+      case 'F':
+	morph.fill = atol (optarg);
+	break;
+      case 'A':
+	morph.min_area = atol (optarg);
+	break;
+      case 'R':
+	if ((raster = block_raster_format (optarg)) == 0)
+	  {
+	    fprintf (stderr, "bounds: --raster wants one of asc, gmt or rle\n");
+	    exit (1);
+	  }
+	break;
+      case 'Q':
+	quantum = atof (optarg);
+	if (!(quantum > 0))
+	  {
+	    fprintf (stderr, "bounds: --quantize wants a step size more than 0 (e.g. 0.001)\n");
+	    exit (1);
+	  }
+	break;
 	
       case '?':
 	/* getopt_long already printed an error message. */
@@ -331,12 +472,66 @@ main (int argc, char **argv)
   if (verbose_flag > 0) 
     fprintf (stderr, "bounds: working on file: %s\n", fn);
   
-  /* Allocate memory for the `pnts` and `pnts2` array using the total number of points.
-     `pnts2` is only used by concave and gets allocated there.
+  /* Allocate memory for the `pnts` array; it grows to the total number of points as they load.
+     The concave search leaves them in place, working on permutations of their indices.
   */
   point_t* pnts;
   pnts = (point_t*) malloc (sizeof (point_t));
 
+  /* Quantized points are hulled by the convex (monotone chain) and concave hulls
+     and gridded by the blocks
+   */
+  if (quantum > 0 && (qflag > 0 || bflag > 0 || aflag > 0 || gflag > 0 || cflag > 1))
+    {
+      fprintf (stderr, "bounds: --quantize works with --convex (not -xx), --concave or --block\n");
+      exit (1);
+    }
+
+  /* Classify the points against an existing boundary instead of making one.
+   */
+  if (qflag > 0)
+    {
+      rings_t qrings;
+      FILE* qfp = fopen (qfn, "r");
+      if (!qfp)
+	{
+	  fprintf (stderr,"bounds: failed to open file: %s\n", qfn);
+	  exit (1);
+	}
+      rings_init (&qrings);
+      if (rings_load (qfp, &qrings) == 0)
+	{
+	  fprintf (stderr,"bounds: no boundary found in file: %s\n", qfn);
+	  exit (1);
+	}
+      fclose (qfp);
+      if (verbose_flag > 0)
+	fprintf (stderr, "bounds: classifying against %d boundary rings\n", qrings.nrings);
+
+      query_points (fp, &qrings, ptrec, dflag > 0 ? delim : NULL,
+		    inside_flag - outside_flag, nthreads, verbose_flag);
+      rings_free (&qrings);
+      exit (0);
+    }
+
+  /* The layers of a block pyramid are named for their increments
+   */
+  if (kflag > 0 && pyr.levels > 0)
+    {
+      if (kreg[0] == '-' && (kreg[1] == '\0' || kreg[1] == '/'))
+	{
+	  fprintf (stderr, "bounds: a block pyramid wants an increment, not -\n");
+	  exit (1);
+	}
+      pyr.name = lname, pyr.gflag = gmtflag;
+      snprintf (lbuf, sizeof (lbuf), "%s_%g", lname, atof (kreg));
+      lname = lbuf;
+    }
+
+  /* A raster has no vector header or footer */
+  if (kflag > 0 && raster)
+    gmtflag = 0, jsonflag = 3;
+
   /* This is for the GMT compatibility. More can be done here.
    */
   if (gmtflag == 1)
@@ -370,28 +565,58 @@ main (int argc, char **argv)
     printf (">\n");
     
   /* The default is a convex hull -- `cflag` */
-  if (cflag == 0 && vflag == 0 && bflag == 0 && kflag == 0) 
+  if (cflag == 0 && vflag == 0 && bflag == 0 && kflag == 0 && aflag == 0 && gflag == 0) 
     cflag++;
   
   /* Monotone Chain Convex Hull Algorithm - -*Default*-
    */
-  if (cflag == 1) 
+  if (cflag == 1 && quantum > 0)
+    {
+      quant_t q;
+      qpoint_t* qpnts = NULL;
+
+      quant_init (&q, quantum);
+      load_qpnts (fp, &qpnts, &npr, ptrec, &q, verbose_flag);
+      qsort (qpnts, npr, sizeof (qpoint_t), compare_qxy);
+      ring_init (&hull);
+      mc_convex_q (qpnts, npr, &hull);
+      hullsize = hull.n;
+
+      for (i = 0; i < hullsize; i++)
+	{
+	  pnt = quant_unpoint (&q, qpnts[hull.idx[i]].x, qpnts[hull.idx[i]].y);
+	  if (jsonflag > 0)
+	    printf (i < hullsize - 1 ? "[%f, %f], " : "[%f, %f]", pnt.x, pnt.y);
+	  else
+	    printf ("%f %f\n", pnt.x, pnt.y);
+	}
+      ring_free (&hull);
+      free (qpnts);
+
+      if (verbose_flag > 0) 
+	fprintf (stderr, "bounds: found %d convex boundary points.\n", hullsize);
+    }
+
+  else if (cflag == 1) 
     {
       load_pnts (fp, &pnts, &npr, ptrec, verbose_flag);
       qsort (pnts, npr, sizeof (point_t), compare);
-      mc_convex (pnts, npr, &hull, &hullsize);
+      ring_init (&hull);
+      mc_convex (pnts, npr, &hull);
+      hullsize = hull.n;
 
       if (jsonflag > 0)
 	{
 	  for (i = 0; i < hullsize-1; i++)
-	    printf ("[%f, %f], ", hull[i]->x, hull[i]->y);
-	  printf("[%f, %f]", hull[hullsize-1]->x, hull[hullsize-1]->y);
+	    printf ("[%f, %f], ", pnts[hull.idx[i]].x, pnts[hull.idx[i]].y);
+	  printf("[%f, %f]", pnts[hull.idx[hullsize-1]].x, pnts[hull.idx[hullsize-1]].y);
 	}
       else
 	{
 	  for (i = 0; i < hullsize; i++)
-	    printf ("%f %f\n", hull[i]->x, hull[i]->y);
+	    printf ("%f %f\n", pnts[hull.idx[i]].x, pnts[hull.idx[i]].y);
 	}
+      ring_free (&hull);
 
       if (verbose_flag > 0) 
 	fprintf (stderr, "bounds: found %d convex boundary points.\n", hullsize);
@@ -425,124 +650,137 @@ main (int argc, char **argv)
    * points, using whatever distance value is needed to
    * accomplish that.
    */
-  else if (vflag == 1) 
+  else if (vflag == 1 && mflag == 0) 
     {
+      rings_t rings;
+      quant_t q;
+
       load_pnts (fp, &pnts, &npr, ptrec, verbose_flag);
 
       /* The distance parameter can't be less than zero */
-      if (!dist)
-	dist = qadd (pnts, npr);
-      if (dist > 0) hullsize = -1;
-      else hullsize = 0;
-
-      /* if (verbose_flag > 0) */
-      /* 	fprintf (stderr,"bounds: %-10s %-10s\n\rbounds: %-10d %-10.12f", "iteration", "distance", pc, dist); */
-
-      /* Keep a copy of the original point-set in `pts2` in-case
-	 * we need to re-run with a higher `dist` value. */
-      point_t* pnts2;  
-      pnts2 = (point_t*) malloc ((npr + 1) * sizeof (point_t));
-      memcpy (pnts2, pnts, sizeof (point_t) * (npr + 1));
-      
-      /* Find a boundary, inrease the distance variable until a boundary is found. */
-      while (hullsize == -1) 
+      if (dist < 0) dist = 0;
+
+      /* Quantized, the hull is made in steps and put back in input units */
+      if (quantum > 0)
 	{
-	  hullsize = dpw_concave (pnts, npr, dist);
-	  
-	  /* If a hull was found, check that it gathered all the points.
-	   * We want to have a 'hull' in that the output contains all points
-	   * within the boundary polygon. Otherwise instead of increasing
-	   * the boundary we could run on outside points to output a 
-	   * multipolygon.
-	   * If there are points still outside the boundary, increase the
-	   * distance and retry.
-	   */
-	  if (hullsize >= 0)
-	    for (i = hullsize+1; i < npr; i++)
-	      if (!inside_p (&pnts[i], pnts, hullsize)) 
-		{
-		  hullsize = -1;
-		  break;
-		}
-
-	  /* If a hull wasn't found, increase the `dist` and try again. */
-	  if (hullsize == -1) 
-	    {
-	      dist += dist, pc++;
-	      memcpy (pnts, pnts2, sizeof (point_t) * (npr + 1));
-	      /* if (verbose_flag > 0)  */
-	      /* 	{ */
-	      /* 	  fprintf (stderr,"\rbounds: %-10d %-10.12f", pc, dist); */
-	      /* 	  fflush (stderr); */
-	      /* 	} */
-	    }
-	  
-	  /* In case something funky happens; just make a convex hull */
-	  if (dist == INFINITY || dist == NAN || dist < 0)
-	    { 
-	      memcpy (pnts, pnts2, sizeof (point_t) * (npr + 1));
-	      hullsize = pw_convex (pnts, npr);
-	    }
+	  quant_init (&q, quantum);
+	  quant_pnts (pnts, npr, &q);
+	  dist /= quantum;
+	  hull_lattice (1);
 	}
-      
+
+      /* Find the smallest distance (from `dist` up, or from an estimate if
+       * `dist` is zero) whose boundary holds all the points. */
+      rings_init (&rings);
+      hullsize = dpw_concave_search (pnts, npr, &dist, nthreads, prefilter_flag, verbose_flag, &rings);
+      if (quantum > 0)
+	quant_rings (&rings, &q), dist *= quantum;
+
       /* Print out the hull */
-      if (jsonflag > 0)
+      rings_print (&rings, jsonflag);
+      rings_free (&rings);
+      
+      if (verbose_flag > 0) 
+	  fprintf (stderr, "bounds: found %zd total boundary points using distance %f\n", hullsize, dist);
+  }
+
+  /* Concave Hulls - one for each group of points linked by the distance
+   * Note: outputs a multipolygon rather than growing the distance until
+   * a single polygon holds every group.
+   */
+  else if (vflag == 1)
+    {
+      rings_t rings;
+      quant_t q;
+      int npolys;
+
+      load_pnts (fp, &pnts, &npr, ptrec, verbose_flag);
+
+      /* The distance parameter can't be less than zero */
+      if (dist < 0) dist = 0;
+
+      if (quantum > 0)
 	{
-	  for (i = 0; i < hullsize; i++)
-	    printf ("[%f, %f], ", pnts[i].x, pnts[i].y);
-	  printf ("[%f, %f]", pnts[hullsize].x, pnts[hullsize].y);
+	  quant_init (&q, quantum);
+	  quant_pnts (pnts, npr, &q);
+	  dist /= quantum;
+	  hull_lattice (1);
 	}
+
+      npolys = dpw_concave_multi (pnts, npr, &dist, nthreads, prefilter_flag, verbose_flag, &rings);
+      if (quantum > 0)
+	quant_rings (&rings, &q), dist *= quantum;
+      rings_print (&rings, jsonflag);
+
+      if (verbose_flag > 0)
+	fprintf (stderr, "bounds: found %zd total boundary points in %d polygons using distance %f\n",
+		 rings.npnts, npolys, dist);
+      rings_free (&rings);
+    }
+
+  /* Alpha Shape - Delaunay triangulation less the triangles with long edges
+   * Note: unlike the concave hull this runs once at the given distance and 
+   * outputs every polygon (and hole) that is left.
+   */
+  else if (aflag == 1)
+    {
+      rings_t rings;
+      
+      load_pnts (fp, &pnts, &npr, ptrec, verbose_flag);
+
+      /* The distance parameter can't be less than zero */
+      if (dist < 0) dist = 0;
+      
+      if (alpha_shape (pnts, npr, &dist, &rings) < 0)
+	fprintf (stderr, "bounds: failed to triangulate the points, they may be collinear\n");
       else
 	{
-	  for (i = 0; i <= hullsize; i++)
-	    printf ("%f %f\n", pnts[i].x, pnts[i].y);
+	  rings_print (&rings, jsonflag);
+
+	  if (verbose_flag > 0) 
+	    fprintf (stderr, "bounds: found %zd total boundary points in %d rings using distance %f\n",
+		     rings.npnts, rings.nrings, dist);
+	  rings_free (&rings);
+	}
+    }
+  
+  /* Concave Hull - dig into the convex hull
+   * Note: a single polygon in one pass, the concavity sets how
+   * far an edge may be dug in relative to its length.
+   */
+  else if (gflag == 1)
+    {
+      rings_t rings;
+      double concavity = 0, length = 0;
+      
+      char* p = strtok (greg, "/");
+      if (p != NULL)
+	{
+	  concavity = atof (p);
+	  p = strtok (NULL, "/");
+	  if (p != NULL)
+	    length = atof (p);
 	}
       
+      load_pnts (fp, &pnts, &npr, ptrec, verbose_flag);
+      hullsize = dig_concave (pnts, npr, concavity, length, &rings);
+      rings_print (&rings, jsonflag);
+      
       if (verbose_flag > 0) 
-	  fprintf (stderr, "bounds: found %d total boundary points\n", hullsize);
-
-      free (pnts2);
-      pnts2 = NULL;
-  }
+	fprintf (stderr, "bounds: found %zd total boundary points\n", hullsize);
+      rings_free (&rings);
+    }
   
   /* Bounding Box - Generate a box around the given points.
    */
   else if (bflag == 1) 
     {
       double ymin, ymax, xmin, xmax;
+      region_t box = {0, 0, 0, 0};
       /* Read through the point records and find the min/max bounding box.
        */
-      i = 0;
-      while (read_point(fp, &rpnt, &delim, ptrec, dflag, verbose_flag) == 0) 
-	{
-	  if (sl > 0) 
-	    sl--;
-	  else 
-	    {
-	      npr++;
-	      if (i==0)
-		{
-		  ymin = rpnt.y;
-		  ymax = rpnt.y;
-		  xmin = rpnt.x;
-		  xmax = rpnt.x;
-		}
-	      else
-		{
-		  if (rpnt.y < ymin) 
-		    ymin = rpnt.y;
-		  if (rpnt.x < xmin) 
-		    xmin = rpnt.x;
-		  if (rpnt.y > ymax) 
-		    ymax = rpnt.y;
-		  if (rpnt.x > xmax) 
-		    xmax = rpnt.x;
-		}
-	      i++;
-	      if (i>1)
-		dflag++;
-	    }
-	}
+      bbs_box (fp, &delim, ptrec, dflag, sl, nthreads, &box, &npr, verbose_flag);
+      xmin = box.xmin, xmax = box.xmax, ymin = box.ymin, ymax = box.ymax;
 
       if (jsonflag > 0)
 	{
@@ -569,7 +807,7 @@ main (int argc, char **argv)
   else if (kflag > 0) 
     {
       int kr_length;
-      region_t rgn;
+      region_t rgn = {0, 0, 0, 0};
       
       kr_length = strlen (kreg);
       char* p = strtok (kreg, "/");
@@ -578,7 +816,7 @@ main (int argc, char **argv)
 	  if (p != NULL) 
 	    {
 	      if (j == 0) 
-		dist = atof (p);
+		dist = strcmp (p, "-") == 0 ? 0 : atof (p);
 	      if (j == 1) 
 		rgn.xmin = atof (p);
 	      if (j == 2) 
@@ -591,8 +829,11 @@ main (int argc, char **argv)
 	  p = strtok (NULL, "/");
 	}
 
-      /* The distance parameter can't be less than zero */
-      if (dist > 0) bbs_block (fp, dist, rgn, verbose_flag, jsonflag);
+      /* The distance parameter can't be less than zero; with - it's estimated */
+      if (dist > 0 || strcmp (kreg, "-") == 0) bbs_block (fp, dist, quantum, rgn, max_memory, pyr.levels > 0 ? &pyr : NULL,
+			       (morph.track > 0 || morph.min_count > 1 || morph.dilate > 0 || morph.erode > 0 || morph.close > 0
+				|| morph.fill > 0 || morph.min_area > 0) ? &morph : NULL,
+			       raster, nthreads, verbose_flag, jsonflag);
     }
 
   free (pnts);
@@ -19,11 +19,11 @@
 #include <math.h>
 #include <float.h>
 #include <limits.h>
+#include <stdint.h>
 
 #define BOUNDS_VERSION "0.5.9"
 
 #define MAX_RECORD_LENGTH 1024
-#define MAX_HULLS 100000
 
 #ifndef INFINITY
 #define INFINITY (1.0 / 0.0)
@@ -44,6 +44,37 @@ typedef struct
  
 typedef point_t* point_ptr_t;
 
+/* A point as whole steps of `quant_t.scale` from the `quant_t` origin;
+ * the steps are less than QUANT_MAX each way (see quant.c).
+ */
+#define QUANT_MAX (1 << 30)
+
+typedef struct
+{
+  int32_t x;
+  int32_t y;
+} qpoint_t;
+
+typedef struct
+{
+  double ox;
+  double oy;
+  double scale;
+} quant_t;
+
+/* An index into a point array; point counts are `int`, so they always fit.
+ */
+typedef uint32_t pidx_t;
+
+/* A growable ring of point indices, `idx[0]` to `idx[n-1]`.
+ */
+typedef struct
+{
+  pidx_t* idx;
+  ssize_t n;
+  ssize_t cap;
+} ring_t;
+
 typedef struct 
 {
   point_t p1, p2;
@@ -79,6 +110,257 @@ typedef struct
   double ymax;
 } region_t;
 
+/* The number of edges a polygon index query tests at once */
+#define POLYIDX_LANES 4
+
+/* The edges of closed polygon rings, bucketed by horizontal band;
+ * band `b` lists the edges reaching into it (by their first vertex)
+ * from `edge[start[b]]` to `edge[start[b+1]-1]`.
+ * The same edges are copied out by coordinate from `vx0[vstart[b]]` on,
+ * padded to a multiple of POLYIDX_LANES.
+ */
+typedef struct
+{
+  point_t* poly;
+  ssize_t nedges;
+  double ymin;
+  double ymax;
+  double band;
+  int nbands;
+  int* start;
+  int* edge;
+  int* vstart;
+  double* vx0;
+  double* vy0;
+  double* vx1;
+  double* vy1;
+} polyidx_t;
+
+/* A set of closed polygon rings.
+ * Ring `i` is `pnts[start[i]]` to `pnts[start[i+1]-1]`, with the first point repeated last.
+ * `hole[i]` is 1 if the ring is a hole of the outer ring `owner[i]`.
+ */
+typedef struct
+{
+  point_t* pnts;
+  ssize_t npnts;
+  ssize_t pcap;
+  ssize_t* start;
+  int* hole;
+  int* owner;
+  int nrings;
+  int rcap;
+} rings_t;
+
+/* The geometry of a uniform grid of square cells
+ */
+typedef struct
+{
+  double xmin;
+  double ymin;
+  double cell;
+  int nx;
+  int ny;
+} grid_t;
+
+/* A uniform grid of point indices; the points in cell `c` are
+ * `idx[start[c]]` to `idx[start[c+1]-1]`.
+ */
+typedef struct
+{
+  grid_t g;
+  int* start;
+  int* idx;
+} pgrid_t;
+
+/* A uniform grid of segment ids, chained through `next` from each cell's `head`.
+ * `found` holds the ids from the last query.
+ */
+typedef struct
+{
+  grid_t g;
+  int* head;
+  int* next;
+  int* seg;
+  int nnodes;
+  int cap;
+  int* mark;
+  int nmark;
+  int stamp;
+  int* found;
+  int nfound;
+  int found_cap;
+} sgrid_t;
+
+/* The edges of a block grid cell */
+#define BGRID_B 1
+#define BGRID_L 2
+#define BGRID_T 4
+#define BGRID_R 8
+
+/* The side of a sparse block grid tile, in cells */
+#define BTILE_SHIFT 6
+#define BTILE (1 << BTILE_SHIFT)
+
+/* A tile of a sparse block grid, at tile column `tx` and row `ty`;
+ * bit `c` of `occ[r]` is cell (c, r) of the tile.  While the points are
+ * being counted, `cnt` holds the count of each cell, in row order.
+ */
+typedef struct
+{
+  int64_t tx;
+  int64_t ty;
+  uint64_t occ[BTILE];
+  uint8_t edge[BTILE * BTILE / 2];
+  void* cnt;
+} btile_t;
+
+/* A bit-packed block grid of `nx` by `ny` cells: one occupancy bit and four
+ * edge bits a cell.
+ * A dense grid keeps them in `occ` and `edge`, cell `k` being column `k % nx`
+ * of row `k / nx`.  A sparse grid (`tiles` not NULL) keeps only the tiles
+ * holding points, found by their tile coordinates through `hash`; once sealed,
+ * the tiles are in row order and cell (0, 0) is the first of tile (tx0, ty0).
+ * While the points are being counted, a dense grid keeps the count of each
+ * cell in `cnt`, saturating at `cmax`: a byte a cell up to 255, else two.
+ */
+typedef struct
+{
+  int nx;
+  int ny;
+  uint64_t* occ;
+  uint8_t* edge;
+  btile_t** tiles;
+  ssize_t ntiles;
+  ssize_t tcap;
+  ssize_t* hash;
+  size_t hcap;
+  int64_t tx0;
+  int64_t ty0;
+  void* cnt;
+  int cmax;
+} bgrid_t;
+
+/* A directed edge of a block grid cell, from the cell's column `xi`, row `yi`
+ * and which edge `f` it is (0 bottom, 1 left, 2 top, 3 right); ids sort
+ * by row, then column, then edge.
+ */
+typedef uint64_t bedge_t;
+
+#define BEDGE(xi, yi, f) (((uint64_t) (yi) << 33) | ((uint64_t) (xi) << 2) | (uint64_t) (f))
+#define BEDGE_X(e) ((int) (((e) >> 2) & 0x7FFFFFFF))
+#define BEDGE_Y(e) ((int) ((e) >> 33))
+#define BEDGE_F(e) ((int) ((e) & 3))
+
+/* A block pyramid: `levels` grids, each `factor` times coarser than the
+ * one before, printed as layers named `name` and the level's increment;
+ * `gflag` is set for GMT output.
+ */
+typedef struct
+{
+  int levels;
+  int factor;
+  char* name;
+  int gflag;
+} bpyramid_t;
+
+/* The shaping of a block grid: consecutive points no more than `track`
+ * apart are joined by the cells of the line between them, and a cell is
+ * occupied if it holds at least `min_count` points (or lines); then cells
+ * are dilated by `dilate` cells, eroded by `erode`, closed by `close`
+ * (dilated then eroded), and holes of fewer than `fill` cells are filled,
+ * in that order; 0 leaves a step out.
+ * Rings of fewer than `min_area` cells are left out of the boundary.
+ */
+typedef struct
+{
+  double track;
+  int min_count;
+  int dilate;
+  int erode;
+  int close;
+  ssize_t fill;
+  ssize_t min_area;
+} bmorph_t;
+
+/* The raster formats of a block grid, written in place of its boundary */
+#define BRASTER_ASC 1
+#define BRASTER_GMT 2
+#define BRASTER_RLE 3
+
+/* The number of records read and gridded together */
+#define BBATCH 65536
+
+/* The most points read ahead to estimate a block increment from */
+#define BBATCH_AHEAD (16 * BBATCH)
+
+/* A batch of `n` xy records read for gridding: their text, the points
+ * parsed from it and the cells they fall in (INT64_MIN for none).
+ * `delim` is the record delimiter, guessed from the first record, and
+ * `last` the last point of the batch before.  `tpnt` is the last point
+ * joined to a track, in cell (`tcx`, `tcy`), or `tcx` is INT64_MIN.
+ * The `npre` points of `pre` were read ahead, and are read again from
+ * `ipre` on before the rest of the file.  With `quantum` more than 0 the
+ * points are gridded in whole steps of it, `qinc` steps to a cell.
+ */
+typedef struct
+{
+  char* text;
+  ssize_t tcap;
+  ssize_t* line;
+  point_t* pnts;
+  int64_t* cx;
+  int64_t* cy;
+  char* delim;
+  point_t last;
+  point_t tpnt;
+  int64_t tcx;
+  int64_t tcy;
+  point_t* pre;
+  ssize_t npre;
+  ssize_t ipre;
+  double quantum;
+  int64_t qinc;
+  int n;
+  int done;
+} bbatch_t;
+
+/* The 8-connected components of the occupied cells of a block grid, as
+ * runs of cells `x0` to `x1` of row `y` in row order, joined in a
+ * union-find by `parent`.  `prev0` to `prev1` are the runs of the row
+ * below the one being added, which starts at run `row0`.
+ */
+typedef struct
+{
+  int* y;
+  int* x0;
+  int* x1;
+  ssize_t* parent;
+  ssize_t n;
+  ssize_t cap;
+  ssize_t prev0;
+  ssize_t prev1;
+  ssize_t row0;
+  int row;
+} blabel_t;
+
+#define bgrid_occ_p(bg, k) ((int) (((bg)->occ[(k) >> 6] >> ((k) & 63)) & 1))
+#define bgrid_occ_set(bg, k) ((bg)->occ[(k) >> 6] |= (uint64_t) 1 << ((k) & 63))
+#define bgrid_edges(bg, k) (((bg)->edge[(k) >> 1] >> (((k) & 1) << 2)) & 15)
+#define bgrid_edges_set(bg, k, f) ((bg)->edge[(k) >> 1] |= (f) << (((k) & 1) << 2))
+#define bgrid_edges_clear(bg, k, f) ((bg)->edge[(k) >> 1] &= ~((f) << (((k) & 1) << 2)))
+
+/* A Delaunay triangulation.
+ * `triangles` holds three point indices per triangle, counter-clockwise;
+ * `halfedges` holds the opposite half-edge of each half-edge, or -1 on the hull.
+ */
+typedef struct
+{
+  int* triangles;
+  int* halfedges;
+  int ntriangles;
+} delaunay_t;
+
 /* Line-Count 
  */
 ssize_t
@@ -101,12 +383,114 @@ auto_delim_l (char* inl, char** delimiter);
 int
 read_point (FILE *infile, point_t *rpnt, char** delimiter, char* pnt_recr, int dflag, int vflag);
 
+/* Parse the x and y of the record `line` into `rpnt`, following `pnt_recr`;
+ * returns 0 if both were read as numbers, otherwise -1.
+ */
+int
+parse_point (char* line, point_t* rpnt, char* delimiter, char* pnt_recr);
+
 int
 load_pnts (FILE *infile, point_t **pnts, ssize_t *npr, char* pnt_recr, int vflag);
 
+/* Quantized points, in steps of `scale`; the origin is set by the first point
+ */
+void
+quant_init (quant_t* q, double scale);
+
+/* The point `x`, `y` steps from the origin of `q`
+ */
+point_t
+quant_unpoint (quant_t* q, double x, double y);
+
+/* Load the points of `infile` into `pnts` as steps of `q`
+ */
+void
+load_qpnts (FILE *infile, qpoint_t **pnts, ssize_t *npr, char* pnt_recr, quant_t* q, int vflag);
+
+/* Snap the points to the steps of `q`, in place; each becomes its steps
+ * from the origin, as doubles.
+ */
+void
+quant_pnts (point_t* pnts, ssize_t npr, quant_t* q);
+
+/* Take the points of `rings` from steps of `q` back to input units
+ */
+void
+quant_rings (rings_t* rings, quant_t* q);
+
+/* Compare quantized points by x, then y, for use in qsort
+ */
+int
+compare_qxy (const void* a, const void* b);
+
+/* "Bounding Box"
+ * Find the extent `box` of the xy records of `infile`, after skipping
+ * `skip` of them, as read_point reads them one after the other; `npr` is
+ * set to the number of records.  After the first few, which set the
+ * delimiter, the records are read in large blocks and parsed on
+ * `nthreads` threads, a file in byte ranges of its own for each thread.
+ */
+int
+bbs_box (FILE* infile, char** delimiter, char* pnt_recr, int dflag, int skip, int nthreads, region_t* box, ssize_t* npr, int vflag);
+
 void
 minmax (point_t* points, int npoints, region_t *xyzi);
 
+/* Compare points by x, then y, for use in qsort
+ */
+int
+compare_xy (const void* a, const void* b);
+
+/* Run `fn` over the `n` jobs of `size` bytes each at `jobs`, on up to `n`
+ * threads (this one included), and wait for them all.
+ */
+void
+run_jobs (void* jobs, size_t size, int n, void* (*fn) (void*));
+
+void
+ring_init (ring_t* ring);
+
+void
+ring_free (ring_t* ring);
+
+/* Add the index `i` to the end of the ring
+ */
+void
+ring_push (ring_t* ring, pidx_t i);
+
+void
+rings_init (rings_t* rings);
+
+void
+rings_free (rings_t* rings);
+
+/* Add a point to the ring currently being built
+ */
+void
+rings_add (rings_t* rings, point_t pnt);
+
+/* Finish the ring currently being built; `hole` is 1 if it is a hole.
+ * Returns the index of the ring.
+ */
+int
+rings_close (rings_t* rings, int hole);
+
+/* Return the signed area of the points from `r0` to the end of `rings`
+ */
+double
+rings_area (rings_t* rings, ssize_t r0);
+
+/* Print the rings as a multipolygon, each outer ring followed by its holes.
+ */
+void
+rings_print (rings_t* rings, int jflag);
+
+/* Load a boundary, as GMT or GeoJSON, from `infile` into `rings`.
+ * Returns the number of rings loaded.
+ */
+int
+rings_load (FILE* infile, rings_t* rings);
+
 int
 pnts_equal_p (point_t p1, point_t p2);
 
@@ -150,19 +534,72 @@ intersect_p (line_t l1, line_t l2, int t);
 int
 inside_p (point_t* p1, point_t* poly, ssize_t hullsize);
 
+/* Return 1 if p1 is inside the indexed polygon, as `inside_p` would
+ */
+int
+polyidx_inside_p (polyidx_t* pi, point_t* p1);
+
+/* Return 1 if p1 is inside (by the even-odd rule) or on the edge of
+ * the indexed rings, otherwise return 0
+ */
+int
+polyidx_contains (polyidx_t* pi, point_t* p1);
+
 /* A 'package-wrap' concavehull 
  * -- Retruns the number of points in the boundary;
- * The hull makes up the begining of the points array.
+ * Hulls the points `points[perm[0]]` to `points[perm[npoints-1]]`, reordering
+ * `perm` (which needs room for one more) and leaving the points alone.
+ * The hull makes up the begining of `perm`, its first index repeated last.
  * Generate the concave hull using the given distance threshold
  */
 ssize_t
-dpw_concave (point_t* points, int npoints, double d);
+dpw_concave (point_t* points, pidx_t* perm, int npoints, double d);
+
+/* Search for the smallest distance giving a concave hull that holds every point
+ * -- If `d` is zero, start from the sampled nearest-neighbour spacing; up to
+ * `nthreads` candidate distances are tried at once.  With `prefilter`, only the
+ * points in grid cells near empty cells are hulled.  The points are left alone.
+ * The hull is recorded as a ring in `rings` and `d` gets the distance used.
+ * Returns the number of points in the hull.
+ */
+ssize_t
+dpw_concave_search (point_t* points, int npoints, double* d, int nthreads, int prefilter, int vflag,
+		    rings_t* rings);
+
+/* Concave hulls of each group of points linked by `d`
+ * -- Each group is hulled with `dpw_concave_search` on up to `nthreads` threads;
+ * if `d` is zero it is estimated from the point spacing; a group of one or two
+ * points is the closed ring through them.  The hulls are recorded in `rings` and
+ * `d` gets the largest distance used.
+ * Returns the number of polygons.
+ */
+int
+dpw_concave_multi (point_t* points, int npoints, double* d, int nthreads, int prefilter, int vflag, rings_t* rings);
+
+/* Classify the xy records of `infile` against the rings of `boundary`,
+ * writing them out flagged 1 (inside or on the boundary) or 0 with `select` 0,
+ * or only the inside (`select` 1) or outside (`select` -1) records.
+ * Returns the number of records inside.
+ */
+ssize_t
+query_points (FILE* infile, rings_t* boundary, char* pnt_recr, char* delimiter, int select, int nthreads, int vflag);
+
+/* Records the indices of the points on the convex hull in `hull`, in counter-clockwise order.
+ * Note: the last index in the returned ring is the same as the first one. 
+ */
+void
+mc_convex (point_t* points, ssize_t npoints, ring_t* hull);
+
+/* `mc_convex` of quantized points, sorted by x then y, with exact orientation tests
+ */
+void
+mc_convex_q (qpoint_t* points, ssize_t npoints, ring_t* hull);
 
-/* Returns a list of points on the convex hull in counter-clockwise order.
- * Note: the last point in the returned list is the same as the first one. 
+/* With `on`, the points given to the hulls are taken to be quantized steps,
+ * as `quant_pnts` leaves them, and their orientation is tested exactly.
  */
 void
-mc_convex (point_t* points, ssize_t npoints, point_ptr_t** out_hull, ssize_t* out_hullsize);
+hull_lattice (int on);
 
 /* A 'package-wrap' convexhull 
  * -- Retruns the number of points in the hull;
@@ -171,11 +608,341 @@ mc_convex (point_t* points, ssize_t npoints, point_ptr_t** out_hull, ssize_t* ou
 ssize_t
 pw_convex (point_t* points, ssize_t npoints);
 
+/* Delaunay triangulate `points`.
+ * Returns 0 on success, or -1 if the points are all collinear.
+ */
+int
+delaunay (point_t* points, int npoints, delaunay_t* dt);
+
+void
+delaunay_free (delaunay_t* dt);
+
+/* 'Alpha Shape'
+ * -- Removes every triangle with an edge longer than `d` and records the
+ * boundary of what is left in `rings`; if `d` is zero, estimate it from
+ * the triangulation and record it in `d`.
+ * Returns the number of polygons, or -1 on failure.
+ */
+int
+alpha_shape (point_t* points, int npoints, double* d, rings_t* rings);
+
+/* Set up the grid geometry over `region` with `cell` sized cells;
+ * the cell size is grown until there are no more than `maxcells` cells.
+ */
+void
+grid_init (grid_t* g, region_t* region, double cell, ssize_t maxcells);
+
+/* Return the (clamped) grid column of `x` or row of `y`
+ */
+int
+grid_xi (grid_t* g, double x);
+
+int
+grid_yi (grid_t* g, double y);
+
+/* Bucket the points by grid cell.
+ * If `cell` is zero, use a cell size holding about one point.
+ */
+void
+pgrid_init (pgrid_t* pg, point_t* points, int npoints, double cell);
+
+/* Bucket the points `points[perm[0]]` to `points[perm[npoints-1]]` by grid cell;
+ * the grid holds positions in `perm`.
+ */
+void
+pgrid_init_idx (pgrid_t* pg, point_t* points, pidx_t* perm, int npoints, double cell);
+
+void
+pgrid_free (pgrid_t* pg);
+
+/* Index the `nedges` edges of the closed polygon `poly` (its first point
+ * repeated last) by horizontal band; `poly` has to outlive the index.
+ */
+void
+polyidx_init (polyidx_t* pi, point_t* poly, ssize_t nedges);
+
+/* Index the edges of every ring in `rings`, which has to outlive the index.
+ */
+void
+polyidx_init_rings (polyidx_t* pi, rings_t* rings);
+
+void
+polyidx_free (polyidx_t* pi);
+
+/* Return the (clamped) band of `y`
+ */
+int
+polyidx_band (polyidx_t* pi, double y);
+
+/* Estimate the nearest-neighbour spacing of the points from `nsample` of them.
+ * Returns the `q` quantile (0 to 1) of the sampled spacings.
+ */
+double
+nn_spacing (point_t* points, int npoints, int nsample, double q);
+
+/* Label the groups of points linked by steps of no more than `d`;
+ * `label[i]` gets the group of point `i`, numbered in order of first appearance.
+ * Returns the number of groups.
+ */
+int
+point_components (point_t* points, int npoints, double d, int* label);
+
+void
+sgrid_init (sgrid_t* sg, grid_t* g);
+
+void
+sgrid_free (sgrid_t* sg);
+
+/* Add segment `id` running from p1 to p2 to every cell it passes through
+ */
+void
+sgrid_insert (sgrid_t* sg, int id, point_t* p1, point_t* p2);
+
+/* Gather the ids of the segments sharing a cell with p1-p2 into `sg->found`.
+ * Returns the number of ids found.
+ */
+int
+sgrid_query (sgrid_t* sg, point_t* p1, point_t* p2);
+
+/* 'Dig' a concave hull out of the convex hull
+ * -- Edges longer than `length` are dug in towards the nearest inner point
+ * while that point is closer than the edge length over `concavity`.
+ * The points are sorted in place; the boundary is recorded in `rings`.
+ * Returns the number of points in the boundary.
+ */
+ssize_t
+dig_concave (point_t* points, int npoints, double concavity, double length, rings_t* rings);
+
+/* Allocate an empty `nx` by `ny` block grid.
+ * Returns 0, or -1 if the memory couldn't be had.
+ */
+int
+bgrid_init (bgrid_t* bg, int nx, int ny);
+
+/* Start an empty sparse block grid
+ */
+void
+bgrid_init_sparse (bgrid_t* bg);
+
+/* Return the tile at tile column `tx` and row `ty` of a sparse grid,
+ * adding an empty one if `create` is set; otherwise NULL if there is none.
+ */
+btile_t*
+bgrid_tile (bgrid_t* bg, int64_t tx, int64_t ty, int create);
+
+/* Set the cell at column `cx` and row `cy` of a sparse grid's whole lattice
+ */
+void
+bgrid_set (bgrid_t* bg, int64_t cx, int64_t cy);
+
+/* Put the tiles of a sparse grid in row order and size the grid to cover them.
+ * Returns 0, or -1 if the grid would have more than INT_MAX rows or columns.
+ */
+int
+bgrid_seal (bgrid_t* bg);
+
+void
+bgrid_free (bgrid_t* bg);
+
+/* Add the existing tile `tile` to a sparse grid; the grid doesn't take it over.
+ */
+void
+bgrid_insert (bgrid_t* bg, btile_t* tile);
+
+/* Drop the tiles of a sparse grid without freeing them
+ */
+void
+bgrid_clear (bgrid_t* bg);
+
+/* Return the occupancy of cell (xi, yi), which may be off the grid
+ */
+int
+bgrid_occ_at (bgrid_t* bg, int xi, int yi);
+
+/* Return the byte holding the edge bits of cell (xi, yi) and set `shift`
+ * to their place in it, or NULL if the cell is in no tile.
+ */
+uint8_t*
+bgrid_cell (bgrid_t* bg, int xi, int yi, int* shift);
+
+void
+bbatch_init (bbatch_t* b);
+
+void
+bbatch_free (bbatch_t* b);
+
+/* Read the next batch of records and parse their xy (following `pnt_recr`)
+ * over `nthreads` threads; a field missing from a record is taken from the
+ * record before, as read_point leaves it.
+ * Returns the number of records read, 0 at the end of the file.
+ */
+int
+bbatch_read (bbatch_t* b, FILE* infile, char* pnt_recr, int nthreads, int vflag);
+
+/* Set the cells of the points of a batch, `inc` wide from (xmin, ymin),
+ * over `nthreads` threads.  With `nx` of 0 or more a cell is counted as
+ * bbs_block counts it, and kept only if it is within `nx` by `ny`;
+ * otherwise the cells are on the whole lattice of `inc`.  If `bg` is not
+ * NULL the cells are also set in that dense grid.
+ */
+void
+bbatch_cells (bbatch_t* b, double inc, double xmin, double ymin, int nx, int ny, bgrid_t* bg, int nthreads);
+
+/* Read up to BBATCH_AHEAD points of `infile` ahead into `b` and choose a
+ * block increment from them: twice the 0.9 quantile of their sampled
+ * nearest-neighbour spacing, rounded to 1, 2 or 5 times a power of ten,
+ * then stepped up until the grid over `region` (or the extent of the points
+ * read) fits in `max_memory` bytes, or a quarter of the memory if that is 0,
+ * at `cellsize` bytes a cell.
+ * Returns the increment.
+ */
+double
+bbatch_increment (bbatch_t* b, FILE* infile, char* pnt_recr, region_t region, size_t max_memory, double cellsize, int nthreads, int vflag);
+
+/* Mark the cells of `bg` on the line to the cell of point `i` of batch `b`
+ * from that of the gridded point before it, if the two are no more than
+ * `gap` apart; the points' own cells are left to be marked as points.
+ */
+void
+bbatch_track (bbatch_t* b, int i, double gap, bgrid_t* bg);
+
+/* Record the edges of the occupied cells, those sides facing an empty cell
+ * or the edge of the grid; of tiles `t0` to `t1-1` of a sparse grid,
+ * or of the whole of a dense one.
+ */
+void
+bgrid_record_edges (bgrid_t* bg, ssize_t t0, ssize_t t1);
+
+/* Return the edge following (or preceding) `e` around its ring.
+ * Where two cells only meet at a corner the ring turns to keep them together.
+ */
+bedge_t
+block_next (bgrid_t* bg, bedge_t e);
+
+bedge_t
+block_prev (bgrid_t* bg, bedge_t e);
+
+/* Print the `n` edges of a ring, starting at its first, as the corners
+ * where it turns; `sep` is 0 for the first ring, 1 for the outer ring of
+ * a new polygon and 2 for a hole of the polygon before.
+ * Returns the number of points printed.
+ */
+ssize_t
+block_print_ring (bedge_t* ring, ssize_t n, double inc, region_t xyi, int jflag, int sep);
+
+void
+blabel_init (blabel_t* lab);
+
+void
+blabel_free (blabel_t* lab);
+
+/* Add the run of occupied cells `x0` to `x1` of row `y`; runs are added
+ * in row order, then by column.
+ */
+void
+blabel_run (blabel_t* lab, int y, int x0, int x1);
+
+/* Add the runs of occupied cells of rows `r0` to `r1-1` of `bg`
+ */
+void
+blabel_grid (blabel_t* lab, bgrid_t* bg, int r0, int r1);
+
+/* Return the least edge of the outer ring of the component holding
+ * cell (`x`, `y`): the bottom edge of its lowest, leftmost cell.
+ */
+bedge_t
+blabel_root (blabel_t* lab, int x, int y);
+
+/* Count the points of each cell of `bg` as they are gridded, up to `cmax`
+ * (at most 65535), rather than only marking the cells; a sparse grid
+ * counts them with bgrid_count.
+ */
+void
+bgrid_count_init (bgrid_t* bg, int cmax);
+
+void
+bgrid_count (bgrid_t* bg, int64_t cx, int64_t cy);
+
+/* Mark the cells of `bg` counted to `min_count` or more as occupied and
+ * stop counting; a sparse grid drops the tiles left empty.
+ */
+void
+bgrid_threshold (bgrid_t* bg, int min_count);
+
+/* Apply the morphology `m` to the occupied cells of `bg`.  A sparse grid
+ * counted from the corner of a region (not `lattice`) is kept within its
+ * `nx` by `ny` cells; one on the lattice grows (or shrinks) with its tiles.
+ */
+void
+bgrid_morph (bgrid_t* bg, bmorph_t* m, int lattice);
+
+/* Set `coarse` to `bg` OR-reduced `factor` by `factor` cells to a cell:
+ * a dense grid of its size over `factor` (rounded up), or a sparse grid
+ * with cell (x, y) of `bg` in cell (floor (x / factor), floor (y / factor)),
+ * sealed.
+ */
+void
+bgrid_reduce (bgrid_t* bg, int factor, bgrid_t* coarse);
+
+/* Trace the grid `bg`, of `inc` cells from `xyi`, and print it; with a
+ * pyramid, each coarser level after it is reduced from the one before and
+ * printed as its own layer.  `lattice` is set if the cells of a sparse grid
+ * are on the whole lattice of `inc` rather than counted from `xyi`.
+ * Rings of fewer than `min_area` cells of their level are left out.
+ * Returns the number of boundary points.
+ */
+ssize_t
+block_levels (bgrid_t* bg, double inc, region_t xyi, int lattice, bpyramid_t* pyr, ssize_t min_area, int nthreads, int vflag, int jflag);
+
+/* Trace the recorded edges of the grid into rings and print them;
+ * cell (0, 0) is at the lower-left corner of `xyi`.  The rows are split
+ * into stripes traced on `nthreads` threads and stitched back together.
+ * Each ring starts at its least edge in row order.  The polygons, labelled
+ * by the connected components of the occupied cells, come out in the order
+ * of their outer rings' least edges, each followed by its holes.  Outer
+ * rings (with their holes) and holes of fewer than `min_area` cells are
+ * left out.
+ * Returns the number of boundary points.
+ */
+ssize_t
+block_trace_stripes (bgrid_t* bg, double inc, region_t xyi, ssize_t min_area, int nthreads, int jflag);
+
+/* The raster format (BRASTER_*) named `name`, or 0 if there's none */
+int
+block_raster_format (const char* name);
+
+/* Write the occupied cells of the (sealed) grid `bg`, of `inc` cells from
+ * `xyi`, to standard output as a raster of `format`, a row at a time from
+ * the top: an ESRI ASCII grid of 1 and 0, a GMT native binary grid of bytes
+ * (=bb) or, for BRASTER_RLE, the ESRI ASCII header (without NODATA_value)
+ * followed by a line to a row of the lengths of its runs, alternately
+ * empty and occupied, starting with an empty run.  With `lattice` (a sparse
+ * grid without a region) the raster is cropped to the occupied cells.
+ * Returns the number of cells.
+ */
+ssize_t
+block_raster (bgrid_t* bg, double inc, region_t xyi, int lattice, int format, int vflag);
+
 /* Generate a boundary with blocks
  * `inc` is the blocksize in the same units
- * as the input points.
+ * as the input points, or 0 to estimate it; if `max_memory` is more than 0
+ * the grid is kept within about that many bytes.  With `quantum` more than 0
+ * the points are snapped to whole steps of it and put in their cells in
+ * integers, `inc` being a whole number of steps.
+ * With `pyr` not NULL, the coarser levels of a pyramid follow; with `morph`
+ * not NULL the grid is shaped by it before it is traced.  With `raster`
+ * set to a BRASTER_* format, the grid is written as a raster instead.
+ * The boundary is traced on `nthreads` threads.
+ */
+int
+bbs_block (FILE *infile, double inc, double quantum, region_t region, size_t max_memory, bpyramid_t* pyr, bmorph_t* morph, int raster, int nthreads, int vflag, int jflag);
+
+/* Generate a boundary with blocks over a sparse grid of tiles,
+ * spilling them to a temporary file if they need more than `max_memory`
+ * bytes (and `max_memory` is more than 0).  The points are read with the
+ * batch `bb`, which may hold some read ahead.
  */
 int
-bbs_block (FILE *infile, double inc, region_t region, int vflag, int jflag);
+bbs_block_tiles (FILE *infile, bbatch_t* bb, double inc, region_t region, size_t max_memory, bpyramid_t* pyr, bmorph_t* morph, int raster, int nthreads, int vflag, int jflag);
 
 // End
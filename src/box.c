@@ -0,0 +1,464 @@
+/*------------------------------------------------------------
+ * box.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2011, 2012, 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bounds.h"
+
+/* The bytes read at a time by each thread */
+#define BOX_BLOCK (1 << 22)
+
+/* The values parsed before they are folded into the extent */
+#define BOX_VALUES 4096
+
+/* The fewest bytes worth a thread of their own */
+#define BOX_CHUNK (1 << 20)
+
+/* The longest record, as fgets reads them into MAX_RECORD_LENGTH */
+#define BOX_RECORD (MAX_RECORD_LENGTH - 1)
+
+/* The extent of the x (or y) values of a part of the records: the least
+ * and greatest of those that aren't NaN, if `seen`, and the first value
+ * equal to zero, if `zeroed`, whose sign a fold of the values keeps.
+ */
+typedef struct
+{
+  double min;
+  double max;
+  double zero;
+  int seen;
+  int zeroed;
+} box_axis_t;
+
+/* The work of one thread: the records of bytes `lo` to `hi-1` of file
+ * `fd`, or else those of `buf`, into the extents `ax` of `nrec` records.
+ */
+typedef struct
+{
+  int fd;
+  off_t lo;
+  off_t hi;
+  char* buf;
+  size_t n;
+  int final;
+  size_t used;
+  const char* isdel;
+  char* pnt_recr;
+  int pflen;
+  double vals[2][BOX_VALUES];
+  int nvals[2];
+  box_axis_t ax[2];
+  ssize_t nrec;
+  int failed;
+} box_job_t;
+
+#if defined (__GNUC__)
+/* Two lanes, as the plainest SSE2 (or NEON) register holds them */
+typedef double bxdbl_t __attribute__ ((vector_size (2 * sizeof (double))));
+typedef long long bxint_t __attribute__ ((vector_size (2 * sizeof (long long))));
+#endif
+
+/* Fold the `n` values of `v` into `a`, four at a time in two registers */
+static void
+box_axis_fold (box_axis_t* a, double* v, int n)
+{
+  double mn = INFINITY, mx = -INFINITY;
+  int i = 0, z = 0, ok = 0;
+
+#if defined (__GNUC__)
+  bxdbl_t vmn[2] = {{mn, mn}, {mn, mn}}, vmx[2] = {{mx, mx}, {mx, mx}}, q;
+  const bxdbl_t zero = {0, 0};
+  bxint_t lt, gt, vz = {0, 0}, vok = {0, 0};
+  int l;
+
+  for (; i + 4 <= n; i += 4)
+    for (l = 0; l < 2; l++)
+      {
+	memcpy (&q, v + i + 2 * l, sizeof (q));
+	lt = q < vmn[l], gt = q > vmx[l];
+	vmn[l] = (bxdbl_t) (((bxint_t) q & lt) | ((bxint_t) vmn[l] & ~lt));
+	vmx[l] = (bxdbl_t) (((bxint_t) q & gt) | ((bxint_t) vmx[l] & ~gt));
+	vz |= q == zero;
+	vok |= q == q;
+      }
+  for (l = 0; l < 4; l++)
+    {
+      if (vmn[l >> 1][l & 1] < mn) mn = vmn[l >> 1][l & 1];
+      if (vmx[l >> 1][l & 1] > mx) mx = vmx[l >> 1][l & 1];
+    }
+  z |= (vz[0] | vz[1]) != 0, ok |= (vok[0] | vok[1]) != 0;
+#endif
+  for (; i < n; i++)
+    {
+      if (v[i] < mn) mn = v[i];
+      if (v[i] > mx) mx = v[i];
+      z |= v[i] == 0, ok |= v[i] == v[i];
+    }
+
+  if (ok)
+    {
+      a->min = a->seen ? min (a->min, mn) : mn;
+      a->max = a->seen ? max (a->max, mx) : mx;
+      a->seen = 1;
+    }
+
+  /* Only the first zero of the records is wanted */
+  if (z && !a->zeroed)
+    for (i = 0; i < n; i++)
+      if (v[i] == 0)
+	{
+	  a->zero = v[i], a->zeroed = 1;
+	  break;
+	}
+}
+
+static void
+box_job_flush (box_job_t* j)
+{
+  box_axis_fold (&j->ax[0], j->vals[0], j->nvals[0]);
+  box_axis_fold (&j->ax[1], j->vals[1], j->nvals[1]);
+  j->nvals[0] = j->nvals[1] = 0;
+}
+
+/* Powers of ten a double holds exactly */
+static const double box_pow10[23] =
+  {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* The value of the field `s` to `e` as atof reads it -- Plain decimals of
+ * up to 15 significant digits with a small exponent are exact as one
+ * multiplication or division of exact doubles; anything else is left to
+ * strtod.
+ */
+static double
+box_atof (const char* s, const char* e)
+{
+  char tmp[MAX_RECORD_LENGTH];
+  const char* p = s;
+  uint64_t m = 0;
+  int neg = 0, nd = 0, sig = 0, k = 0, ek = 0, eneg = 0;
+
+  if (p < e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+  for (; p < e && *p >= '0' && *p <= '9'; p++, nd++)
+    if (m > 0 || *p != '0')
+      m = m * 10 + (*p - '0'), sig++;
+  if (p < e && *p == '.')
+    for (p++; p < e && *p >= '0' && *p <= '9'; p++, nd++, k--)
+      if (m > 0 || *p != '0')
+	m = m * 10 + (*p - '0'), sig++;
+  if (p < e && (*p == 'x' || *p == 'X'))
+    sig = 99;
+  if (nd > 0 && sig <= 15 && p < e && (*p == 'e' || *p == 'E'))
+    {
+      const char* q = p + 1;
+      if (q < e && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+      if (q < e && *q >= '0' && *q <= '9')
+	{
+	  for (; q < e && *q >= '0' && *q <= '9' && ek < 1000; q++)
+	    ek = ek * 10 + (*q - '0');
+	  if (q < e && *q >= '0' && *q <= '9') sig = 99;
+	  k += eneg ? -ek : ek;
+	}
+    }
+  if (nd > 0 && sig <= 15 && k >= -22 && k <= 22)
+    {
+      double v = (double) m;
+      v = k < 0 ? v / box_pow10[-k] : v * box_pow10[k];
+      return neg ? -v : v;
+    }
+
+  memcpy (tmp, s, e - s);
+  tmp[e - s] = '\0';
+  return atof (tmp);
+}
+
+/* Fold the whole records of the `n` bytes of `buf` into `j`, as fgets
+ * would read them and parse_point parse them; the last, if it isn't ended
+ * (and `final` isn't set), is left.
+ * Returns the bytes used.
+ */
+static size_t
+box_parse (box_job_t* j, const char* buf, size_t n, int final)
+{
+  const char *r = buf, *end = buf + n, *re, *s, *nl;
+  int f;
+  char c;
+
+  while (r < end)
+    {
+      nl = (const char*) memchr (r, '\n', min ((size_t) (end - r), (size_t) BOX_RECORD));
+      if (nl) re = nl + 1;
+      else if (end - r >= BOX_RECORD) re = r + BOX_RECORD;
+      else if (final) re = end;
+      else break;
+
+      /* The fields, as strtok splits them */
+      for (f = 0, s = r; f < j->pflen; f++)
+	{
+	  while (s < re && j->isdel[(unsigned char) *s]) s++;
+	  if (s == re) break;
+	  for (nl = s; nl < re && !j->isdel[(unsigned char) *nl]; nl++);
+	  c = j->pnt_recr[f];
+	  if (c == 'x' || c == 'y')
+	    {
+	      j->vals[c == 'y'][j->nvals[c == 'y']++] = box_atof (s, nl);
+	      if (j->nvals[c == 'y'] == BOX_VALUES)
+		box_job_flush (j);
+	    }
+	  s = nl;
+	}
+      j->nrec++;
+      r = re;
+    }
+  return r - buf;
+}
+
+static void*
+box_parse_run (void* arg)
+{
+  box_job_t* j = (box_job_t*) arg;
+
+  j->used = box_parse (j, j->buf, j->n, j->final);
+  box_job_flush (j);
+  return NULL;
+}
+
+/* Read and fold bytes `lo` to `hi-1` of the file */
+static void*
+box_read_run (void* arg)
+{
+  box_job_t* j = (box_job_t*) arg;
+  size_t keep = 0, used, n;
+  off_t off = j->lo;
+  ssize_t got;
+  char* buf;
+
+  buf = (char*) malloc (BOX_BLOCK + MAX_RECORD_LENGTH);
+  if (!buf)
+    {
+      j->failed = 1;
+      return NULL;
+    }
+  for (;;)
+    {
+      got = 0;
+      if (off < j->hi)
+	{
+	  got = pread (j->fd, buf + keep, (size_t) min ((off_t) BOX_BLOCK, j->hi - off), off);
+	  if (got < 0)
+	    {
+	      j->failed = 1;
+	      break;
+	    }
+	}
+      off += got, n = keep + got;
+      used = box_parse (j, buf, n, off >= j->hi || got == 0);
+      if (off >= j->hi || got == 0)
+	break;
+      keep = n - used;
+      memmove (buf, buf + used, keep);
+    }
+  box_job_flush (j);
+  free (buf);
+  return NULL;
+}
+
+static void
+box_job_init (box_job_t* j, const char* isdel, char* pnt_recr)
+{
+  memset (j->ax, 0, sizeof (j->ax));
+  j->nvals[0] = j->nvals[1] = 0;
+  j->isdel = isdel, j->pnt_recr = pnt_recr, j->pflen = strlen (pnt_recr);
+  j->nrec = 0, j->failed = 0, j->fd = -1;
+}
+
+/* Fold the extents of a job into the box, as the records would have been
+ * folded one after the other.
+ */
+static void
+box_fold (box_job_t* j, region_t* box, ssize_t* npr)
+{
+  if (j->ax[0].seen)
+    {
+      if (j->ax[0].min < box->xmin) box->xmin = j->ax[0].min == 0 ? j->ax[0].zero : j->ax[0].min;
+      if (j->ax[0].max > box->xmax) box->xmax = j->ax[0].max == 0 ? j->ax[0].zero : j->ax[0].max;
+    }
+  if (j->ax[1].seen)
+    {
+      if (j->ax[1].min < box->ymin) box->ymin = j->ax[1].min == 0 ? j->ax[1].zero : j->ax[1].min;
+      if (j->ax[1].max > box->ymax) box->ymax = j->ax[1].max == 0 ? j->ax[1].zero : j->ax[1].max;
+    }
+  *npr += j->nrec;
+}
+
+/* The first record starting at or after byte `at` of the file */
+static off_t
+box_record_at (int fd, off_t at, off_t size)
+{
+  char buf[65536];
+  ssize_t got;
+  char* nl;
+
+  if (at <= 0) return 0;
+  for (at--; at < size; at += got)
+    {
+      got = pread (fd, buf, sizeof (buf), at);
+      if (got <= 0) return size;
+      if ((nl = (char*) memchr (buf, '\n', got)) != NULL)
+	return at + (nl - buf) + 1;
+    }
+  return size;
+}
+
+/* Split the file from `off` on over the threads, by byte ranges read
+ * with pread.  Returns -1 if a read failed.
+ */
+static int
+box_file (int fd, off_t off, off_t size, box_job_t* jobs, int nthreads, region_t* box, ssize_t* npr)
+{
+  off_t at[65];
+  int t, threads, failed = 0;
+
+  threads = (int) max (1, min ((off_t) min (nthreads, 64), (size - off) / BOX_CHUNK));
+  at[0] = off, at[threads] = size;
+  for (t = 1; t < threads; t++)
+    at[t] = max (at[t - 1], box_record_at (fd, off + (size - off) / threads * t, size));
+  for (t = 0; t < threads; t++)
+    jobs[t].fd = fd, jobs[t].lo = at[t], jobs[t].hi = at[t + 1];
+  run_jobs (jobs, sizeof (box_job_t), threads, box_read_run);
+  for (t = 0; t < threads; t++)
+    {
+      failed |= jobs[t].failed;
+      box_fold (&jobs[t], box, npr);
+    }
+  return failed ? -1 : 0;
+}
+
+/* Read the rest of `infile` a block at a time, each split over the threads
+ * at the ends of its lines.
+ */
+static void
+box_stream (FILE* infile, box_job_t* jobs, int nthreads, region_t* box, ssize_t* npr)
+{
+  size_t cap = (size_t) BOX_BLOCK * 4, keep = 0, n, got, at[65];
+  char* buf;
+  char* nl;
+  int t, threads, final = 0;
+
+  buf = (char*) malloc (cap + MAX_RECORD_LENGTH);
+  if (!buf)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the box\n");
+      exit (EXIT_FAILURE);
+    }
+  while (!final)
+    {
+      got = fread (buf + keep, 1, cap, infile);
+      n = keep + got;
+      final = got < cap;
+
+      threads = (int) max (1, min ((size_t) min (nthreads, 64), n / BOX_CHUNK));
+      at[0] = 0, at[threads] = n;
+      for (t = 1; t < threads; t++)
+	{
+	  at[t] = max (at[t - 1], n / threads * t);
+	  nl = at[t] < n ? (char*) memchr (buf + at[t], '\n', n - at[t]) : NULL;
+	  at[t] = nl ? (size_t) (nl - buf) + 1 : n;
+	}
+      for (t = 0; t < threads; t++)
+	{
+	  jobs[t].buf = buf + at[t], jobs[t].n = at[t + 1] - at[t];
+	  jobs[t].final = final || at[t + 1] < n;
+	}
+      run_jobs (jobs, sizeof (box_job_t), threads, box_parse_run);
+      for (t = 0; t < threads; t++)
+	box_fold (&jobs[t], box, npr);
+
+      /* Only the part reaching the end of the block can end in a part of
+       * a record, which is kept for the next.
+       */
+      for (t = threads - 1; t > 0 && at[t] >= n; t--);
+      keep = n - at[t] - jobs[t].used;
+      memmove (buf, buf + n - keep, keep);
+    }
+  free (buf);
+}
+
+int
+bbs_box (FILE* infile, char** delimiter, char* pnt_recr, int dflag, int skip, int nthreads, region_t* box, ssize_t* npr, int vflag)
+{
+  point_t rpnt = {0, 0};
+  box_job_t* jobs;
+  struct stat st;
+  char isdel[256];
+  off_t off;
+  char* d;
+  int i = 0, t;
+
+  *npr = 0;
+
+  /* The first records (to the second point) are read as they always were,
+   * guessing the delimiter from each; the rest are read in bulk.
+   */
+  while ((i < 2 || skip > 0) && read_point (infile, &rpnt, delimiter, pnt_recr, dflag, vflag) == 0)
+    {
+      if (skip > 0)
+	{
+	  skip--;
+	  continue;
+	}
+      (*npr)++;
+      if (i == 0)
+	box->xmin = box->xmax = rpnt.x, box->ymin = box->ymax = rpnt.y;
+      else
+	{
+	  if (rpnt.y < box->ymin) box->ymin = rpnt.y;
+	  if (rpnt.x < box->xmin) box->xmin = rpnt.x;
+	  if (rpnt.y > box->ymax) box->ymax = rpnt.y;
+	  if (rpnt.x > box->xmax) box->xmax = rpnt.x;
+	}
+      i++;
+    }
+  if (i < 2)
+    return 0;
+
+  memset (isdel, 0, sizeof (isdel));
+  for (d = *delimiter; *d; d++)
+    isdel[(unsigned char) *d] = 1;
+
+  jobs = (box_job_t*) malloc (64 * sizeof (box_job_t));
+  if (!jobs)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the box\n");
+      exit (EXIT_FAILURE);
+    }
+  for (t = 0; t < 64; t++)
+    box_job_init (&jobs[t], isdel, pnt_recr);
+
+  /* A file is split over the threads; anything else is streamed */
+  off = ftello (infile);
+  if (fstat (fileno (infile), &st) == 0 && S_ISREG (st.st_mode) && off >= 0)
+    {
+      if (box_file (fileno (infile), off, st.st_size, jobs, nthreads, box, npr) != 0)
+	{
+	  fprintf (stderr, "bounds: failed to read the input\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  else
+    box_stream (infile, jobs, nthreads, box, npr);
+
+  free (jobs);
+  return 0;
+}
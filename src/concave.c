@@ -0,0 +1,632 @@
+/*------------------------------------------------------------
+ * concave.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2011, 2012, 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "bounds.h"
+
+/* Stop bisecting once the bracket is this fraction of its upper end */
+#define SEARCH_TOL (1.0 / 16)
+
+/* The most doublings (or halvings) tried when bracketing */
+#define SEARCH_STEPS 64
+
+/* The fewest points worth a verification thread of their own */
+#define VERIFY_CHUNK 16384
+
+typedef struct
+{
+  point_t* pnts;
+  pidx_t* perm;
+  point_t* poly;
+  ssize_t poly_cap;
+  int npoints;
+  double d;
+  int prefilter;
+  int vthreads;
+  ssize_t hullsize;
+} attempt_t;
+
+typedef struct
+{
+  polyidx_t* pi;
+  point_t* pnts;
+  pidx_t* idx;
+  ssize_t from;
+  ssize_t to;
+  atomic_int* outside;
+} verify_t;
+
+/* Check the points `idx[from]` to `idx[to-1]`, giving up as soon as
+ * any thread has found a point outside.
+ */
+static void*
+verify_run (void* arg)
+{
+  verify_t* v = arg;
+  ssize_t i;
+
+  for (i = v->from; i < v->to; i++)
+    {
+      if ((i & 1023) == 0 && atomic_load_explicit (v->outside, memory_order_relaxed))
+	break;
+      if (!polyidx_inside_p (v->pi, &v->pnts[v->idx[i]]))
+	{
+	  atomic_store_explicit (v->outside, 1, memory_order_relaxed);
+	  break;
+	}
+    }
+  return NULL;
+}
+
+/* Return 1 if the points `pnts[idx[0]]` to `pnts[idx[n-1]]` are all inside
+ * the indexed polygon, checking them on up to `nthreads` threads.
+ */
+static int
+verify_all (polyidx_t* pi, point_t* pnts, pidx_t* idx, ssize_t n, int nthreads)
+{
+  atomic_int outside = 0;
+  int t;
+
+  nthreads = (int) max (1, min (nthreads, n / VERIFY_CHUNK));
+  {
+    verify_t v[nthreads];
+
+    for (t = 0; t < nthreads; t++)
+      {
+	v[t].pi = pi, v[t].pnts = pnts, v[t].idx = idx, v[t].outside = &outside;
+	v[t].from = n * t / nthreads, v[t].to = n * (t + 1) / nthreads;
+      }
+    run_jobs (v, sizeof (verify_t), nthreads, verify_run);
+  }
+  return !atomic_load (&outside);
+}
+
+/* Gather the points of the hull at the start of `a->perm` into `a->poly`,
+ * the contiguous polygon `inside_p` wants.
+ */
+static point_t*
+attempt_poly (attempt_t* a, ssize_t hullsize)
+{
+  ssize_t i;
+
+  if (hullsize + 1 > a->poly_cap)
+    {
+      a->poly_cap = max (hullsize + 1, a->poly_cap * 2);
+      a->poly = (point_t*) realloc (a->poly, a->poly_cap * sizeof (point_t));
+      if (!a->poly)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the concave search\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  for (i = 0; i <= hullsize; i++)
+    a->poly[i] = a->pnts[a->perm[i]];
+  return a->poly;
+}
+
+/* One concave hull attempt at distance `a->d`; a retry only resets the indices.
+ * The hull has to hold every point, otherwise the attempt fails.
+ * Returns the number of points in the hull, or -1 on failure.
+ */
+static ssize_t
+concave_attempt (attempt_t* a)
+{
+  polyidx_t pi;
+  ssize_t hullsize;
+  int i;
+
+  for (i = 0; i < a->npoints; i++)
+    a->perm[i] = i;
+  hullsize = dpw_concave (a->pnts, a->perm, a->npoints, a->d);
+
+  if (hullsize >= 0)
+    {
+      polyidx_init (&pi, attempt_poly (a, hullsize), hullsize);
+      if (!verify_all (&pi, a->pnts, a->perm + hullsize + 1, a->npoints - hullsize, a->vthreads))
+	hullsize = -1;
+      polyidx_free (&pi);
+    }
+
+  return hullsize;
+}
+
+/* One concave hull attempt on just the points near the edge of the data
+ * -- The points are gridded with `d` sized cells and only those in cells within
+ * two cells of an empty one are hulled (one cell isn't enough, hull edges can
+ * reach across it).  Any other occupied cell is checked whole by its centre
+ * when no hull edge passes through it, otherwise point by point.
+ * Returns the number of points in the hull, or -1 on failure.
+ */
+static ssize_t
+filtered_attempt (attempt_t* a)
+{
+  pgrid_t pg;
+  sgrid_t sg;
+  polyidx_t pi;
+  point_t* poly;
+  char* edge;
+  ssize_t c, ncells, hullsize;
+  int i, k, m, x, y, dx, dy, nx, ny;
+
+  memset (&pi, 0, sizeof (polyidx_t));
+  pgrid_init (&pg, a->pnts, a->npoints, a->d);
+  ncells = (ssize_t) pg.g.nx * pg.g.ny;
+  edge = (char*) calloc (ncells, 1);
+  if (!edge)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the concave prefilter\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Flag the occupied cells within two cells of an empty (or off the grid) one */
+  for (y = 0; y < pg.g.ny; y++)
+    for (x = 0; x < pg.g.nx; x++)
+      {
+	c = (ssize_t) y * pg.g.nx + x;
+	if (pg.start[c] == pg.start[c + 1]) continue;
+	for (dy = -2; dy <= 2 && !edge[c]; dy++)
+	  for (dx = -2; dx <= 2; dx++)
+	    {
+	      nx = x + dx, ny = y + dy;
+	      if (nx < 0 || ny < 0 || nx >= pg.g.nx || ny >= pg.g.ny
+		  || pg.start[(ssize_t) ny * pg.g.nx + nx] == pg.start[(ssize_t) ny * pg.g.nx + nx + 1])
+		{
+		  edge[c] = 1;
+		  break;
+		}
+	    }
+      }
+
+  for (m = 0, c = 0; c < ncells; c++)
+    if (edge[c])
+      for (k = pg.start[c]; k < pg.start[c + 1]; k++)
+	a->perm[m++] = pg.idx[k];
+
+  hullsize = dpw_concave (a->pnts, a->perm, m, a->d);
+
+  if (hullsize >= 0)
+    {
+      poly = attempt_poly (a, hullsize);
+      polyidx_init (&pi, poly, hullsize);
+      if (!verify_all (&pi, a->pnts, a->perm + hullsize + 1, m - hullsize, a->vthreads))
+	hullsize = -1;
+    }
+
+  if (hullsize >= 0)
+    {
+      sgrid_init (&sg, &pg.g);
+      for (i = 0; i < hullsize; i++)
+	sgrid_insert (&sg, i, &poly[i], &poly[i + 1]);
+
+      for (c = 0; c < ncells && hullsize >= 0; c++)
+	{
+	  if (edge[c] || pg.start[c] == pg.start[c + 1]) continue;
+	  if (sg.head[c] == -1)
+	    {
+	      /* Nothing crosses the cell, so it is all on the side any of its
+	       * points is; a point rather than the centre, which on the lattice
+	       * of `hull_lattice` would be off the steps the tests are exact on.
+	       */
+	      if (!polyidx_inside_p (&pi, &a->pnts[pg.idx[pg.start[c]]]))
+		hullsize = -1;
+	    }
+	  else
+	    for (k = pg.start[c]; k < pg.start[c + 1]; k++)
+	      if (!polyidx_inside_p (&pi, &a->pnts[pg.idx[k]]))
+		{
+		  hullsize = -1;
+		  break;
+		}
+	}
+      sgrid_free (&sg);
+    }
+
+  free (edge);
+  pgrid_free (&pg);
+  polyidx_free (&pi);
+  return hullsize;
+}
+
+static void*
+attempt_run (void* arg)
+{
+  attempt_t* a = arg;
+
+  if (a->prefilter)
+    a->hullsize = filtered_attempt (a);
+  else
+    a->hullsize = concave_attempt (a);
+  return NULL;
+}
+
+/* Run the first `n` attempts, one per thread; threads left over from
+ * `nthreads` go to verifying the hulls.
+ */
+static void
+attempt_all (attempt_t* at, int n, int nthreads)
+{
+  int t;
+
+  for (t = 0; t < n; t++)
+    at[t].vthreads = max (1, nthreads / n);
+  run_jobs (at, sizeof (attempt_t), n, attempt_run);
+}
+
+/* Keep the hull of attempt `a` as the best (smallest successful) one so far */
+static void
+keep_best (ring_t* best, attempt_t* a, double* hi, ssize_t* hullsize)
+{
+  ssize_t i;
+
+  for (best->n = 0, i = 0; i <= a->hullsize; i++)
+    ring_push (best, a->perm[i]);
+  *hi = a->d;
+  *hullsize = a->hullsize;
+}
+
+/* Search for the smallest distance giving a concave hull that holds every point
+ * -- Starts from `d`, or from the sampled nearest-neighbour spacing if `d` is zero,
+ * and doubles until an attempt succeeds, up to four times the diagonal of the
+ * points, after which the hull is convex; an estimated start is also halved until
+ * one fails.  The bracket is then bisected.  Up to `nthreads` attempts run at
+ * once: the next steps of the sequence when bracketing and the next levels of the
+ * bisection tree when bisecting, so the result doesn't depend on the thread count.
+ * With `prefilter`, each attempt hulls only the points near the edge of the data.
+ * The points are left alone; the hull is recorded as a ring in `rings` and `d`
+ * gets the distance used.
+ * Returns the number of points in the hull.
+ */
+ssize_t
+dpw_concave_search (point_t* points, int npoints, double* d, int nthreads, int prefilter, int vflag,
+		    rings_t* rings)
+{
+  attempt_t* at;
+  point_t* sorted;
+  ring_t best;
+  region_t xyi;
+  double lo = 0, hi = INFINITY, start = *d, diag;
+  ssize_t hullsize = -1;
+  int t, k, l, levels, nat, estimated = 0, step;
+
+  ring_init (&best);
+  if (npoints < 3) goto convex;
+
+  minmax (points, npoints, &xyi);
+  diag = sqrt ((xyi.xmax - xyi.xmin) * (xyi.xmax - xyi.xmin)
+	       + (xyi.ymax - xyi.ymin) * (xyi.ymax - xyi.ymin));
+
+  if (!(start > 0))
+    {
+      start = nn_spacing (points, npoints, 1024, 0.9);
+      if (!(start > 0)) start = diag;
+      estimated++;
+      if (vflag > 0)
+	fprintf (stderr, "bounds: estimated a starting distance of %f\n", start);
+    }
+
+  nthreads = max (nthreads, 1);
+  at = (attempt_t*) malloc (nthreads * sizeof (attempt_t));
+  if (!at)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the concave search\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Each attempt only needs its own indices (and room for one more) */
+  for (t = 0; t < nthreads; t++)
+    {
+      at[t].pnts = points;
+      at[t].npoints = npoints;
+      at[t].prefilter = prefilter;
+      at[t].poly = NULL, at[t].poly_cap = 0;
+      at[t].perm = (pidx_t*) malloc (((size_t) npoints + 1) * sizeof (pidx_t));
+      if (!at[t].perm)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the concave search\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+
+  /* Bracket upwards: start, 2*start, 4*start... until one succeeds; the
+   * start is always tried, the rest only while under 4 diagonals.
+   */
+  for (step = 0; hi == INFINITY && step < SEARCH_STEPS && (step == 0 || start * pow (2, step) < diag * 4);
+       step += nthreads)
+    {
+      for (nat = 0; nat < nthreads && step + nat < SEARCH_STEPS
+	     && (step + nat == 0 || start * pow (2, step + nat) < diag * 4); nat++)
+	at[nat].d = start * pow (2, step + nat);
+      attempt_all (at, nat, nthreads);
+      for (t = 0; t < nat; t++)
+	{
+	  if (vflag > 0)
+	    fprintf (stderr, "bounds: distance %f %s\n", at[t].d, at[t].hullsize >= 0 ? "succeeded" : "failed");
+	  if (at[t].hullsize >= 0)
+	    {
+	      keep_best (&best, &at[t], &hi, &hullsize);
+	      break;
+	    }
+	  lo = at[t].d;
+	}
+    }
+
+  /* Bracket downwards from an estimate that succeeded straight away */
+  if (estimated && hi == start)
+    for (step = 1, lo = -1; lo < 0 && step < SEARCH_STEPS; step += nthreads)
+      {
+	for (nat = 0; nat < nthreads && step + nat < SEARCH_STEPS; nat++)
+	  at[nat].d = start / pow (2, step + nat);
+	attempt_all (at, nat, nthreads);
+	for (t = 0; t < nat; t++)
+	  {
+	    if (vflag > 0)
+	      fprintf (stderr, "bounds: distance %f %s\n", at[t].d, at[t].hullsize >= 0 ? "succeeded" : "failed");
+	    if (at[t].hullsize < 0)
+	      {
+		lo = at[t].d;
+		break;
+	      }
+	    keep_best (&best, &at[t], &hi, &hullsize);
+	  }
+      }
+
+  /* Bisect (lo, hi]; a user given distance that succeeded is kept as is */
+  if (hi != INFINITY && lo > 0)
+    {
+      double nlo[nthreads], nhi[nthreads];
+
+      for (levels = 1; (2 << levels) - 1 <= nthreads; levels++);
+
+      while (hi - lo > hi * SEARCH_TOL)
+	{
+	  /* The midpoints of the next `levels` levels of the bisection tree,
+	   * each split the same way a single bisection would split it */
+	  nlo[0] = lo, nhi[0] = hi;
+	  for (nat = 0; nat < (1 << levels) - 1; nat++)
+	    {
+	      at[nat].d = nlo[nat] + (nhi[nat] - nlo[nat]) / 2;
+	      if (2 * nat + 2 < (1 << levels) - 1)
+		{
+		  nlo[2 * nat + 1] = nlo[nat], nhi[2 * nat + 1] = at[nat].d;
+		  nlo[2 * nat + 2] = at[nat].d, nhi[2 * nat + 2] = nhi[nat];
+		}
+	    }
+	  attempt_all (at, nat, nthreads);
+
+	  /* Walk down the tree the way one bisection at a time would have */
+	  for (l = 0, k = 0; l < levels && hi - lo > hi * SEARCH_TOL; l++)
+	    {
+	      if (vflag > 0)
+		fprintf (stderr, "bounds: distance %f %s\n", at[k].d, at[k].hullsize >= 0 ? "succeeded" : "failed");
+	      if (at[k].hullsize >= 0)
+		keep_best (&best, &at[k], &hi, &hullsize), k = 2 * k + 1;
+	      else
+		lo = at[k].d, k = 2 * k + 2;
+	    }
+	}
+    }
+
+  for (t = 0; t < nthreads; t++)
+    {
+      free (at[t].perm);
+      free (at[t].poly);
+    }
+  free (at);
+
+  /* In case something funky happens; just make a convex hull */
+ convex:
+  if (hullsize < 0)
+    {
+      if (vflag > 0 && npoints >= 3)
+	fprintf (stderr, "bounds: no distance from %f to %f succeeded, using the convex hull\n", start, max (start, diag * 4));
+      sorted = (point_t*) malloc (max (npoints, 1) * sizeof (point_t));
+      if (!sorted)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the concave search\n");
+	  exit (EXIT_FAILURE);
+	}
+      memcpy (sorted, points, npoints * sizeof (point_t));
+      qsort (sorted, npoints, sizeof (point_t), compare_xy);
+      mc_convex (sorted, npoints, &best);
+      for (k = 0; k < best.n; k++)
+	rings_add (rings, sorted[best.idx[k]]);
+      hullsize = best.n - 1;
+      hi = INFINITY;
+      free (sorted);
+    }
+  else
+    for (k = 0; k < best.n; k++)
+      rings_add (rings, points[best.idx[k]]);
+  rings_close (rings, 0);
+  ring_free (&best);
+
+  *d = hi;
+  return hullsize;
+}
+
+/* One group of points for `dpw_concave_multi` and its hull
+ */
+typedef struct
+{
+  point_t* pnts;
+  int npoints;
+  double d;
+  rings_t hull;
+  ssize_t hullsize;
+} part_t;
+
+typedef struct
+{
+  part_t** order;
+  int nparts;
+  int prefilter;
+  int next;
+  pthread_mutex_t lock;
+} part_queue_t;
+
+/* Take groups off the queue, `arg` pointing to it, and hull them until it
+ * is empty
+ */
+static void*
+part_run (void* arg)
+{
+  part_queue_t* q = *(part_queue_t**) arg;
+  part_t* p;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&q->lock);
+      p = (q->next < q->nparts) ? q->order[q->next++] : NULL;
+      pthread_mutex_unlock (&q->lock);
+      if (!p) break;
+
+      rings_init (&p->hull);
+      p->hullsize = dpw_concave_search (p->pnts, p->npoints, &p->d, 1, q->prefilter, 0, &p->hull);
+    }
+  return NULL;
+}
+
+static int
+part_compare (const void* a, const void* b)
+{
+  const part_t* p1 = *(part_t* const*) a;
+  const part_t* p2 = *(part_t* const*) b;
+
+  if (p1->npoints != p2->npoints)
+    return (p1->npoints > p2->npoints) ? -1 : 1;
+  return (p1 > p2) - (p1 < p2);
+}
+
+/* A group of one or two points, as the closed ring through them, so the
+ * boundary holds them too.
+ */
+static void
+small_ring (rings_t* rings, point_t* pnts, int npoints)
+{
+  int i;
+
+  for (i = 0; i < npoints; i++)
+    rings_add (rings, pnts[i]);
+  rings_add (rings, pnts[0]);
+  rings_close (rings, 0);
+}
+
+/* Concave hulls of each group of points linked by `d`
+ * -- The groups are found with `point_components` and each one is hulled with
+ * `dpw_concave_search`, starting from `d`, on up to `nthreads` threads; if `d` is
+ * zero it is estimated from the point spacing.  Groups of fewer than three points
+ * are recorded as the closed ring through their points.  The hulls are recorded
+ * in `rings` in order of each group's first point and `d` gets the largest
+ * distance used.
+ * Returns the number of polygons.
+ */
+int
+dpw_concave_multi (point_t* points, int npoints, double* d, int nthreads, int prefilter, int vflag, rings_t* rings)
+{
+  part_queue_t q;
+  part_t* parts;
+  point_t* store;
+  int* label;
+  int* fill;
+  int i, c, t, nparts, nsmall = 0, npolys = 0;
+  ssize_t k;
+
+  rings_init (rings);
+  if (npoints < 1) return 0;
+  if (npoints < 3)
+    {
+      small_ring (rings, points, npoints);
+      return 1;
+    }
+
+  if (!(*d > 0))
+    {
+      *d = 2 * nn_spacing (points, npoints, 1024, 0.9);
+      if (vflag > 0)
+	fprintf (stderr, "bounds: estimated a grouping distance of %f\n", *d);
+    }
+
+  label = (int*) malloc (npoints * sizeof (int));
+  if (!label)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the point groups\n");
+      exit (EXIT_FAILURE);
+    }
+  nparts = point_components (points, npoints, *d, label);
+
+  parts = (part_t*) calloc (nparts, sizeof (part_t));
+  fill = (int*) calloc (nparts, sizeof (int));
+  q.order = (part_t**) malloc (nparts * sizeof (part_t*));
+  store = (point_t*) malloc (npoints * sizeof (point_t));
+  if (!parts || !fill || !q.order || !store)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the point groups\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Lay the groups out one after the other */
+  for (i = 0; i < npoints; i++)
+    parts[label[i]].npoints++;
+  for (k = 0, c = 0; c < nparts; k += parts[c].npoints, c++)
+    {
+      parts[c].pnts = store + k;
+      parts[c].d = *d;
+      parts[c].hullsize = -1;
+    }
+  for (i = 0; i < npoints; i++)
+    parts[label[i]].pnts[fill[label[i]]++] = points[i];
+
+  /* Queue the groups worth hulling, largest first to even out the threads */
+  for (q.nparts = 0, c = 0; c < nparts; c++)
+    if (parts[c].npoints >= 3)
+      q.order[q.nparts++] = &parts[c];
+    else
+      nsmall++;
+  qsort (q.order, q.nparts, sizeof (part_t*), part_compare);
+  q.next = 0, q.prefilter = prefilter;
+  pthread_mutex_init (&q.lock, NULL);
+
+  nthreads = min (max (nthreads, 1), max (q.nparts, 1));
+  {
+    part_queue_t* qs[nthreads];
+
+    for (t = 0; t < nthreads; t++)
+      qs[t] = &q;
+    run_jobs (qs, sizeof (part_queue_t*), nthreads, part_run);
+  }
+  pthread_mutex_destroy (&q.lock);
+
+  for (*d = 0, c = 0; c < nparts; c++, npolys++)
+    if (parts[c].npoints >= 3)
+      {
+	for (k = 0; k < parts[c].hull.npnts; k++)
+	  rings_add (rings, parts[c].hull.pnts[k]);
+	rings_close (rings, 0);
+	rings_free (&parts[c].hull);
+	if (parts[c].d != INFINITY) *d = max (*d, parts[c].d);
+      }
+    else
+      small_ring (rings, parts[c].pnts, parts[c].npoints);
+
+  if (vflag > 0)
+    fprintf (stderr, "bounds: found %d groups of points, %d of them of one or two points\n", nparts, nsmall);
+
+  free (label);
+  free (fill);
+  free (q.order);
+  free (parts);
+  free (store);
+  return npolys;
+}
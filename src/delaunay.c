@@ -0,0 +1,549 @@
+/*------------------------------------------------------------
+ * delaunay.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2011, 2012, 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *
+ * The triangulation is a sweep-hull in the manner of 'delaunator'
+ * (Mapbox, ISC license): points are added in order of distance from
+ * a seed triangle and the hull edges are located through an angular hash.
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+#define EDGE_STACK_SIZE 512
+
+typedef struct
+{
+  double d;
+  int i;
+} dist_idx_t;
+
+/* Orientation of p, q, r; 1 if clockwise, else 0.
+ * Triangles come out counter-clockwise, so this is the sign we walk the hull by.
+ */
+static int
+orient_cw (const point_t* p, const point_t* q, const point_t* r)
+{
+  return ((q->x - p->x) * (r->y - q->y) - (q->y - p->y) * (r->x - q->x)) < 0;
+}
+
+/* Return 1 if p is inside the circumcircle of the counter-clockwise triangle a, b, c
+ */
+static int
+in_circle (const point_t* a, const point_t* b, const point_t* c, const point_t* p)
+{
+  double dx = a->x - p->x, dy = a->y - p->y;
+  double ex = b->x - p->x, ey = b->y - p->y;
+  double fx = c->x - p->x, fy = c->y - p->y;
+  double ap = dx * dx + dy * dy;
+  double bp = ex * ex + ey * ey;
+  double cp = fx * fx + fy * fy;
+
+  return dx * (ey * cp - bp * fy) - dy * (ex * cp - bp * fx) + ap * (ex * fy - ey * fx) > 0;
+}
+
+static double
+dist_sq (const point_t* a, const point_t* b)
+{
+  double dx = a->x - b->x, dy = a->y - b->y;
+  return dx * dx + dy * dy;
+}
+
+static double
+circumradius_sq (const point_t* a, const point_t* b, const point_t* c)
+{
+  double dx = b->x - a->x, dy = b->y - a->y;
+  double ex = c->x - a->x, ey = c->y - a->y;
+  double bl = dx * dx + dy * dy;
+  double cl = ex * ex + ey * ey;
+  double d = 0.5 / (dx * ey - dy * ex);
+  double x = (ey * bl - dy * cl) * d;
+  double y = (dx * cl - ex * bl) * d;
+
+  return x * x + y * y;
+}
+
+static point_t
+circumcenter (const point_t* a, const point_t* b, const point_t* c)
+{
+  point_t p;
+  double dx = b->x - a->x, dy = b->y - a->y;
+  double ex = c->x - a->x, ey = c->y - a->y;
+  double bl = dx * dx + dy * dy;
+  double cl = ex * ex + ey * ey;
+  double d = 0.5 / (dx * ey - dy * ex);
+
+  p.x = a->x + (ey * bl - dy * cl) * d;
+  p.y = a->y + (dx * cl - ex * bl) * d;
+  return p;
+}
+
+/* A monotone stand-in for the angle of (dx, dy), in [0..1]
+ */
+static double
+pseudo_angle (double dx, double dy)
+{
+  double p = dx / (fabs (dx) + fabs (dy));
+  return (dy > 0 ? 3 - p : 1 + p) / 4;
+}
+
+static int
+compare_dist_idx (const void* a, const void* b)
+{
+  const dist_idx_t *elem1 = a;
+  const dist_idx_t *elem2 = b;
+
+  if (elem1->d < elem2->d)
+    return -1;
+  else if (elem1->d > elem2->d)
+    return 1;
+  else
+    return elem1->i - elem2->i;
+}
+
+/* The working state of the sweep */
+typedef struct
+{
+  point_t* pnts;
+  int* triangles;
+  int* halfedges;
+  int ntri;
+  int* hull_prev;
+  int* hull_next;
+  int* hull_tri;
+  int* hull_hash;
+  int hash_size;
+  int hull_start;
+  point_t c;
+} sweep_t;
+
+static int
+hash_key (sweep_t* s, point_t* p)
+{
+  /* The hash runs in the mirrored frame so the walk direction matches the hull. */
+  return (int) floor (pseudo_angle (p->x - s->c.x, s->c.y - p->y) * s->hash_size) % s->hash_size;
+}
+
+static void
+link_he (sweep_t* s, int a, int b)
+{
+  s->halfedges[a] = b;
+  if (b != -1) s->halfedges[b] = a;
+}
+
+static int
+add_triangle (sweep_t* s, int i0, int i1, int i2, int a, int b, int c)
+{
+  int t = s->ntri;
+
+  s->triangles[t] = i0, s->triangles[t + 1] = i1, s->triangles[t + 2] = i2;
+  link_he (s, t, a), link_he (s, t + 1, b), link_he (s, t + 2, c);
+  s->ntri += 3;
+  return t;
+}
+
+/* Flip triangles until the pair on half-edge `a` and its neighbours
+ * satisfy the Delaunay condition; return the last half-edge touched.
+ */
+static int
+legalize (sweep_t* s, int a)
+{
+  int edge_stack[EDGE_STACK_SIZE];
+  int i = 0, ar = 0;
+  int b, a0, b0, al, bl, br, p0, pr, pl, p1, hbl, e;
+
+  while (1)
+    {
+      b = s->halfedges[a];
+      a0 = a - a % 3;
+      ar = a0 + (a + 2) % 3;
+
+      if (b == -1)
+	{
+	  if (i == 0) break;
+	  a = edge_stack[--i];
+	  continue;
+	}
+
+      b0 = b - b % 3;
+      al = a0 + (a + 1) % 3;
+      bl = b0 + (b + 2) % 3;
+
+      p0 = s->triangles[ar], pr = s->triangles[a];
+      pl = s->triangles[al], p1 = s->triangles[bl];
+
+      if (in_circle (&s->pnts[p0], &s->pnts[pr], &s->pnts[pl], &s->pnts[p1]))
+	{
+	  s->triangles[a] = p1, s->triangles[b] = p0;
+	  hbl = s->halfedges[bl];
+
+	  /* The edge swapped on the other side of the hull (rare); fix the hull reference */
+	  if (hbl == -1)
+	    {
+	      e = s->hull_start;
+	      do
+		{
+		  if (s->hull_tri[e] == bl)
+		    {
+		      s->hull_tri[e] = a;
+		      break;
+		    }
+		  e = s->hull_prev[e];
+		}
+	      while (e != s->hull_start);
+	    }
+
+	  link_he (s, a, hbl);
+	  link_he (s, b, s->halfedges[ar]);
+	  link_he (s, ar, bl);
+
+	  br = b0 + (b + 1) % 3;
+	  /* Only extremely degenerate input can fill the stack */
+	  if (i < EDGE_STACK_SIZE) edge_stack[i++] = br;
+	}
+      else
+	{
+	  if (i == 0) break;
+	  a = edge_stack[--i];
+	}
+    }
+  return ar;
+}
+
+/* Delaunay triangulate `points`.
+ * Returns 0 on success, or -1 if the points are all collinear.
+ * Near-duplicate points are left out of the triangulation.
+ */
+int
+delaunay (point_t* points, int npoints, delaunay_t* dt)
+{
+  sweep_t s;
+  dist_idx_t* ids;
+  double min_dist, d, min_radius, r;
+  point_t* p;
+  point_t pp;
+  int i, k, j, i0 = 0, i1 = -1, i2 = -1, t, start, e, q, n, tmp;
+  int max_tri;
+  region_t xyi;
+
+  dt->triangles = NULL, dt->halfedges = NULL, dt->ntriangles = 0;
+  if (npoints < 3) return -1;
+
+  minmax (points, npoints, &xyi);
+  pp.x = (xyi.xmin + xyi.xmax) / 2, pp.y = (xyi.ymin + xyi.ymax) / 2;
+
+  /* Pick a seed point close to the center, the point closest to it
+   * and the third point making the smallest circumcircle with those two.
+   */
+  for (min_dist = INFINITY, i = 0; i < npoints; i++)
+    if ((d = dist_sq (&pp, &points[i])) < min_dist)
+      i0 = i, min_dist = d;
+
+  for (min_dist = INFINITY, i = 0; i < npoints; i++)
+    if (i != i0 && (d = dist_sq (&points[i0], &points[i])) < min_dist && d > 0)
+      i1 = i, min_dist = d;
+
+  if (i1 == -1) return -1;
+
+  for (min_radius = INFINITY, i = 0; i < npoints; i++)
+    if (i != i0 && i != i1)
+      {
+	r = circumradius_sq (&points[i0], &points[i1], &points[i]);
+	if (r < min_radius)
+	  i2 = i, min_radius = r;
+      }
+
+  if (min_radius == INFINITY) return -1;
+
+  if (orient_cw (&points[i0], &points[i1], &points[i2]))
+    tmp = i1, i1 = i2, i2 = tmp;
+
+  max_tri = max (2 * npoints - 5, 1);
+  s.pnts = points;
+  s.triangles = (int*) malloc (max_tri * 3 * sizeof (int));
+  s.halfedges = (int*) malloc (max_tri * 3 * sizeof (int));
+  s.hull_prev = (int*) malloc (npoints * sizeof (int));
+  s.hull_next = (int*) malloc (npoints * sizeof (int));
+  s.hull_tri = (int*) malloc (npoints * sizeof (int));
+  s.hash_size = (int) ceil (sqrt (npoints));
+  s.hull_hash = (int*) malloc (s.hash_size * sizeof (int));
+  ids = (dist_idx_t*) malloc (npoints * sizeof (dist_idx_t));
+
+  if (!s.triangles || !s.halfedges || !s.hull_prev || !s.hull_next || !s.hull_tri || !s.hull_hash || !ids)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the triangulation\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Sort the points by distance from the seed triangle circumcenter */
+  s.c = circumcenter (&points[i0], &points[i1], &points[i2]);
+  for (i = 0; i < npoints; i++)
+    ids[i].d = dist_sq (&points[i], &s.c), ids[i].i = i;
+  qsort (ids, npoints, sizeof (dist_idx_t), compare_dist_idx);
+
+  /* Set up the seed triangle as the starting hull */
+  s.hull_start = i0;
+  s.hull_next[i0] = s.hull_prev[i2] = i1;
+  s.hull_next[i1] = s.hull_prev[i0] = i2;
+  s.hull_next[i2] = s.hull_prev[i1] = i0;
+  s.hull_tri[i0] = 0, s.hull_tri[i1] = 1, s.hull_tri[i2] = 2;
+
+  for (i = 0; i < s.hash_size; i++) s.hull_hash[i] = -1;
+  s.hull_hash[hash_key (&s, &points[i0])] = i0;
+  s.hull_hash[hash_key (&s, &points[i1])] = i1;
+  s.hull_hash[hash_key (&s, &points[i2])] = i2;
+
+  s.ntri = 0;
+  add_triangle (&s, i0, i1, i2, -1, -1, -1);
+
+  for (k = 0; k < npoints; k++)
+    {
+      i = ids[k].i;
+      p = &points[i];
+
+      /* Skip near-duplicate points */
+      if (k > 0 && fabs (p->x - pp.x) <= DBL_EPSILON && fabs (p->y - pp.y) <= DBL_EPSILON) continue;
+      pp = *p;
+
+      /* Skip the seed triangle points */
+      if (i == i0 || i == i1 || i == i2) continue;
+
+      /* Find a visible edge on the convex hull using the edge hash */
+      for (start = 0, j = 0, tmp = hash_key (&s, p); j < s.hash_size; j++)
+	{
+	  start = s.hull_hash[(tmp + j) % s.hash_size];
+	  if (start != -1 && start != s.hull_next[start]) break;
+	}
+
+      start = s.hull_prev[start];
+      e = start;
+      while (q = s.hull_next[e], !orient_cw (p, &points[e], &points[q]))
+	{
+	  e = q;
+	  if (e == start)
+	    {
+	      e = -1;
+	      break;
+	    }
+	}
+
+      /* Likely a near-duplicate point; skip it */
+      if (e == -1) continue;
+
+      /* Add the first triangle from the point and flip until it is legal */
+      t = add_triangle (&s, e, i, s.hull_next[e], -1, -1, s.hull_tri[e]);
+      s.hull_tri[i] = legalize (&s, t + 2);
+      s.hull_tri[e] = t;
+
+      /* Walk forward through the hull, adding more triangles and flipping */
+      n = s.hull_next[e];
+      while (q = s.hull_next[n], orient_cw (p, &points[n], &points[q]))
+	{
+	  t = add_triangle (&s, n, i, q, s.hull_tri[i], -1, s.hull_tri[n]);
+	  s.hull_tri[i] = legalize (&s, t + 2);
+	  s.hull_next[n] = n;
+	  n = q;
+	}
+
+      /* Walk backward from the other side, adding more triangles and flipping */
+      if (e == start)
+	{
+	  while (q = s.hull_prev[e], orient_cw (p, &points[q], &points[e]))
+	    {
+	      t = add_triangle (&s, q, i, e, -1, s.hull_tri[e], s.hull_tri[q]);
+	      legalize (&s, t + 2);
+	      s.hull_tri[q] = t;
+	      s.hull_next[e] = e;
+	      e = q;
+	    }
+	}
+
+      /* Update the hull indices and save the two new edges in the hash */
+      s.hull_start = s.hull_prev[i] = e;
+      s.hull_next[e] = s.hull_prev[n] = i;
+      s.hull_next[i] = n;
+
+      s.hull_hash[hash_key (&s, p)] = i;
+      s.hull_hash[hash_key (&s, &points[e])] = e;
+    }
+
+  free (ids);
+  free (s.hull_prev);
+  free (s.hull_next);
+  free (s.hull_tri);
+  free (s.hull_hash);
+
+  dt->triangles = s.triangles;
+  dt->halfedges = s.halfedges;
+  dt->ntriangles = s.ntri / 3;
+  return 0;
+}
+
+void
+delaunay_free (delaunay_t* dt)
+{
+  free (dt->triangles);
+  free (dt->halfedges);
+  dt->triangles = NULL;
+  dt->halfedges = NULL;
+  dt->ntriangles = 0;
+}
+
+/* The next half-edge in the triangle of half-edge `e` */
+static int
+next_he (int e)
+{
+  return (e % 3 == 2) ? e - 2 : e + 1;
+}
+
+static int
+uf_find (int* parent, int a)
+{
+  while (parent[a] != a)
+    parent[a] = parent[parent[a]], a = parent[a];
+  return a;
+}
+
+/* 'Alpha Shape'
+ * -- Removes every triangle with an edge longer than `d` and
+ * records the boundary of what is left in `rings`, grouped as outer
+ * rings each followed by their holes.
+ * If `d` is zero, use the smallest distance that leaves every point
+ * in the shape and record it in `d`.
+ * Returns the number of polygons, or -1 if the points couldn't be triangulated.
+ */
+int
+alpha_shape (point_t* points, int npoints, double* d, rings_t* rings)
+{
+  delaunay_t dt;
+  double* tmax;
+  double* vmin;
+  double d2, l;
+  int* parent;
+  int* outer;
+  unsigned char* kept;
+  unsigned char* seen;
+  int t, e, f, o, n, c, npolys = 0, nhe;
+  ssize_t r0;
+
+  if (delaunay (points, npoints, &dt) < 0)
+    return -1;
+
+  nhe = dt.ntriangles * 3;
+  tmax = (double*) malloc (dt.ntriangles * sizeof (double));
+  kept = (unsigned char*) malloc (dt.ntriangles);
+  seen = (unsigned char*) calloc (nhe, 1);
+  parent = (int*) malloc (dt.ntriangles * sizeof (int));
+  outer = (int*) malloc (dt.ntriangles * sizeof (int));
+
+  if (!tmax || !kept || !seen || !parent || !outer)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the alpha shape\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* The longest (squared) edge of each triangle */
+  for (t = 0; t < dt.ntriangles; t++)
+    for (tmax[t] = 0, e = t * 3; e < t * 3 + 3; e++)
+      {
+	l = dist_sq (&points[dt.triangles[e]], &points[dt.triangles[next_he (e)]]);
+	if (l > tmax[t]) tmax[t] = l;
+      }
+
+  /* Estimate the distance: each point needs at least one triangle
+   * short enough to keep it, take the largest of those.
+   */
+  if (*d <= 0)
+    {
+      vmin = (double*) malloc (npoints * sizeof (double));
+      if (!vmin)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the alpha shape\n");
+	  exit (EXIT_FAILURE);
+	}
+      for (e = 0; e < npoints; e++) vmin[e] = INFINITY;
+      for (e = 0; e < nhe; e++)
+	if (tmax[e / 3] < vmin[dt.triangles[e]])
+	  vmin[dt.triangles[e]] = tmax[e / 3];
+      for (d2 = 0, e = 0; e < npoints; e++)
+	if (vmin[e] != INFINITY && vmin[e] > d2)
+	  d2 = vmin[e];
+      *d = sqrt (d2);
+      free (vmin);
+    }
+  else
+    d2 = *d * *d;
+
+  /* Keep the short triangles and join them into edge-connected components;
+   * with some slack, so the estimate's own triangles (and those of a grid
+   * with edges a rounding off from it) are kept.
+   */
+  d2 *= (1 + 1e-6) * (1 + 1e-6);
+  for (t = 0; t < dt.ntriangles; t++)
+    kept[t] = tmax[t] <= d2, parent[t] = t, outer[t] = -1;
+
+  for (e = 0; e < nhe; e++)
+    {
+      o = dt.halfedges[e];
+      if (o > e && kept[e / 3] && kept[o / 3])
+	parent[uf_find (parent, e / 3)] = uf_find (parent, o / 3);
+    }
+
+  /* Walk the boundary half-edges (kept on the left, gone or nothing on the right)
+   * into rings; at a vertex, turn around through the kept triangles until the
+   * next boundary edge.
+   */
+  rings_init (rings);
+  for (e = 0; e < nhe; e++)
+    {
+      o = dt.halfedges[e];
+      if (seen[e] || !kept[e / 3] || (o != -1 && kept[o / 3]))
+	continue;
+
+      r0 = rings->npnts;
+      f = e;
+      do
+	{
+	  seen[f] = 1;
+	  rings_add (rings, points[dt.triangles[f]]);
+	  n = next_he (f);
+	  while ((o = dt.halfedges[n]) != -1 && kept[o / 3])
+	    n = next_he (o);
+	  f = n;
+	}
+      while (f != e);
+      rings_add (rings, points[dt.triangles[e]]);
+
+      /* Counter-clockwise rings are outer rings, the rest are holes of their component */
+      c = uf_find (parent, e / 3);
+      if (rings_area (rings, r0) > 0)
+	{
+	  outer[c] = rings_close (rings, 0);
+	  npolys++;
+	}
+      else
+	rings_close (rings, 1);
+      rings->owner[rings->nrings - 1] = c;
+    }
+
+  /* Point each hole at the outer ring of its component */
+  for (n = 0; n < rings->nrings; n++)
+    rings->owner[n] = rings->hole[n] ? outer[rings->owner[n]] : n;
+
+  free (tmax);
+  free (kept);
+  free (seen);
+  free (parent);
+  free (outer);
+  delaunay_free (&dt);
+
+  return npolys;
+}
@@ -0,0 +1,361 @@
+/*------------------------------------------------------------
+ * dig.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2011, 2012, 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *
+ * The digging follows the 'concaveman' approach (Park & Oh, 2012, as
+ * done by Mapbox): start from the convex hull and repeatedly replace an
+ * edge with two edges through the nearest inner point.
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+typedef struct
+{
+  double d;
+  int id;
+} heap_item_t;
+
+typedef struct
+{
+  point_t* pnts;
+  pgrid_t pg;
+  sgrid_t sg;
+  unsigned char* used;
+  int* cell_mark;
+  int stamp;
+  /* the boundary as a linked list of nodes */
+  int* node_pnt;
+  int* node_prev;
+  int* node_next;
+  int nnodes;
+  /* the best-first search queue */
+  heap_item_t* heap;
+  int nheap;
+  int heap_cap;
+} dig_t;
+
+static double
+dist_sq (point_t* a, point_t* b)
+{
+  double dx = a->x - b->x, dy = a->y - b->y;
+  return dx * dx + dy * dy;
+}
+
+/* Squared distance from p to the segment a-b
+ */
+static double
+seg_dist_sq (point_t* p, point_t* a, point_t* b)
+{
+  double x = a->x, y = a->y, dx = b->x - x, dy = b->y - y, t;
+
+  if (dx != 0 || dy != 0)
+    {
+      t = ((p->x - x) * dx + (p->y - y) * dy) / (dx * dx + dy * dy);
+      if (t > 1)
+	x = b->x, y = b->y;
+      else if (t > 0)
+	x += dx * t, y += dy * t;
+    }
+  dx = p->x - x, dy = p->y - y;
+  return dx * dx + dy * dy;
+}
+
+/* Squared distance from p to the box x0/x1/y0/y1
+ */
+static double
+box_dist_sq (point_t* p, double x0, double x1, double y0, double y1)
+{
+  double dx = (p->x < x0) ? x0 - p->x : (p->x > x1) ? p->x - x1 : 0;
+  double dy = (p->y < y0) ? y0 - p->y : (p->y > y1) ? p->y - y1 : 0;
+  return dx * dx + dy * dy;
+}
+
+/* Squared distance from the segment a-b to the box x0/x1/y0/y1
+ */
+static double
+seg_box_dist_sq (point_t* a, point_t* b, double x0, double x1, double y0, double y1)
+{
+  double t0 = 0, t1 = 1, p[4], q[4], r, d;
+  point_t c;
+  int i;
+
+  /* Liang-Barsky; if any part of the segment is in the box the distance is zero */
+  p[0] = a->x - b->x, q[0] = a->x - x0;
+  p[1] = b->x - a->x, q[1] = x1 - a->x;
+  p[2] = a->y - b->y, q[2] = a->y - y0;
+  p[3] = b->y - a->y, q[3] = y1 - a->y;
+  for (i = 0; i < 4; i++)
+    {
+      if (p[i] == 0)
+	{
+	  if (q[i] < 0) break;
+	}
+      else
+	{
+	  r = q[i] / p[i];
+	  if (p[i] < 0) t0 = max (t0, r);
+	  else t1 = min (t1, r);
+	  if (t0 > t1) break;
+	}
+    }
+  if (i == 4) return 0;
+
+  /* Otherwise it is between an end and the box, or a corner and the segment */
+  d = min (box_dist_sq (a, x0, x1, y0, y1), box_dist_sq (b, x0, x1, y0, y1));
+  c.x = x0, c.y = y0, d = min (d, seg_dist_sq (&c, a, b));
+  c.x = x1, d = min (d, seg_dist_sq (&c, a, b));
+  c.y = y1, d = min (d, seg_dist_sq (&c, a, b));
+  c.x = x0, d = min (d, seg_dist_sq (&c, a, b));
+  return d;
+}
+
+static int
+orient_p (point_t* a, point_t* b, point_t* c)
+{
+  return ((b->y - a->y) * (c->x - b->x) - (b->x - a->x) * (c->y - b->y)) > 0;
+}
+
+static void
+heap_push (dig_t* dg, double d, int id)
+{
+  int i, up;
+  heap_item_t t;
+
+  if (dg->nheap == dg->heap_cap)
+    {
+      dg->heap_cap = dg->heap_cap ? dg->heap_cap * 2 : 1024;
+      dg->heap = (heap_item_t*) realloc (dg->heap, dg->heap_cap * sizeof (heap_item_t));
+      if (!dg->heap)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+
+  i = dg->nheap++;
+  dg->heap[i].d = d, dg->heap[i].id = id;
+  while (i > 0 && dg->heap[up = (i - 1) / 2].d > dg->heap[i].d)
+    t = dg->heap[up], dg->heap[up] = dg->heap[i], dg->heap[i] = t, i = up;
+}
+
+static heap_item_t
+heap_pop (dig_t* dg)
+{
+  heap_item_t top = dg->heap[0], t;
+  int i = 0, l, m;
+
+  dg->heap[0] = dg->heap[--dg->nheap];
+  while ((l = 2 * i + 1) < dg->nheap)
+    {
+      m = (l + 1 < dg->nheap && dg->heap[l + 1].d < dg->heap[l].d) ? l + 1 : l;
+      if (dg->heap[m].d >= dg->heap[i].d) break;
+      t = dg->heap[m], dg->heap[m] = dg->heap[i], dg->heap[i] = t, i = m;
+    }
+  return top;
+}
+
+/* Return 1 if the segment from point `a` to point `p` crosses no boundary edge
+ */
+static int
+no_intersections (dig_t* dg, int a, int p)
+{
+  int k, n, s1, s2;
+  point_t* pnts = dg->pnts;
+
+  sgrid_query (&dg->sg, &pnts[a], &pnts[p]);
+  for (k = 0; k < dg->sg.nfound; k++)
+    {
+      n = dg->sg.found[k];
+      s1 = dg->node_pnt[n], s2 = dg->node_pnt[dg->node_next[n]];
+      if (s1 != p && s2 != a
+	  && orient_p (&pnts[s1], &pnts[s2], &pnts[a]) != orient_p (&pnts[s1], &pnts[s2], &pnts[p])
+	  && orient_p (&pnts[a], &pnts[p], &pnts[s1]) != orient_p (&pnts[a], &pnts[p], &pnts[s2]))
+	return 0;
+    }
+  return 1;
+}
+
+static void
+cell_push (dig_t* dg, int xi, int yi, point_t* a, point_t* b, double maxd)
+{
+  grid_t* g = &dg->pg.g;
+  int c = yi * g->nx + xi;
+  double d, x0, y0;
+
+  if (xi < 0 || yi < 0 || xi >= g->nx || yi >= g->ny || dg->cell_mark[c] == dg->stamp)
+    return;
+
+  dg->cell_mark[c] = dg->stamp;
+  x0 = g->xmin + xi * g->cell, y0 = g->ymin + yi * g->cell;
+  d = seg_box_dist_sq (a, b, x0, x0 + g->cell, y0, y0 + g->cell);
+  if (d <= maxd) heap_push (dg, d, -(c + 1));
+}
+
+/* Find the inner point nearest the edge a-b (between pa and pb) that is
+ * no further than `maxd` from it, nearer to it than to the neighbouring
+ * edges, and reachable from both ends without crossing the boundary.
+ * Cells and points are visited best-first from a single queue.
+ */
+static int
+find_candidate (dig_t* dg, int pa, int a, int b, int pb, double maxd)
+{
+  grid_t* g = &dg->pg.g;
+  point_t* pnts = dg->pnts;
+  heap_item_t it;
+  int c, k, i, xi, yi;
+  double d;
+
+  dg->nheap = 0, dg->stamp++;
+  cell_push (dg, grid_xi (g, pnts[a].x), grid_yi (g, pnts[a].y), &pnts[a], &pnts[b], INFINITY);
+
+  while (dg->nheap > 0)
+    {
+      it = heap_pop (dg);
+      if (it.id < 0)
+	{
+	  c = -it.id - 1, xi = c % g->nx, yi = c / g->nx;
+	  for (k = dg->pg.start[c]; k < dg->pg.start[c + 1]; k++)
+	    {
+	      i = dg->pg.idx[k];
+	      if (!dg->used[i] && (d = seg_dist_sq (&pnts[i], &pnts[a], &pnts[b])) <= maxd)
+		heap_push (dg, d, i);
+	    }
+	  cell_push (dg, xi - 1, yi, &pnts[a], &pnts[b], maxd);
+	  cell_push (dg, xi + 1, yi, &pnts[a], &pnts[b], maxd);
+	  cell_push (dg, xi, yi - 1, &pnts[a], &pnts[b], maxd);
+	  cell_push (dg, xi, yi + 1, &pnts[a], &pnts[b], maxd);
+	}
+      else
+	{
+	  i = it.id;
+	  if (it.d < seg_dist_sq (&pnts[i], &pnts[pa], &pnts[a])
+	      && it.d < seg_dist_sq (&pnts[i], &pnts[b], &pnts[pb])
+	      && no_intersections (dg, a, i) && no_intersections (dg, b, i))
+	    return i;
+	}
+    }
+  return -1;
+}
+
+/* 'Dig' a concave hull out of the convex hull
+ * -- Edges longer than `length` are dug in towards the nearest inner point
+ * while that point is closer than the edge length over `concavity`.
+ * The points are sorted in place; the boundary is recorded in `rings`.
+ * Returns the number of points in the boundary.
+ */
+ssize_t
+dig_concave (point_t* points, int npoints, double concavity, double length, rings_t* rings)
+{
+  dig_t dg;
+  ring_t hull;
+  ssize_t hullsize, ncells;
+  int* queue;
+  int qhead = 0, qtail = 0, n, i, p, nn;
+  double len, maxd, sqc, sql;
+
+  if (!(concavity > 0)) concavity = 2;
+  sqc = concavity * concavity, sql = length * length;
+
+  /* Start with the convex hull */
+  qsort (points, npoints, sizeof (point_t), compare_xy);
+  ring_init (&hull);
+  mc_convex (points, npoints, &hull);
+  hullsize = hull.n;
+  if (hullsize > 1) hullsize--;
+
+  dg.pnts = points;
+  dg.used = (unsigned char*) calloc (npoints, 1);
+  dg.node_pnt = (int*) malloc (npoints * sizeof (int));
+  dg.node_prev = (int*) malloc (npoints * sizeof (int));
+  dg.node_next = (int*) malloc (npoints * sizeof (int));
+  queue = (int*) malloc ((hullsize + 2 * npoints) * sizeof (int));
+  dg.heap = NULL, dg.nheap = 0, dg.heap_cap = 0, dg.stamp = 0;
+
+  pgrid_init (&dg.pg, points, npoints, 0);
+  sgrid_init (&dg.sg, &dg.pg.g);
+  ncells = (ssize_t) dg.pg.g.nx * dg.pg.g.ny;
+  dg.cell_mark = (int*) calloc (ncells, sizeof (int));
+
+  if (!dg.used || !dg.node_pnt || !dg.node_prev || !dg.node_next || !queue || !dg.cell_mark)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the concave hull\n");
+      exit (EXIT_FAILURE);
+    }
+
+  for (n = 0; n < hullsize; n++)
+    {
+      dg.node_pnt[n] = hull.idx[n];
+      dg.node_prev[n] = (n + hullsize - 1) % hullsize;
+      dg.node_next[n] = (n + 1) % hullsize;
+      dg.used[dg.node_pnt[n]] = 1;
+    }
+  dg.nnodes = hullsize;
+  ring_free (&hull);
+
+  for (n = 0; n < dg.nnodes; n++)
+    {
+      sgrid_insert (&dg.sg, n, &points[dg.node_pnt[n]], &points[dg.node_pnt[dg.node_next[n]]]);
+      queue[qtail++] = n;
+    }
+
+  /* Dig each edge in turn; a dug edge and the new edge go back on the queue */
+  while (hullsize > 2 && qhead < qtail)
+    {
+      n = queue[qhead++];
+      nn = dg.node_next[n];
+      len = dist_sq (&points[dg.node_pnt[n]], &points[dg.node_pnt[nn]]);
+      if (len < sql) continue;
+
+      maxd = len / sqc;
+      p = find_candidate (&dg, dg.node_pnt[dg.node_prev[n]], dg.node_pnt[n], dg.node_pnt[nn],
+			  dg.node_pnt[dg.node_next[nn]], maxd);
+
+      if (p != -1 && min (dist_sq (&points[p], &points[dg.node_pnt[n]]),
+			  dist_sq (&points[p], &points[dg.node_pnt[nn]])) <= maxd)
+	{
+	  i = dg.nnodes++;
+	  dg.node_pnt[i] = p, dg.used[p] = 1;
+	  dg.node_prev[i] = n, dg.node_next[i] = nn;
+	  dg.node_next[n] = i, dg.node_prev[nn] = i;
+
+	  sgrid_insert (&dg.sg, n, &points[dg.node_pnt[n]], &points[p]);
+	  sgrid_insert (&dg.sg, i, &points[p], &points[dg.node_pnt[nn]]);
+	  queue[qtail++] = n;
+	  queue[qtail++] = i;
+	}
+    }
+
+  /* Record the boundary, closed */
+  rings_init (rings);
+  n = 0;
+  do
+    {
+      rings_add (rings, points[dg.node_pnt[n]]);
+      n = dg.node_next[n];
+    }
+  while (n != 0 && hullsize > 0);
+  if (hullsize > 0)
+    rings_add (rings, points[dg.node_pnt[0]]);
+  rings_close (rings, 0);
+
+  pgrid_free (&dg.pg);
+  sgrid_free (&dg.sg);
+  free (dg.cell_mark);
+  free (dg.heap);
+  free (dg.used);
+  free (dg.node_pnt);
+  free (dg.node_prev);
+  free (dg.node_next);
+  free (queue);
+
+  return rings->npnts - 1;
+}
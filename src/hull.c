@@ -88,9 +88,40 @@ ccw2 (point_t* p1, point_t* p2, point_t* p3)
   return (p2->x - p1->x) * (p3->y - p2->y) - (p2->y - p1->y) * (p3->x - p2->x);
 }
 
+/* The sign of ccw for points of whole steps, less than QUANT_MAX from the
+ * origin: the differences are under 2^31 and their products under 2^62,
+ * so the determinant is exact in 64 bits.
+ */
+static int
+ccw_steps (int64_t x1, int64_t y1, int64_t x2, int64_t y2, int64_t x3, int64_t y3)
+{
+  int64_t ccwv = (y2 - y1) * (x3 - x2) - (x2 - x1) * (y3 - y2);
+  return (ccwv > 0) - (ccwv < 0);
+}
+
+static int
+qccw (qpoint_t* p1, qpoint_t* p2, qpoint_t* p3)
+{
+  return ccw_steps (p1->x, p1->y, p2->x, p2->y, p3->x, p3->y);
+}
+
+/* Set by `hull_lattice` before any hull is started, read-only after
+ */
+static int ccw_lattice = 0;
+
+void
+hull_lattice (int on)
+{
+  ccw_lattice = on;
+}
+
 int
 ccw (point_t* p1, point_t* p2, point_t* p3) 
 {
+  if (ccw_lattice)
+    return ccw_steps ((int64_t) p1->x, (int64_t) p1->y, (int64_t) p2->x, (int64_t) p2->y,
+		      (int64_t) p3->x, (int64_t) p3->y);
+
   float ccwv = (p2->y - p1->y) * (p3->x - p2->x) - (p2->x - p1->x) * (p3->y - p2->y);
   if (ccwv == 0) return 0;
   return (ccwv > 0)? 1: -1;
@@ -128,98 +159,537 @@ intersect_p (line_t l1, line_t l2, int t)
 
 }
 
+#if defined (__GNUC__)
+typedef double vdbl_t __attribute__ ((vector_size (POLYIDX_LANES * sizeof (double))));
+typedef long long vmask_t __attribute__ ((vector_size (POLYIDX_LANES * sizeof (long long))));
+
+/* The segment tests take two edges to a register, as SSE2 has it */
+#define SEG_LANES 2
+
+typedef double sdbl_t __attribute__ ((vector_size (SEG_LANES * sizeof (double))));
+typedef long long smask_t __attribute__ ((vector_size (SEG_LANES * sizeof (long long))));
+#endif
+
+/* Batched segment tests
+ * -- The edges are taken by coordinate, from (`cx`, `cy`) to (`dx`, `dy`),
+ * SEG_LANES at a time.  Each lane works the determinants of ccw in
+ * double, as ccw does, and takes their signs as its conversion to float
+ * would: within 2^-150 of zero (a float zero) is 0, and a NaN is -1.  So
+ * a lane gives what intersect_p (with `t` set) gives its edge, and an
+ * edge of NaNs, as pads the lanes out, meets nothing.  On the lattice of
+ * `hull_lattice` ccw is exact in integers instead, and the edges are
+ * tested one at a time.
+ */
+#if defined (__GNUC__)
+/* Select `x` where `m` is set, else `y` */
+static sdbl_t
+vsel (smask_t m, sdbl_t x, sdbl_t y)
+{
+  return (sdbl_t) (((smask_t) x & m) | ((smask_t) y & ~m));
+}
+
+/* The signs, as 1.0, 0.0 or -1.0; kept in doubles, as SSE2 compares those */
+static sdbl_t
+ccw_signs (sdbl_t v)
+{
+  const sdbl_t zero = {0};
+  const double tiny = 0x1p-150;
+
+  return vsel (v > tiny, zero + 1.0, vsel (v >= -tiny, zero, zero - 1.0));
+}
+
+/* The lanes of the edges meeting `l1` */
+static smask_t
+intersect_lanes (line_t* l1, sdbl_t cx, sdbl_t cy, sdbl_t dx, sdbl_t dy)
+{
+  double ax = l1->p1.x, ay = l1->p1.y, bx = l1->p2.x, by = l1->p2.y;
+  double xlo = min (ax, bx), xhi = max (ax, bx), ylo = min (ay, by), yhi = max (ay, by);
+  sdbl_t a, b, c, d, cdxlo, cdxhi, cdylo, cdyhi;
+  smask_t m, z;
+  int j;
+
+  a = ccw_signs ((by - ay) * (cx - bx) - (bx - ax) * (cy - by));
+  b = ccw_signs ((by - ay) * (dx - bx) - (bx - ax) * (dy - by));
+  c = ccw_signs ((dy - cy) * (ax - dx) - (dx - cx) * (ay - dy));
+  d = ccw_signs ((dy - cy) * (bx - dx) - (dx - cx) * (by - dy));
+
+  m = (a != b) & (c != d);
+
+  /* The ends lying on the other segment, as on_line_p has them; only
+   * wanted where an end is collinear, which is seldom.
+   */
+  z = (a == 0) | (b == 0) | (c == 0) | (d == 0);
+  for (j = 0; j < SEG_LANES && !z[j]; j++);
+  if (j == SEG_LANES) return m;
+
+  cdxhi = vsel (cx > dx, cx, dx), cdxlo = vsel (cx < dx, cx, dx);
+  cdyhi = vsel (cy > dy, cy, dy), cdylo = vsel (cy < dy, cy, dy);
+  m |= (a == 0) & (cx <= xhi) & (cx >= xlo) & (cy <= yhi) & (cy >= ylo);
+  m |= (b == 0) & (dx <= xhi) & (dx >= xlo) & (dy <= yhi) & (dy >= ylo);
+  m |= (c == 0) & (ax <= cdxhi) & (ax >= cdxlo) & (ay <= cdyhi) & (ay >= cdylo);
+  m |= (d == 0) & (bx <= cdxhi) & (bx >= cdxlo) & (by <= cdyhi) & (by >= cdylo);
+  return m;
+}
+
+/* The edges reaching the ray `lt` from p1 off to the right, gathered
+ * SEG_LANES at a time; `k` gets the crossings and `l` the edges with an
+ * end level with p1, lane by lane, as inside_edge counts them.
+ */
+typedef struct
+{
+  sdbl_t cx, cy, dx, dy;
+  smask_t k, l;
+  int n;
+} inside_acc_t;
+
+static void
+inside_flush (line_t* lt, inside_acc_t* acc)
+{
+  double py = lt->p1.y;
+  int j;
+
+  if (acc->n == 0) return;
+  for (j = acc->n; j < SEG_LANES; j++)
+    acc->cx[j] = acc->cy[j] = acc->dx[j] = acc->dy[j] = NAN;
+  acc->l -= (py == acc->dy) | (py == acc->cy);
+  acc->k -= intersect_lanes (lt, acc->cx, acc->cy, acc->dx, acc->dy);
+  acc->n = 0;
+}
+
+/* Add the edge (x0, y0) to (x1, y1) unless, as most are, it is wholly
+ * above or below the ray.
+ */
+static void
+inside_push (line_t* lt, inside_acc_t* acc, double x0, double y0, double x1, double y1)
+{
+  double py = lt->p1.y;
+
+  if ((y0 > py && y1 > py) || (y0 < py && y1 < py))
+    return;
+  acc->cx[acc->n] = x0, acc->cy[acc->n] = y0, acc->dx[acc->n] = x1, acc->dy[acc->n] = y1;
+  if (++acc->n == SEG_LANES)
+    inside_flush (lt, acc);
+}
+
+/* The counts of `acc`, once flushed */
+static void
+inside_sum (inside_acc_t* acc, int* k, int* l)
+{
+  int j;
+
+  for (j = 0; j < SEG_LANES; j++)
+    *k += acc->k[j], *l += acc->l[j];
+}
+#endif
+
+/* Count edge `e` of `poly` against the ray from p1 off to the right:
+ * `k` gets the crossings, `l` the edges with an end level with p1.
+ */
+static void
+inside_edge (point_t* p1, line_t* lt, point_t* poly, ssize_t e, int* k, int* l)
+{
+  line_t lp;
+
+  /* An edge wholly above or below the ray can neither cross nor touch it */
+  if ((poly[e].y > p1->y && poly[e+1].y > p1->y) || (poly[e].y < p1->y && poly[e+1].y < p1->y))
+    return;
+
+  lp.p1 = poly[e], lp.p2 = poly[e+1];
+
+  if (lt->p1.y == lp.p2.y || lt->p1.y == lp.p1.y) (*l)++;
+
+  if (intersect_p (*lt, lp, 1)) (*k)++;
+}
+
 /* Return 1 if point p1 is inside polygon poly, otherwise return 0
  */
 int
 inside_p (point_t* p1, point_t* poly, ssize_t hullsize) 
 {
-  int k = 0, l, l1;
+  int k = 0, l = 0;
   ssize_t i;
   point_t p2;
-  line_t lt, lp;
+  line_t lt;
+
+  /* In steps, the ray ends at QUANT_MAX, past any point and still exact */
+  p2.y = p1->y, p2.x = ccw_lattice ? QUANT_MAX : FLT_MAX;
+  lt.p1 = *p1, lt.p2 = p2;
+
+  i = 0;
+#if defined (__GNUC__)
+  if (!ccw_lattice)
+    {
+      inside_acc_t acc = {.n = 0};
+
+      for (; i < hullsize; i++)
+	inside_push (&lt, &acc, poly[i].x, poly[i].y, poly[i + 1].x, poly[i + 1].y);
+      inside_flush (&lt, &acc);
+      inside_sum (&acc, &k, &l);
+    }
+#endif
+  for (; i < hullsize; i++) 
+    inside_edge (p1, &lt, poly, i, &k, &l);
+
+  if (l == 2) return 1;
+
+  return k & 1;
+}
+
+/* Return 1 if point p1 is inside the indexed polygon, otherwise return 0;
+ * the same answer as `inside_p`, only looking at the edges in p1's band.
+ */
+int
+polyidx_inside_p (polyidx_t* pi, point_t* p1)
+{
+  int k = 0, l = 0, b, j;
+  point_t p2;
+  line_t lt;
+
+  if (pi->nedges == 0 || p1->y < pi->ymin || p1->y > pi->ymax) return 0;
 
-  p2.y = p1->y, p2.x = FLT_MAX;
+  p2.y = p1->y, p2.x = ccw_lattice ? QUANT_MAX : FLT_MAX;
   lt.p1 = *p1, lt.p2 = p2;
-  l = 0;
 
-  for (i = 0; i < hullsize; i++) 
+  b = polyidx_band (pi, p1->y);
+#if defined (__GNUC__)
+  /* The band's edges by coordinate, a register at a time; the lanes
+   * wholly above or below the ray, and the NaNs padding the band out,
+   * count nothing, as in inside_edge.
+   */
+  if (!ccw_lattice)
     {
-      lp.p1 = poly[i], lp.p2 = poly[i+1];
-    
-      if (lt.p1.y == lp.p2.y || lt.p1.y == lp.p1.y) l++;
+      sdbl_t cx, cy, dx, dy;
+      smask_t keep, vk = {0}, vl = {0};
+      double py = lt.p1.y;
+      int e = pi->vstart[b] + pi->start[b + 1] - pi->start[b], i;
 
-      if (intersect_p (lt, lp, 1)) k++;
+      for (j = pi->vstart[b]; j < e; j += SEG_LANES)
+	{
+	  memcpy (&cy, pi->vy0 + j, sizeof (sdbl_t)), memcpy (&dy, pi->vy1 + j, sizeof (sdbl_t));
+	  keep = ((cy <= py) | (dy <= py)) & ((cy >= py) | (dy >= py));
+	  for (i = 0; i < SEG_LANES && !keep[i]; i++);
+	  if (i == SEG_LANES) continue;
+
+	  memcpy (&cx, pi->vx0 + j, sizeof (sdbl_t)), memcpy (&dx, pi->vx1 + j, sizeof (sdbl_t));
+	  vl -= keep & ((py == dy) | (py == cy));
+	  vk -= keep & intersect_lanes (&lt, cx, cy, dx, dy);
+	}
+      for (i = 0; i < SEG_LANES; i++)
+	k += vk[i], l += vl[i];
+      return (l == 2) ? 1 : k & 1;
     }
+#endif
+  for (j = pi->start[b]; j < pi->start[b + 1]; j++)
+    inside_edge (p1, &lt, pi->poly, pi->edge[j], &k, &l);
 
   if (l == 2) return 1;
 
   return k & 1;
 }
 
+/* Return 1 if p1 is inside the indexed rings or on one of their edges,
+ * otherwise return 0.
+ * -- Counts the edges crossing a ray to the right of p1, taking each
+ * edge's lower end as on the edge and its upper end as off it, so a ray
+ * through a vertex counts once; holes fall out of the even-odd count.
+ * The edges of p1's band are tested POLYIDX_LANES at a time.
+ */
+int
+polyidx_contains (polyidx_t* pi, point_t* p1)
+{
+  double px = p1->x, py = p1->y;
+  int j, k, cross = 0, on = 0;
+
+  if (pi->nedges == 0 || !(py >= pi->ymin && py <= pi->ymax)) return 0;
+
+  k = polyidx_band (pi, py);
+#if defined (__GNUC__)
+  vdbl_t x0, y0, x1, y1, s;
+  vmask_t up, down, vcross = {0}, von = {0};
+
+  for (j = pi->vstart[k]; j < pi->vstart[k + 1]; j += POLYIDX_LANES)
+    {
+      memcpy (&x0, pi->vx0 + j, sizeof (vdbl_t)), memcpy (&y0, pi->vy0 + j, sizeof (vdbl_t));
+      memcpy (&x1, pi->vx1 + j, sizeof (vdbl_t)), memcpy (&y1, pi->vy1 + j, sizeof (vdbl_t));
+
+      /* Positive when p1 is left of the edge, zero when on its line */
+      s = (x1 - x0) * (py - y0) - (y1 - y0) * (px - x0);
+      up = (y0 <= py) & (y1 > py);
+      down = (y1 <= py) & (y0 > py);
+      vcross -= (up & (s > 0)) | (down & (s < 0));
+      von |= (s == 0) & (((x0 <= px) & (px <= x1)) | ((x1 <= px) & (px <= x0)))
+	& (((y0 <= py) & (py <= y1)) | ((y1 <= py) & (py <= y0)));
+    }
+  for (j = 0; j < POLYIDX_LANES; j++)
+    cross += vcross[j], on |= (von[j] != 0);
+#else
+  double s;
+
+  for (j = pi->vstart[k]; j < pi->vstart[k + 1]; j++)
+    {
+      double x0 = pi->vx0[j], y0 = pi->vy0[j], x1 = pi->vx1[j], y1 = pi->vy1[j];
+
+      s = (x1 - x0) * (py - y0) - (y1 - y0) * (px - x0);
+      if (y0 <= py && y1 > py && s > 0) cross++;
+      else if (y1 <= py && y0 > py && s < 0) cross++;
+      if (s == 0 && min (x0, x1) <= px && px <= max (x0, x1)
+	  && min (y0, y1) <= py && py <= max (y0, y1))
+	on = 1;
+    }
+#endif
+  return on || (cross & 1);
+}
+
+/* The points `dpw_concave` has yet to place, by array position, bucketed
+ * by grid cell: cell `c` holds `pg.idx[pg.start[c]]` to
+ * `pg.idx[pg.start[c] + count[c] - 1]` and `slot` maps a position back
+ * to its place in `pg.idx`.
+ */
+typedef struct
+{
+  pgrid_t pg;
+  int* count;
+  int* slot;
+} dpw_grid_t;
+
+typedef struct
+{
+  float cth;
+  int i;
+} dpw_cand_t;
+
+static int
+dpw_cell (dpw_grid_t* dg, point_t* p)
+{
+  return grid_yi (&dg->pg.g, p->y) * dg->pg.g.nx + grid_xi (&dg->pg.g, p->x);
+}
+
+/* Drop position `i` (holding point `p`) from the grid
+ */
+static void
+dpw_grid_remove (dpw_grid_t* dg, int i, point_t* p)
+{
+  int c = dpw_cell (dg, p);
+  int k = dg->slot[i];
+  int last = dg->pg.start[c] + --dg->count[c];
+
+  dg->pg.idx[k] = dg->pg.idx[last];
+  dg->slot[dg->pg.idx[k]] = k;
+}
+
+/* Sort candidates by angle, ties going to the later position
+ * (the order the scan over positions would settle on).
+ */
+static int
+dpw_compare (const void* a, const void* b)
+{
+  const dpw_cand_t *elem1 = a;
+  const dpw_cand_t *elem2 = b;
+
+  if (elem1->cth < elem2->cth)
+    return -1;
+  else if (elem1->cth > elem2->cth)
+    return 1;
+  else
+    return elem2->i - elem1->i;
+}
+
+/* Return 1 if `l1` meets any of the boundary edges found by `sg`; edge
+ * `f` runs from (`hx[f]`, `hy[f]`) to (`hx[f+1]`, `hy[f+1]`).
+ */
+static int
+dpw_meets (line_t* l1, double* hx, double* hy, sgrid_t* sg)
+{
+  line_t l2;
+  int k = 0, j, f;
+
+#if defined (__GNUC__)
+  if (!ccw_lattice)
+    {
+      sdbl_t cx, cy, dx, dy;
+      smask_t m;
+
+      for (; k < sg->nfound; k += SEG_LANES)
+	{
+	  for (j = 0; j < SEG_LANES; j++)
+	    if (k + j < sg->nfound)
+	      {
+		f = sg->found[k + j];
+		cx[j] = hx[f], cy[j] = hy[f], dx[j] = hx[f + 1], dy[j] = hy[f + 1];
+	      }
+	    else
+	      cx[j] = cy[j] = dx[j] = dy[j] = NAN;
+	  m = intersect_lanes (l1, cx, cy, dx, dy);
+	  for (j = 0; j < SEG_LANES; j++)
+	    if (m[j]) return 1;
+	}
+      return 0;
+    }
+#endif
+  for (; k < sg->nfound; k++)
+    {
+      f = sg->found[k];
+      l2.p1.x = hx[f], l2.p1.y = hy[f], l2.p2.x = hx[f + 1], l2.p2.y = hy[f + 1];
+      if (intersect_p (*l1, l2, 1)) return 1;
+    }
+  return 0;
+}
+
 /* A 'package-wrap' concavehull 
  * -- Retruns the number of points in the boundary;
- * The hull makes up the begining of the points array.
+ * Hulls the points `points[perm[0]]` to `points[perm[npoints-1]]`, reordering
+ * `perm` (which needs room for one more) and leaving the points alone.
+ * The hull makes up the begining of `perm`, its first index repeated last,
+ * and the `npoints - hullsize` points off it follow.
  * Generate the concave hull using the given distance threshold
+ *
+ * The points still to be placed are found through a grid of `d` sized
+ * cells and the boundary edges through a segment grid, so each step only
+ * looks at its neighbourhood; the candidates are tried in the order the
+ * full scan would have settled on them, so the result is the same.  The
+ * boundary so far is kept by coordinate, for the edges to be tested a few
+ * at a time.
  */
+/* The point at position `k` of the permutation */
+#define P(k) (&points[perm[k]])
+
 ssize_t
-dpw_concave (point_t* points, int npoints, double d) 
+dpw_concave (point_t* points, pidx_t* perm, int npoints, double d) 
 {
-  int i, min, M, k, j;
-  float th, cth, fth;
-  point_t t, t0;
-  line_t l1, l2;
-  int rein = 0;
+  int i, min, M, k, j, c, xi, yi, x0, x1, y0, y1;
+  float th, cth;
+  double r;
+  pidx_t t;
+  line_t l1;
+  double *hx, *hy;
+  dpw_grid_t dg;
+  sgrid_t sg;
+  dpw_cand_t* cand;
+  int ncand, cand_cap = 1024;
+  ssize_t ncells, hullsize = -1;
 
   /* Find the minimum y value in the dataset */
   for (min = 0, i = 1; i < npoints; i++)
-    if (points[i].y < points[min].y) 
+    if (P(i)->y < P(min)->y) 
       min = i;
 
-  /* Loop through all the points, starting with the point found above. */
-  for (M = 0; M < npoints; M++) 
+  /* Start with that point and re-insert it at the end of the dataset */
+  t = perm[0], perm[0] = perm[min], perm[min] = t;
+  perm[npoints] = perm[0];
+
+  /* Grid the remaining positions, 1 to npoints */
+  pgrid_init_idx (&dg.pg, points, perm, npoints + 1, d);
+  ncells = (ssize_t) dg.pg.g.nx * dg.pg.g.ny;
+  dg.count = (int*) malloc (ncells * sizeof (int));
+  dg.slot = (int*) malloc ((npoints + 1) * sizeof (int));
+  cand = (dpw_cand_t*) malloc (cand_cap * sizeof (dpw_cand_t));
+  hx = (double*) malloc ((npoints + 1) * sizeof (double));
+  hy = (double*) malloc ((npoints + 1) * sizeof (double));
+
+  if (!dg.count || !dg.slot || !cand || !hx || !hy)
     {
-      t = points[M], points[M] = points[min], points[min] = t;
-      min = -1, k = 0, th = 2*M_PI;
-      
-      /* Re-insert the first point into the dataset */
-      if (!rein)
-	  points[npoints] = points[0], rein = 1;
-      
-      /* Loop through the remaining points and find the next concave point; 
-	 less than distance threshold -> less than working theta -> does not 
-	 intersect existing boundary */
-      for (i = M + 1; i <= npoints; i++) 
-	if (dist_euclid (&points[M], &points[i]) <= d) 
-	  {
-	    if (M == 0) cth = theta (&points[M], &points[i]);
-	    else cth = atheta (&points[M], &points[i], &points[M - 1]);
+      fprintf (stderr, "bounds: failed to allocate needed memory for the concave hull\n");
+      exit (EXIT_FAILURE);
+    }
 
-	    if (cth > FLT_EPSILON && cth <= th) 
-	      {
-		l1.p1 = points[M], l1.p2 = points[i];
+  for (c = 0; c < ncells; c++)
+    dg.count[c] = dg.pg.start[c + 1] - dg.pg.start[c];
+  for (k = 0; k <= npoints; k++)
+    dg.slot[dg.pg.idx[k]] = k;
+  dpw_grid_remove (&dg, 0, P(0));
 
-		for (k = 0, j = 1; j < M - 1; j++) 
-		  {
-		    l2.p1 = points[j], l2.p2 = points[j + 1];
-		    if (intersect_p (l1, l2, 1)) k++;
-		  }
+  sgrid_init (&sg, &dg.pg.g);
+  r = d * (1 + 1e-6);
 
-		if (k == 0) min = i, th = cth;
-	      }
-	  }
+  /* Loop through all the points, starting with the point found above. */
+  for (M = 0, min = 0; M < npoints; M++) 
+    {
+      if (M > 0)
+	{
+	  /* Position `min` leaves the grid, position `M` moves to it */
+	  dpw_grid_remove (&dg, min, P(min));
+	  if (min != M)
+	    {
+	      dg.pg.idx[dg.slot[M]] = min;
+	      dg.slot[min] = dg.slot[M];
+	    }
+	  t = perm[M], perm[M] = perm[min], perm[min] = t;
+
+	  /* The boundary edges checked below are 1 to M-2 */
+	  if (M >= 3)
+	    sgrid_insert (&sg, M - 2, P(M - 2), P(M - 1));
+	}
+      hx[M] = P(M)->x, hy[M] = P(M)->y;
+      min = -1, th = 2*M_PI;
+      
+      /* Gather the nearby points that are less than distance threshold 
+	 and less than working theta, ordered by theta */
+      x0 = grid_xi (&dg.pg.g, P(M)->x - r), x1 = grid_xi (&dg.pg.g, P(M)->x + r);
+      y0 = grid_yi (&dg.pg.g, P(M)->y - r), y1 = grid_yi (&dg.pg.g, P(M)->y + r);
+      for (ncand = 0, yi = y0; yi <= y1; yi++)
+	for (xi = x0; xi <= x1; xi++)
+	  for (c = yi * dg.pg.g.nx + xi, k = dg.pg.start[c]; k < dg.pg.start[c] + dg.count[c]; k++)
+	    {
+	      i = dg.pg.idx[k];
+	      if (dist_euclid (P(M), P(i)) <= d) 
+		{
+		  if (M == 0) cth = theta (P(M), P(i));
+		  else cth = atheta (P(M), P(i), P(M - 1));
+
+		  if (cth > FLT_EPSILON && cth <= th) 
+		    {
+		      if (ncand == cand_cap)
+			{
+			  cand_cap *= 2;
+			  cand = (dpw_cand_t*) realloc (cand, cand_cap * sizeof (dpw_cand_t));
+			  if (!cand)
+			    {
+			      fprintf (stderr, "bounds: failed to allocate needed memory for the concave hull\n");
+			      exit (EXIT_FAILURE);
+			    }
+			}
+		      cand[ncand].cth = cth, cand[ncand].i = i, ncand++;
+		    }
+		}
+	    }
+      qsort (cand, ncand, sizeof (dpw_cand_t), dpw_compare);
+
+      /* The first candidate that does not intersect the existing boundary is next */
+      for (j = 0; j < ncand && min == -1; j++)
+	{
+	  l1.p1 = *P(M), l1.p2 = *P(cand[j].i);
+	  sgrid_query (&sg, &l1.p1, &l1.p2);
+	  if (!dpw_meets (&l1, hx, hy, &sg)) min = cand[j].i;
+	}
 
       /* No point was found, try again with a larger distance threshhold. */
-      if (min == -1) return min;
+      if (min == -1) break;
       
       /* The first point was found again, a successful hull was found! end here. */
       if (min == npoints) 
 	{
-	  points[M + 1] = points[0];
-	  return M + 1;
+	  /* The point left at M + 1 moves to the duplicate's slot, so the
+	   * unplaced points follow the closed ring.
+	   */
+	  perm[npoints] = perm[M + 1];
+	  perm[M + 1] = perm[0];
+	  hullsize = M + 1;
+	  break;
 	}
     }
+
+  pgrid_free (&dg.pg);
+  sgrid_free (&sg);
+  free (dg.count);
+  free (dg.slot);
+  free (cand);
+  free (hx);
+  free (hy);
+  return hullsize;
 }
 
+#undef P
+
 /* 
  * A Monotone-Chain Convex Hull
  * -- Returns a list of points on the convex hull in counter-clockwise order.
@@ -227,31 +697,51 @@ dpw_concave (point_t* points, int npoints, double d)
  * Note: The input points must be sorted first.
  */
 void
-mc_convex (point_t* points, ssize_t npoints, point_ptr_t** out_hull, ssize_t* out_hullsize) 
+mc_convex (point_t* points, ssize_t npoints, ring_t* hull) 
+{
+  ssize_t i, t;
+
+  hull->n = 0;
+
+  /* lower hull */
+  for (i = 0; i < npoints; ++i) 
+    {
+      while (hull->n >= 2 && ccw (&points[hull->idx[hull->n - 2]], &points[hull->idx[hull->n - 1]], &points[i]) <= 0)
+	--hull->n;
+      ring_push (hull, i);
+    }
+ 
+  /* upper hull */
+  for (i = npoints - 2, t = hull->n + 1; i >= 0; --i) 
+    {
+      while (hull->n >= t && ccw (&points[hull->idx[hull->n - 2]], &points[hull->idx[hull->n - 1]], &points[i]) <= 0) 
+	--hull->n;
+      ring_push (hull, i);
+    }
+}
+
+void
+mc_convex_q (qpoint_t* points, ssize_t npoints, ring_t* hull) 
 {
-  point_ptr_t* hull;
-  ssize_t i, t, k = 0;
+  ssize_t i, t;
 
-  hull = *out_hull;
+  hull->n = 0;
 
   /* lower hull */
   for (i = 0; i < npoints; ++i) 
     {
-      while (k >= 2 && ccw (hull[k - 2], hull[k - 1], &points[i]) <= 0)
-	--k;
-      hull[k++] = &points[i];
+      while (hull->n >= 2 && qccw (&points[hull->idx[hull->n - 2]], &points[hull->idx[hull->n - 1]], &points[i]) <= 0)
+	--hull->n;
+      ring_push (hull, i);
     }
  
   /* upper hull */
-  for (i = npoints - 2, t = k + 1; i >= 0; --i) 
+  for (i = npoints - 2, t = hull->n + 1; i >= 0; --i) 
     {
-      while (k >= t && ccw (hull[k - 2], hull[k - 1], &points[i]) <= 0) 
-	--k;
-      hull[k++] = &points[i];
+      while (hull->n >= t && qccw (&points[hull->idx[hull->n - 2]], &points[hull->idx[hull->n - 1]], &points[i]) <= 0) 
+	--hull->n;
+      ring_push (hull, i);
     }
-  
-  *out_hull = hull;
-  *out_hullsize = k;
 }
 
 /* A 'package-wrap' Convex Hull 
@@ -0,0 +1,581 @@
+/*------------------------------------------------------------
+ * index.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2011, 2012, 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+/* Set up the grid geometry over `region` with `cell` sized cells.
+ * The cell size is grown until there are no more than `maxcells` cells.
+ */
+void
+grid_init (grid_t* g, region_t* region, double cell, ssize_t maxcells)
+{
+  double w = region->xmax - region->xmin;
+  double h = region->ymax - region->ymin;
+
+  if (!(cell > 0)) cell = max (max (w, h), 1);
+  while ((w / cell + 1) * (h / cell + 1) > maxcells)
+    cell *= 1.5;
+
+  g->xmin = region->xmin, g->ymin = region->ymin;
+  g->cell = cell;
+  g->nx = (int) (w / cell) + 1;
+  g->ny = (int) (h / cell) + 1;
+}
+
+/* Return the grid column of `x`, clamped to the grid
+ */
+int
+grid_xi (grid_t* g, double x)
+{
+  double v = (x - g->xmin) / g->cell;
+  if (v < 0) return 0;
+  if (v >= g->nx) return g->nx - 1;
+  return (int) v;
+}
+
+/* Return the grid row of `y`, clamped to the grid
+ */
+int
+grid_yi (grid_t* g, double y)
+{
+  double v = (y - g->ymin) / g->cell;
+  if (v < 0) return 0;
+  if (v >= g->ny) return g->ny - 1;
+  return (int) v;
+}
+
+/* Point Grid
+ * -- Buckets the point indices by grid cell; the points in cell `c` are
+ * `idx[start[c]]` to `idx[start[c+1]-1]`.
+ * If `cell` is zero, use a cell size holding about one point.
+ */
+void
+pgrid_init (pgrid_t* pg, point_t* points, int npoints, double cell)
+{
+  pgrid_init_idx (pg, points, NULL, npoints, cell);
+}
+
+/* As `pgrid_init`, over the points `points[perm[0]]` to `points[perm[npoints-1]]`;
+ * the grid then holds positions in `perm` rather than point indices.
+ * A NULL `perm` grids the points in order.
+ */
+void
+pgrid_init_idx (pgrid_t* pg, point_t* points, pidx_t* perm, int npoints, double cell)
+{
+  region_t xyi;
+  ssize_t c, ncells;
+  point_t* p;
+  int i;
+  int* fill;
+
+  if (perm)
+    {
+      xyi.xmin = xyi.xmax = points[perm[0]].x;
+      xyi.ymin = xyi.ymax = points[perm[0]].y;
+      for (i = 1; i < npoints; i++)
+	{
+	  p = &points[perm[i]];
+	  xyi.xmin = min (xyi.xmin, p->x), xyi.xmax = max (xyi.xmax, p->x);
+	  xyi.ymin = min (xyi.ymin, p->y), xyi.ymax = max (xyi.ymax, p->y);
+	}
+    }
+  else
+    minmax (points, npoints, &xyi);
+
+  if (!(cell > 0))
+    cell = sqrt (((xyi.xmax - xyi.xmin) * (xyi.ymax - xyi.ymin)) / max (npoints, 1));
+
+  grid_init (&pg->g, &xyi, cell, (ssize_t) npoints * 4 + 16);
+  ncells = (ssize_t) pg->g.nx * pg->g.ny;
+
+  pg->start = (int*) calloc (ncells + 1, sizeof (int));
+  pg->idx = (int*) malloc (max (npoints, 1) * sizeof (int));
+  fill = (int*) malloc (max (npoints, 1) * sizeof (int));
+
+  if (!pg->start || !pg->idx || !fill)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the point index\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Count, then prefix-sum, then place */
+  for (i = 0; i < npoints; i++)
+    {
+      p = perm ? &points[perm[i]] : &points[i];
+      fill[i] = grid_yi (&pg->g, p->y) * pg->g.nx + grid_xi (&pg->g, p->x);
+      pg->start[fill[i] + 1]++;
+    }
+
+  for (c = 0; c < ncells; c++)
+    pg->start[c + 1] += pg->start[c];
+
+  for (i = 0; i < npoints; i++)
+    pg->idx[pg->start[fill[i]]++] = i;
+
+  /* Placing moved each start to the end of its cell; shift them back */
+  for (c = ncells; c > 0; c--)
+    pg->start[c] = pg->start[c - 1];
+  pg->start[0] = 0;
+
+  free (fill);
+}
+
+void
+pgrid_free (pgrid_t* pg)
+{
+  free (pg->start);
+  free (pg->idx);
+  pg->start = NULL;
+  pg->idx = NULL;
+}
+
+/* Segment Grid
+ * -- Records segment ids in every cell their segment passes through.
+ * Entries are never removed; callers re-check a segment's current geometry.
+ */
+void
+sgrid_init (sgrid_t* sg, grid_t* g)
+{
+  ssize_t c, ncells = (ssize_t) g->nx * g->ny;
+
+  sg->g = *g;
+  sg->head = (int*) malloc (ncells * sizeof (int));
+  sg->next = NULL, sg->seg = NULL;
+  sg->nnodes = 0, sg->cap = 0;
+  sg->mark = NULL, sg->nmark = 0, sg->stamp = 0;
+  sg->found = NULL, sg->nfound = 0, sg->found_cap = 0;
+
+  if (!sg->head)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the segment index\n");
+      exit (EXIT_FAILURE);
+    }
+  for (c = 0; c < ncells; c++)
+    sg->head[c] = -1;
+}
+
+void
+sgrid_free (sgrid_t* sg)
+{
+  free (sg->head);
+  free (sg->next);
+  free (sg->seg);
+  free (sg->mark);
+  free (sg->found);
+  sg->head = NULL, sg->next = NULL, sg->seg = NULL, sg->mark = NULL, sg->found = NULL;
+}
+
+static void
+sgrid_push (sgrid_t* sg, ssize_t c, int id)
+{
+  if (sg->nnodes == sg->cap)
+    {
+      sg->cap = sg->cap ? sg->cap * 2 : 1024;
+      sg->next = (int*) realloc (sg->next, sg->cap * sizeof (int));
+      sg->seg = (int*) realloc (sg->seg, sg->cap * sizeof (int));
+      if (!sg->next || !sg->seg)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the segment index\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  sg->seg[sg->nnodes] = id;
+  sg->next[sg->nnodes] = sg->head[c];
+  sg->head[c] = sg->nnodes++;
+}
+
+/* Call `fn` with each cell the segment p1-p2 passes through (rows of the grid
+ * are spanned by the segment's x-extent within that row).
+ */
+static void
+sgrid_cells (sgrid_t* sg, point_t* p1, point_t* p2, void (*fn) (sgrid_t*, ssize_t, int), int id)
+{
+  grid_t* g = &sg->g;
+  int r, r0, r1, c, c0, c1;
+  double y0, y1, xa, xb, t;
+
+  r0 = grid_yi (g, min (p1->y, p2->y)), r1 = grid_yi (g, max (p1->y, p2->y));
+  for (r = r0; r <= r1; r++)
+    {
+      if (r0 == r1 || p1->y == p2->y)
+	xa = p1->x, xb = p2->x;
+      else
+	{
+	  /* The segment's x at the bottom and top of this row, clipped to its ends */
+	  y0 = max (g->ymin + r * g->cell, min (p1->y, p2->y));
+	  y1 = min (g->ymin + (r + 1) * g->cell, max (p1->y, p2->y));
+	  t = (y0 - p1->y) / (p2->y - p1->y);
+	  xa = p1->x + t * (p2->x - p1->x);
+	  t = (y1 - p1->y) / (p2->y - p1->y);
+	  xb = p1->x + t * (p2->x - p1->x);
+	}
+      /* Pad by a little so rounding never misses a touching cell */
+      c0 = grid_xi (g, min (xa, xb) - g->cell * 1e-9);
+      c1 = grid_xi (g, max (xa, xb) + g->cell * 1e-9);
+      for (c = c0; c <= c1; c++)
+	fn (sg, (ssize_t) r * g->nx + c, id);
+    }
+}
+
+/* Add segment `id` running from p1 to p2
+ */
+void
+sgrid_insert (sgrid_t* sg, int id, point_t* p1, point_t* p2)
+{
+  sgrid_cells (sg, p1, p2, sgrid_push, id);
+}
+
+static void
+sgrid_gather (sgrid_t* sg, ssize_t c, int unused)
+{
+  int n, id;
+
+  (void) unused;
+  for (n = sg->head[c]; n != -1; n = sg->next[n])
+    {
+      id = sg->seg[n];
+      if (id >= sg->nmark)
+	{
+	  int m = sg->nmark;
+	  sg->nmark = max (id + 1, sg->nmark * 2);
+	  sg->mark = (int*) realloc (sg->mark, sg->nmark * sizeof (int));
+	  if (!sg->mark)
+	    {
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the segment grid\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  for (; m < sg->nmark; m++) sg->mark[m] = 0;
+	}
+      if (sg->mark[id] != sg->stamp)
+	{
+	  sg->mark[id] = sg->stamp;
+	  if (sg->nfound == sg->found_cap)
+	    {
+	      sg->found_cap = sg->found_cap ? sg->found_cap * 2 : 256;
+	      sg->found = (int*) realloc (sg->found, sg->found_cap * sizeof (int));
+	      if (!sg->found)
+		{
+		  fprintf (stderr, "bounds: failed to allocate needed memory for the segment grid\n");
+		  exit (EXIT_FAILURE);
+		}
+	    }
+	  sg->found[sg->nfound++] = id;
+	}
+    }
+}
+
+/* Gather the ids of the segments that share a cell with p1-p2 into
+ * `sg->found`; each id is listed once.
+ * Returns the number of ids found.
+ */
+int
+sgrid_query (sgrid_t* sg, point_t* p1, point_t* p2)
+{
+  sg->nfound = 0;
+  sg->stamp++;
+  sgrid_cells (sg, p1, p2, sgrid_gather, 0);
+  return sg->nfound;
+}
+
+static int
+cmp_double (const void* a, const void* b)
+{
+  double da = *(const double*) a, db = *(const double*) b;
+  return (da > db) - (da < db);
+}
+
+/* Estimate the typical nearest-neighbour spacing of the points from
+ * a sample of `nsample` of them (picked with a fixed seed, so runs
+ * repeat); returns the `q` quantile (0 to 1) of the sampled spacings.
+ */
+double
+nn_spacing (point_t* points, int npoints, int nsample, double q)
+{
+  pgrid_t pg;
+  double* sd;
+  double best, dd, dx, dy, ring;
+  unsigned int seed = 2463534242u;
+  int s, i, j, k, r, xi, yi, x, y, c, ns = 0;
+
+  if (npoints < 2) return 0;
+
+  pgrid_init (&pg, points, npoints, 0);
+  sd = (double*) malloc (nsample * sizeof (double));
+  if (!sd)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the spacing estimate\n");
+      exit (EXIT_FAILURE);
+    }
+
+  for (s = 0; s < nsample; s++)
+    {
+      seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+      i = seed % npoints;
+      xi = grid_xi (&pg.g, points[i].x), yi = grid_yi (&pg.g, points[i].y);
+      best = INFINITY;
+
+      /* Search rings of cells outwards until the ring is further than the best */
+      for (r = 0; r < max (pg.g.nx, pg.g.ny); r++)
+	{
+	  ring = (r - 1) * pg.g.cell;
+	  if (ring > 0 && ring * ring > best) break;
+	  for (y = yi - r; y <= yi + r; y++)
+	    for (x = xi - r; x <= xi + r; x += (y == yi - r || y == yi + r) ? 1 : 2 * r)
+	      {
+		if (x < 0 || y < 0 || x >= pg.g.nx || y >= pg.g.ny) continue;
+		for (c = y * pg.g.nx + x, k = pg.start[c]; k < pg.start[c + 1]; k++)
+		  {
+		    j = pg.idx[k];
+		    dx = points[j].x - points[i].x, dy = points[j].y - points[i].y;
+		    dd = dx * dx + dy * dy;
+		    if (dd > 0 && dd < best) best = dd;
+		  }
+	      }
+	}
+      if (best != INFINITY) sd[ns++] = sqrt (best);
+    }
+
+  pgrid_free (&pg);
+
+  qsort (sd, ns, sizeof (double), cmp_double);
+  best = ns > 0 ? sd[(int) (q * (ns - 1))] : 0;
+
+  free (sd);
+  return best;
+}
+
+static int
+uf_find (int* parent, int i)
+{
+  while (parent[i] != i)
+    i = parent[i] = parent[parent[i]];
+  return i;
+}
+
+static void
+uf_union (int* parent, int i, int j)
+{
+  i = uf_find (parent, i), j = uf_find (parent, j);
+  if (i < j) parent[j] = i;
+  else if (j < i) parent[i] = j;
+}
+
+/* Label the groups of points linked by steps of no more than `d`
+ * -- Points sharing a cell of a grid with diagonal `d` are linked outright;
+ * points in nearby cells are compared until their cells are linked.
+ * `label[i]` gets the group of point `i`, numbered in order of first appearance.
+ * Returns the number of groups.
+ */
+int
+point_components (point_t* points, int npoints, double d, int* label)
+{
+  pgrid_t pg;
+  int* parent;
+  int i, j, a, b, x, y, dx, dy, r, whole, ngroups = 0;
+  ssize_t c, c2;
+  double ex, ey, d2 = d * d;
+
+  if (npoints < 1) return 0;
+
+  parent = (int*) malloc (npoints * sizeof (int));
+  if (!parent)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the point groups\n");
+      exit (EXIT_FAILURE);
+    }
+  for (i = 0; i < npoints; i++) parent[i] = i;
+
+  pgrid_init (&pg, points, npoints, d / M_SQRT2);
+
+  /* The grid may have grown its cells to stay small; then a cell is no longer
+   * within `d` across and its points have to be compared like the rest */
+  whole = pg.g.cell * M_SQRT2 <= d;
+  r = (int) ceil (d / pg.g.cell);
+
+  for (y = 0; y < pg.g.ny; y++)
+    for (x = 0; x < pg.g.nx; x++)
+      {
+	c = (ssize_t) y * pg.g.nx + x;
+	if (pg.start[c] == pg.start[c + 1]) continue;
+
+	if (whole)
+	  for (a = pg.start[c] + 1; a < pg.start[c + 1]; a++)
+	    uf_union (parent, pg.idx[pg.start[c]], pg.idx[a]);
+
+	/* This cell against itself (if need be) and the forward half of its neighbours */
+	for (dy = 0; dy <= r && y + dy < pg.g.ny; dy++)
+	  for (dx = (dy == 0) ? (whole ? 1 : 0) : -r; dx <= r; dx++)
+	    {
+	      if (x + dx < 0 || x + dx >= pg.g.nx) continue;
+	      c2 = (ssize_t) (y + dy) * pg.g.nx + x + dx;
+	      if (pg.start[c2] == pg.start[c2 + 1]) continue;
+	      if (whole && uf_find (parent, pg.idx[pg.start[c]]) == uf_find (parent, pg.idx[pg.start[c2]]))
+		continue;
+
+	      for (a = pg.start[c]; a < pg.start[c + 1]; a++)
+		for (b = (c2 == c) ? a + 1 : pg.start[c2]; b < pg.start[c2 + 1]; b++)
+		  {
+		    i = pg.idx[a], j = pg.idx[b];
+		    ex = points[i].x - points[j].x, ey = points[i].y - points[j].y;
+		    if (ex * ex + ey * ey <= d2 && uf_find (parent, i) != uf_find (parent, j))
+		      {
+			uf_union (parent, i, j);
+			if (whole) goto linked;
+		      }
+		  }
+	    linked:;
+	    }
+      }
+
+  pgrid_free (&pg);
+
+  /* Roots are the lowest index in each group, so they come first */
+  for (i = 0; i < npoints; i++)
+    {
+      j = uf_find (parent, i);
+      label[i] = (j == i) ? ngroups++ : label[j];
+    }
+
+  free (parent);
+  return ngroups;
+}
+
+/* Polygon Index
+ * -- Buckets the edges of closed polygon rings by horizontal band, so a point
+ * only has to be tested against the edges that reach into its band.
+ * Ring `r` runs from `poly[rstart[r]]` to `poly[rstart[r+1]-1]`; an edge joins
+ * each point to the next within its ring.
+ */
+static void
+polyidx_build (polyidx_t* pi, point_t* poly, ssize_t* rstart, int nrings)
+{
+  ssize_t e, total, padded;
+  int r, b, b0, b1, k;
+  double y0, y1;
+
+  pi->poly = poly;
+  pi->start = NULL, pi->edge = NULL;
+  pi->nedges = 0;
+  for (r = 0; r < nrings; r++)
+    if (rstart[r + 1] - rstart[r] > 1)
+      pi->nedges += rstart[r + 1] - rstart[r] - 1;
+  pi->ymin = pi->ymax = (rstart[nrings] > 0) ? poly[0].y : 0;
+  for (e = 1; e < rstart[nrings]; e++)
+    pi->ymin = min (pi->ymin, poly[e].y), pi->ymax = max (pi->ymax, poly[e].y);
+
+  /* About one edge per band */
+  pi->nbands = (int) min (max (pi->nedges, 1), 1 << 20);
+  pi->band = (pi->ymax - pi->ymin) / pi->nbands;
+  if (!(pi->band > 0)) pi->nbands = 1, pi->band = 1;
+
+  pi->start = (int*) calloc (pi->nbands + 1, sizeof (int));
+  pi->vstart = (int*) calloc (pi->nbands + 1, sizeof (int));
+  if (!pi->start || !pi->vstart)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the polygon index\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Count, then prefix-sum, then place, as with the point grid */
+  for (total = 0, r = 0; r < nrings; r++)
+    for (e = rstart[r]; e < rstart[r + 1] - 1; e++)
+      {
+	y0 = min (poly[e].y, poly[e + 1].y), y1 = max (poly[e].y, poly[e + 1].y);
+	b0 = polyidx_band (pi, y0), b1 = polyidx_band (pi, y1);
+	for (b = b0; b <= b1; b++)
+	  pi->start[b + 1]++;
+	total += b1 - b0 + 1;
+      }
+  for (padded = 0, b = 0; b < pi->nbands; b++)
+    {
+      pi->vstart[b] = padded;
+      padded += (pi->start[b + 1] + POLYIDX_LANES - 1) / POLYIDX_LANES * POLYIDX_LANES;
+      pi->start[b + 1] += pi->start[b];
+    }
+  pi->vstart[pi->nbands] = padded;
+
+  pi->edge = (int*) malloc (max (total, 1) * sizeof (int));
+  pi->vx0 = (double*) malloc (max (padded, 1) * sizeof (double));
+  pi->vy0 = (double*) malloc (max (padded, 1) * sizeof (double));
+  pi->vx1 = (double*) malloc (max (padded, 1) * sizeof (double));
+  pi->vy1 = (double*) malloc (max (padded, 1) * sizeof (double));
+  if (!pi->edge || !pi->vx0 || !pi->vy0 || !pi->vx1 || !pi->vy1)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the polygon index\n");
+      exit (EXIT_FAILURE);
+    }
+  for (r = 0; r < nrings; r++)
+    for (e = rstart[r]; e < rstart[r + 1] - 1; e++)
+      {
+	y0 = min (poly[e].y, poly[e + 1].y), y1 = max (poly[e].y, poly[e + 1].y);
+	b0 = polyidx_band (pi, y0), b1 = polyidx_band (pi, y1);
+	for (b = b0; b <= b1; b++)
+	  pi->edge[pi->start[b]++] = e;
+      }
+  for (b = pi->nbands; b > 0; b--)
+    pi->start[b] = pi->start[b - 1];
+  pi->start[0] = 0;
+
+  /* Copy each band's edges out by coordinate, padded to whole vectors
+     with NAN edges that never cross or touch anything */
+  for (b = 0; b < pi->nbands; b++)
+    for (k = 0; k < pi->vstart[b + 1] - pi->vstart[b]; k++)
+      {
+	e = pi->vstart[b] + k;
+	if (k < pi->start[b + 1] - pi->start[b])
+	  {
+	    r = pi->edge[pi->start[b] + k];
+	    pi->vx0[e] = poly[r].x, pi->vy0[e] = poly[r].y;
+	    pi->vx1[e] = poly[r + 1].x, pi->vy1[e] = poly[r + 1].y;
+	  }
+	else
+	  pi->vx0[e] = pi->vy0[e] = pi->vx1[e] = pi->vy1[e] = NAN;
+      }
+}
+
+void
+polyidx_init (polyidx_t* pi, point_t* poly, ssize_t nedges)
+{
+  ssize_t rstart[2] = {0, nedges + 1};
+
+  polyidx_build (pi, poly, rstart, 1);
+}
+
+void
+polyidx_init_rings (polyidx_t* pi, rings_t* rings)
+{
+  polyidx_build (pi, rings->pnts, rings->start, rings->nrings);
+}
+
+void
+polyidx_free (polyidx_t* pi)
+{
+  free (pi->start);
+  free (pi->edge);
+  free (pi->vstart);
+  free (pi->vx0), free (pi->vy0), free (pi->vx1), free (pi->vy1);
+  pi->start = NULL, pi->edge = NULL, pi->vstart = NULL;
+  pi->vx0 = pi->vy0 = pi->vx1 = pi->vy1 = NULL;
+}
+
+/* Return the band of `y`, clamped to the index
+ */
+int
+polyidx_band (polyidx_t* pi, double y)
+{
+  double v = (y - pi->ymin) / pi->band;
+  if (v < 0) return 0;
+  if (v >= pi->nbands) return pi->nbands - 1;
+  return (int) v;
+}
@@ -0,0 +1,223 @@
+/*------------------------------------------------------------
+ * label.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+/* Connected-component labelling of the occupied cells of a block grid
+ * -- The first pass takes the runs of occupied cells row by row and joins
+ * each run to the runs of the row below it that it touches, corners
+ * included, in a union-find; the second is the finds, as they're asked for.
+ * A component's root is its first run in row order, so its lowest,
+ * leftmost cell, whose bottom edge is the first edge of its outer ring.
+ */
+void
+blabel_init (blabel_t* lab)
+{
+  lab->y = NULL, lab->x0 = NULL, lab->x1 = NULL, lab->parent = NULL;
+  lab->n = 0, lab->cap = 0;
+  lab->prev0 = 0, lab->prev1 = 0, lab->row0 = 0, lab->row = INT_MIN;
+}
+
+void
+blabel_free (blabel_t* lab)
+{
+  free (lab->y);
+  free (lab->x0);
+  free (lab->x1);
+  free (lab->parent);
+  blabel_init (lab);
+}
+
+static ssize_t
+blabel_find (blabel_t* lab, ssize_t r)
+{
+  while (lab->parent[r] != r)
+    {
+      lab->parent[r] = lab->parent[lab->parent[r]];
+      r = lab->parent[r];
+    }
+  return r;
+}
+
+/* Join the components of runs `a` and `b`, keeping the earlier root
+ */
+static void
+blabel_union (blabel_t* lab, ssize_t a, ssize_t b)
+{
+  a = blabel_find (lab, a), b = blabel_find (lab, b);
+  if (a < b) lab->parent[b] = a;
+  else if (b < a) lab->parent[a] = b;
+}
+
+void
+blabel_run (blabel_t* lab, int y, int x0, int x1)
+{
+  ssize_t q;
+
+  if (lab->n == lab->cap)
+    {
+      lab->cap = lab->cap ? lab->cap * 2 : 4096;
+      lab->y = (int*) realloc (lab->y, lab->cap * sizeof (int));
+      lab->x0 = (int*) realloc (lab->x0, lab->cap * sizeof (int));
+      lab->x1 = (int*) realloc (lab->x1, lab->cap * sizeof (int));
+      lab->parent = (ssize_t*) realloc (lab->parent, lab->cap * sizeof (ssize_t));
+      if (!lab->y || !lab->x0 || !lab->x1 || !lab->parent)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the block labels\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+
+  /* Starting a row, the runs of the row before (if it's the one below) are
+   * the ones to join to.
+   */
+  if (y != lab->row)
+    {
+      if (y == lab->row + 1)
+	lab->prev0 = lab->row0, lab->prev1 = lab->n;
+      else
+	lab->prev0 = lab->prev1 = lab->n;
+      lab->row0 = lab->n, lab->row = y;
+    }
+
+  lab->y[lab->n] = y, lab->x0[lab->n] = x0, lab->x1[lab->n] = x1;
+  lab->parent[lab->n] = lab->n;
+
+  /* Runs of the row below touching this one, corners included, as the
+   * traced rings join them; those ending before the column left of it
+   * can't touch any later run of this row either.
+   */
+  while (lab->prev0 < lab->prev1 && lab->x1[lab->prev0] < x0 - 1)
+    lab->prev0++;
+  for (q = lab->prev0; q < lab->prev1 && lab->x0[q] <= x1 + 1; q++)
+    blabel_union (lab, q, lab->n);
+  lab->n++;
+}
+
+/* Add the runs of one row of occupied bits, `w` holding columns `x` to
+ * `x+63`; `open` is the start of a run carried in from the word before,
+ * or -1, and is returned for the next word.
+ */
+static int
+blabel_word (blabel_t* lab, int y, int x, uint64_t w, int open)
+{
+  int c = 0, e;
+
+  while (c < 64)
+    {
+      if (open < 0)
+	{
+	  if ((w >> c) == 0) break;
+	  c += __builtin_ctzll (w >> c);
+	  open = x + c;
+	}
+      e = (c < 64 && (~w >> c)) ? c + __builtin_ctzll (~w >> c) : 64;
+      if (e >= 64) return open;
+      blabel_run (lab, y, open, x + e - 1);
+      open = -1, c = e;
+    }
+  return open;
+}
+
+void
+blabel_grid (blabel_t* lab, bgrid_t* bg, int r0, int r1)
+{
+  btile_t* tile;
+  ssize_t lo, hi, mid, t;
+  uint64_t w;
+  size_t k;
+  int i, j, r, c, n, open;
+
+  if (!bg->tiles)
+    {
+      for (i = r0; i < r1 && bg->occ; i++)
+	{
+	  open = -1;
+	  for (j = 0, k = (size_t) i * bg->nx; j < bg->nx; j += n, k += n)
+	    {
+	      /* The next (up to) 64 cells of the row, from word-aligned reads */
+	      n = min (64 - (int) (k & 63), bg->nx - j);
+	      w = bg->occ[k >> 6] >> (k & 63);
+	      if (n < 64)
+		w &= ((uint64_t) 1 << n) - 1;
+	      if (w == 0 && open < 0) continue;
+	      for (c = 0; c < n; c++)
+		if ((w >> c) & 1)
+		  {
+		    if (open < 0) open = j + c;
+		  }
+		else if (open >= 0)
+		  {
+		    blabel_run (lab, i, open, j + c - 1);
+		    open = -1;
+		  }
+	    }
+	  if (open >= 0)
+	    blabel_run (lab, i, open, bg->nx - 1);
+	}
+      return;
+    }
+
+  for (lo = 0, hi = bg->ntiles; lo < hi; )
+    {
+      mid = (lo + hi) / 2;
+      if (((bg->tiles[mid]->ty - bg->ty0) << BTILE_SHIFT) < r0) lo = mid + 1;
+      else hi = mid;
+    }
+
+  /* Each row of a row of tiles, across its tiles; a run ending at the edge
+   * of a tile carries on into the tile next to it.
+   */
+  for (; lo < bg->ntiles && ((bg->tiles[lo]->ty - bg->ty0) << BTILE_SHIFT) < r1; lo = hi)
+    {
+      for (hi = lo; hi < bg->ntiles && bg->tiles[hi]->ty == bg->tiles[lo]->ty; hi++);
+      for (r = 0; r < BTILE; r++)
+	{
+	  i = (int) ((bg->tiles[lo]->ty - bg->ty0) << BTILE_SHIFT) + r;
+	  if (i >= bg->ny) break;
+	  open = -1;
+	  for (t = lo; t < hi; t++)
+	    {
+	      tile = bg->tiles[t];
+	      j = (int) ((tile->tx - bg->tx0) << BTILE_SHIFT);
+	      if (open >= 0 && (t == lo || bg->tiles[t - 1]->tx + 1 != tile->tx))
+		{
+		  blabel_run (lab, i, open, (int) ((bg->tiles[t - 1]->tx - bg->tx0) << BTILE_SHIFT) + BTILE - 1);
+		  open = -1;
+		}
+	      open = blabel_word (lab, i, j, tile->occ[r], open);
+	    }
+	  if (open >= 0)
+	    blabel_run (lab, i, open, (int) ((bg->tiles[hi - 1]->tx - bg->tx0) << BTILE_SHIFT) + BTILE - 1);
+	}
+    }
+}
+
+bedge_t
+blabel_root (blabel_t* lab, int x, int y)
+{
+  ssize_t lo = 0, hi = lab->n, mid, r;
+
+  /* The last run starting at or before (x, y) */
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (lab->y[mid] < y || (lab->y[mid] == y && lab->x0[mid] <= x)) lo = mid + 1;
+      else hi = mid;
+    }
+  if (lo == 0 || lab->y[lo - 1] != y || lab->x1[lo - 1] < x)
+    return BEDGE (x, y, 0);
+  r = blabel_find (lab, lo - 1);
+  return BEDGE (lab->x0[r], lab->y[r], 0);
+}
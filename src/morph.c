@@ -0,0 +1,482 @@
+/*------------------------------------------------------------
+ * morph.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+/* Morphology of the block grid
+ * -- Cells are dilated and eroded over a square of radius `r` cells, as
+ * two passes of shifts over a bitmap, across the rows and then down them.
+ * Each pass ORs (or ANDs) the bitmap with copies of itself shifted by 1,
+ * 2, 4... cells, so a radius costs a few sweeps of word operations.
+ * Cells off the bitmap are empty.
+ */
+
+#if defined (__GNUC__)
+typedef uint64_t bvword_t __attribute__ ((vector_size (4 * sizeof (uint64_t))));
+#endif
+
+/* A bitmap of `h` rows of `w` words each, bit `c` of word `j` of a row
+ * being column 64j+c; the columns past `width` are kept empty.
+ */
+typedef struct
+{
+  uint64_t* bits;
+  uint64_t* tmp;
+  int w;
+  int h;
+  int width;
+} bmap_t;
+
+static void
+bmap_init (bmap_t* bm, int width, int h)
+{
+  bm->width = width, bm->h = h;
+  bm->w = (width + 63) / 64;
+  bm->bits = (uint64_t*) calloc ((size_t) bm->w * h + 1, sizeof (uint64_t));
+  bm->tmp = (uint64_t*) calloc ((size_t) bm->w * h + 1, sizeof (uint64_t));
+  if (!bm->bits || !bm->tmp)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block morphology\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+static void
+bmap_free (bmap_t* bm)
+{
+  free (bm->bits);
+  free (bm->tmp);
+  bm->bits = bm->tmp = NULL;
+}
+
+/* `a` = `a` OR (or with `and`, AND) `b`, over `n` words
+ */
+static void
+words_op (uint64_t* a, const uint64_t* b, size_t n, int and)
+{
+  size_t k = 0;
+
+#if defined (__GNUC__)
+  bvword_t va, vb;
+
+  for (; k + 4 <= n; k += 4)
+    {
+      memcpy (&va, a + k, sizeof (va));
+      memcpy (&vb, b + k, sizeof (vb));
+      va = and ? (va & vb) : (va | vb);
+      memcpy (a + k, &va, sizeof (va));
+    }
+#endif
+  for (; k < n; k++)
+    a[k] = and ? (a[k] & b[k]) : (a[k] | b[k]);
+}
+
+/* Set `out` to the row `in` of `w` words moved `s` columns up (to higher
+ * columns) or down, empty cells moving in.
+ */
+static void
+row_shift (uint64_t* out, const uint64_t* in, int w, int s, int up)
+{
+  int j, q = s >> 6, b = s & 63;
+  uint64_t lo, hi;
+
+  for (j = 0; j < w; j++)
+    if (up)
+      {
+	lo = (j - q >= 0) ? in[j - q] : 0;
+	hi = (j - q - 1 >= 0) ? in[j - q - 1] : 0;
+	out[j] = b ? (lo << b) | (hi >> (64 - b)) : lo;
+      }
+    else
+      {
+	lo = (j + q < w) ? in[j + q] : 0;
+	hi = (j + q + 1 < w) ? in[j + q + 1] : 0;
+	out[j] = b ? (lo >> b) | (hi << (64 - b)) : lo;
+      }
+}
+
+/* Dilate (or with `and`, erode) the bitmap over a square of radius `r`
+ */
+static void
+bmap_spread (bmap_t* bm, int r, int and)
+{
+  uint64_t* row;
+  uint64_t* acc;
+  uint64_t* sh;
+  size_t w = bm->w, k;
+  int i, d, s, cov;
+
+  if (r <= 0) return;
+  acc = (uint64_t*) malloc (2 * w * sizeof (uint64_t));
+  sh = (uint64_t*) malloc (w * sizeof (uint64_t));
+  if (!acc || !sh)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block morphology\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Across the rows: the columns up to `r` below, and up to `r` above */
+  for (i = 0; i < bm->h; i++)
+    {
+      row = bm->bits + i * w;
+      for (d = 0; d < 2; d++)
+	{
+	  memcpy (acc + d * w, row, w * sizeof (uint64_t));
+	  for (cov = 1; cov < r + 1; cov += s)
+	    {
+	      s = min (cov, r + 1 - cov);
+	      row_shift (sh, acc + d * w, (int) w, s, d == 0);
+	      words_op (acc + d * w, sh, w, and);
+	    }
+	}
+      words_op (acc, acc + w, w, and);
+      memcpy (row, acc, w * sizeof (uint64_t));
+      if (bm->width & 63)
+	row[w - 1] &= ((uint64_t) 1 << (bm->width & 63)) - 1;
+    }
+
+  /* Down the rows: the rows up to `r` before in `bits`, up to `r` after
+   * in `tmp`; whole rows are contiguous, so these are runs of words.
+   */
+  memcpy (bm->tmp, bm->bits, w * bm->h * sizeof (uint64_t));
+  for (cov = 1; cov < r + 1; cov += s)
+    {
+      s = min (cov, r + 1 - cov);
+      for (i = bm->h - 1; i >= 0; i--)
+	{
+	  if (i - s >= 0)
+	    words_op (bm->bits + i * w, bm->bits + (i - s) * w, w, and);
+	  else if (and)
+	    memset (bm->bits + i * w, 0, w * sizeof (uint64_t));
+	}
+      for (i = 0; i < bm->h; i++)
+	{
+	  if (i + s < bm->h)
+	    words_op (bm->tmp + i * w, bm->tmp + (i + s) * w, w, and);
+	  else if (and)
+	    memset (bm->tmp + i * w, 0, w * sizeof (uint64_t));
+	}
+    }
+  k = w * bm->h;
+  words_op (bm->bits, bm->tmp, k, and);
+
+  free (acc);
+  free (sh);
+}
+
+/* The `n` (up to 64) bits of the bit string `bits` of `nbits` from bit `k`
+ */
+static uint64_t
+bits_get (const uint64_t* bits, size_t nbits, size_t k, int n)
+{
+  uint64_t v = bits[k >> 6] >> (k & 63);
+
+  if ((k & 63) && (k >> 6) + 1 < (nbits + 63) / 64)
+    v |= bits[(k >> 6) + 1] << (64 - (k & 63));
+  return (n < 64) ? v & (((uint64_t) 1 << n) - 1) : v;
+}
+
+/* OR the bits of `v` into the bit string `bits` from bit `k`
+ */
+static void
+bits_put (uint64_t* bits, size_t k, uint64_t v)
+{
+  bits[k >> 6] |= v << (k & 63);
+  if ((k & 63) && (v >> (64 - (k & 63))))
+    bits[(k >> 6) + 1] |= v >> (64 - (k & 63));
+}
+
+/* Dilate (or with `and`, erode) the tiles of a sparse grid over radius
+ * `r`, each from a window of the tiles around it; dilating makes tiles
+ * next to the ones there were.
+ */
+static void
+morph_tiles (bgrid_t* bg, int r, int and)
+{
+  bgrid_t out;
+  bmap_t bm;
+  btile_t* tile;
+  btile_t* src;
+  uint64_t cols;
+  ssize_t t, n;
+  int k = (r + BTILE - 1) >> BTILE_SHIFT, dx, dy, row, ext[4];
+
+  bgrid_init_sparse (&out);
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      /* Only the tiles its cells reach: `ext` is the least and most column
+       * and row set in the tile.
+       */
+      tile = bg->tiles[t];
+      for (row = 0, ext[0] = ext[2] = BTILE, ext[1] = ext[3] = -1, cols = 0; row < BTILE; row++)
+	if (tile->occ[row])
+	  {
+	    cols |= tile->occ[row];
+	    ext[2] = min (ext[2], row), ext[3] = row;
+	  }
+      ext[0] = cols ? __builtin_ctzll (cols) : BTILE;
+      ext[1] = cols ? 63 - __builtin_clzll (cols) : -1;
+      for (dy = and ? 0 : -k; dy <= (and ? 0 : k); dy++)
+	for (dx = and ? 0 : -k; dx <= (and ? 0 : k); dx++)
+	  if ((dx >= 0 || ext[0] + (-dx - 1) * BTILE < r)
+	      && (dx <= 0 || (BTILE - 1 - ext[1]) + (dx - 1) * BTILE < r)
+	      && (dy >= 0 || ext[2] + (-dy - 1) * BTILE < r)
+	      && (dy <= 0 || (BTILE - 1 - ext[3]) + (dy - 1) * BTILE < r))
+	    bgrid_tile (&out, tile->tx + dx, tile->ty + dy, 1);
+    }
+
+  bmap_init (&bm, (2 * k + 1) * BTILE, (2 * k + 1) * BTILE);
+  for (t = 0; t < out.ntiles; t++)
+    {
+      tile = out.tiles[t];
+      memset (bm.bits, 0, (size_t) bm.w * bm.h * sizeof (uint64_t));
+      for (dy = -k; dy <= k; dy++)
+	for (dx = -k; dx <= k; dx++)
+	  if ((src = bgrid_tile (bg, tile->tx + dx, tile->ty + dy, 0)))
+	    for (row = 0; row < BTILE; row++)
+	      bm.bits[(size_t) ((dy + k) * BTILE + row) * bm.w + dx + k] = src->occ[row];
+      bmap_spread (&bm, r, and);
+      for (row = 0; row < BTILE; row++)
+	tile->occ[row] = bm.bits[(size_t) (k * BTILE + row) * bm.w + k];
+    }
+  bmap_free (&bm);
+
+  /* Drop the tiles left empty */
+  for (t = 0, n = 0; t < out.ntiles; t++)
+    {
+      for (row = 0; row < BTILE && out.tiles[t]->occ[row] == 0; row++);
+      if (row < BTILE) out.tiles[n++] = out.tiles[t];
+      else free (out.tiles[t]);
+    }
+  out.ntiles = n;
+
+  bgrid_free (bg);
+  *bg = out;
+  if (bgrid_seal (bg) != 0)
+    {
+      fprintf (stderr, "bounds: the block morphology spans too many cells\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Clear the cells of a sparse grid outside `nx` by `ny` cells from cell (0, 0)
+ */
+static void
+morph_clip (bgrid_t* bg, int nx, int ny)
+{
+  btile_t* tile;
+  ssize_t t, n;
+  int64_t c0, r0;
+  int row;
+
+  for (t = 0, n = 0; t < bg->ntiles; t++)
+    {
+      tile = bg->tiles[t];
+      c0 = tile->tx << BTILE_SHIFT, r0 = tile->ty << BTILE_SHIFT;
+      if (c0 < 0 || r0 < 0 || c0 >= nx || r0 >= ny)
+	{
+	  free (tile);
+	  continue;
+	}
+      for (row = 0; row < BTILE; row++)
+	if (r0 + row >= ny)
+	  tile->occ[row] = 0;
+	else if (nx - c0 < BTILE)
+	  tile->occ[row] &= ((uint64_t) 1 << (nx - c0)) - 1;
+      bg->tiles[n++] = tile;
+    }
+  bg->ntiles = n;
+  bgrid_seal (bg);
+}
+
+static ssize_t
+gap_find (ssize_t* gp, ssize_t g)
+{
+  while (gp[g] != g)
+    g = gp[g] = gp[gp[g]];
+  return g;
+}
+
+/* Join the groups of gaps `u` and `v`, keeping the lower root (so the
+ * outside stays the root of its group)
+ */
+static void
+gap_union (ssize_t* gp, ssize_t u, ssize_t v)
+{
+  u = gap_find (gp, u), v = gap_find (gp, v);
+  if (u < v) gp[v] = u;
+  else if (v < u) gp[u] = v;
+}
+
+/* Fill the holes of fewer than `n` cells
+ * -- A hole is a 4-connected group of empty cells not reaching the edge of
+ * the grid.  The empty runs of each row, the gaps between the runs of
+ * occupied cells, are joined to the gaps they overlap in the row before in
+ * a union-find, gap 0 standing for the outside.
+ */
+static void
+morph_fill (bgrid_t* bg, ssize_t n)
+{
+  blabel_t lab;
+  int* gy;
+  int* ga;
+  int* gb;
+  ssize_t* gp;
+  int64_t* area;
+  ssize_t ng = 1, gcap, i, j, q, p0 = 0, p1 = 0, g0, a, b;
+  int y, prev = INT_MIN, x;
+
+  blabel_init (&lab);
+  blabel_grid (&lab, bg, 0, bg->ny);
+  /* A row of runs has a gap more than it has runs, at most */
+  gcap = 2 * lab.n + 2;
+  gy = (int*) malloc (gcap * sizeof (int));
+  ga = (int*) malloc (gcap * sizeof (int));
+  gb = (int*) malloc (gcap * sizeof (int));
+  gp = (ssize_t*) malloc (gcap * sizeof (ssize_t));
+  area = (int64_t*) calloc (gcap, sizeof (int64_t));
+  if (!gy || !ga || !gb || !gp || !area)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block morphology\n");
+      exit (EXIT_FAILURE);
+    }
+  gp[0] = 0;
+
+  for (i = 0; i < lab.n; i = j)
+    {
+      y = lab.y[i];
+      for (j = i; j < lab.n && lab.y[j] == y; j++);
+
+      /* The gaps of this row; those at its ends reach the edge */
+      g0 = ng;
+      for (q = i - 1; q < j; q++)
+	{
+	  a = (q < i) ? 0 : lab.x1[q] + 1;
+	  b = (q + 1 < j) ? lab.x0[q + 1] - 1 : bg->nx - 1;
+	  if (a > b) continue;
+	  gy[ng] = y, ga[ng] = (int) a, gb[ng] = (int) b;
+	  gp[ng] = (q < i || q + 1 == j) ? 0 : ng;
+	  ng++;
+	}
+
+      /* An empty row (or the edge) before this one is outside; otherwise
+       * join the gaps overlapping the gaps of the row before.
+       */
+      if (prev != y - 1 || y == 0)
+	{
+	  for (q = p0; q < p1; q++) gap_union (gp, q, 0);
+	  for (q = g0; q < ng; q++) gap_union (gp, q, 0);
+	}
+      else
+	for (q = g0, a = p0; q < ng; q++)
+	  {
+	    while (a < p1 && gb[a] < ga[q]) a++;
+	    for (b = a; b < p1 && ga[b] <= gb[q]; b++)
+	      gap_union (gp, b, q);
+	  }
+      p0 = g0, p1 = ng, prev = y;
+    }
+  for (q = p0; q < p1; q++) gap_union (gp, q, 0);
+
+  for (q = 1; q < ng; q++)
+    area[gap_find (gp, q)] += gb[q] - ga[q] + 1;
+  for (q = 1; q < ng; q++)
+    if (gap_find (gp, q) != 0 && area[gap_find (gp, q)] < n)
+      for (x = ga[q]; x <= gb[q]; x++)
+	{
+	  if (bg->tiles)
+	    bgrid_set (bg, (bg->tx0 << BTILE_SHIFT) + x, (bg->ty0 << BTILE_SHIFT) + gy[q]);
+	  else
+	    bgrid_occ_set (bg, (size_t) gy[q] * bg->nx + x);
+	}
+
+  free (gy);
+  free (ga);
+  free (gb);
+  free (gp);
+  free (area);
+  blabel_free (&lab);
+}
+
+void
+bgrid_morph (bgrid_t* bg, bmorph_t* m, int lattice)
+{
+  bmap_t bm;
+  uint64_t* occ;
+  size_t ncells = (size_t) bg->nx * bg->ny, k;
+  int64_t tx0, ty0;
+  int pad, i, j, n, nx = bg->nx, ny = bg->ny;
+
+  if (bg->tiles || !bg->occ)
+    {
+      /* A sparse grid grows tiles as it needs them; one counted from a
+       * region is clipped back to it.
+       */
+      tx0 = bg->tx0, ty0 = bg->ty0;
+      if (bg->ntiles > 0)
+	{
+	  if (m->dilate > 0) morph_tiles (bg, m->dilate, 0);
+	  if (m->erode > 0) morph_tiles (bg, m->erode, 1);
+	  if (m->close > 0) morph_tiles (bg, m->close, 0), morph_tiles (bg, m->close, 1);
+	  if (!lattice) morph_clip (bg, nx, ny);
+	}
+      if (!lattice)
+	bg->tx0 = tx0, bg->ty0 = ty0, bg->nx = nx, bg->ny = ny;
+      if (m->fill > 0 && bg->ntiles > 0)
+	{
+	  /* The holes are inside the grid, but may want tiles of their own */
+	  morph_fill (bg, m->fill);
+	  tx0 = bg->tx0, ty0 = bg->ty0, nx = bg->nx, ny = bg->ny;
+	  bgrid_seal (bg);
+	  bg->tx0 = tx0, bg->ty0 = ty0, bg->nx = nx, bg->ny = ny;
+	}
+      return;
+    }
+
+  /* A dense grid is copied into a bitmap of whole-word rows, with room
+   * around it to dilate into, and cropped back.
+   */
+  if (m->dilate > 0 || m->erode > 0 || m->close > 0)
+    {
+      pad = max (m->dilate, 0) + max (m->close, 0);
+      bmap_init (&bm, nx + 2 * pad, ny + 2 * pad);
+      for (i = 0; i < ny; i++)
+	for (j = 0, k = (size_t) i * nx; j < nx; j += n, k += n)
+	  {
+	    n = min (64, nx - j);
+	    bits_put (bm.bits + (size_t) (i + pad) * bm.w, (size_t) (j + pad), bits_get (bg->occ, ncells, k, n));
+	  }
+
+      if (m->dilate > 0) bmap_spread (&bm, m->dilate, 0);
+      if (m->erode > 0) bmap_spread (&bm, m->erode, 1);
+      if (m->close > 0) bmap_spread (&bm, m->close, 0), bmap_spread (&bm, m->close, 1);
+
+      if ((occ = (uint64_t*) calloc (ncells / 64 + 1, sizeof (uint64_t))) == NULL)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the block morphology\n");
+	  exit (EXIT_FAILURE);
+	}
+      for (i = 0; i < ny; i++)
+	for (j = 0, k = (size_t) i * nx; j < nx; j += n, k += n)
+	  {
+	    n = min (64, nx - j);
+	    bits_put (occ, k, bits_get (bm.bits + (size_t) (i + pad) * bm.w, (size_t) bm.w * 64, (size_t) (j + pad), n));
+	  }
+      free (bg->occ);
+      bg->occ = occ;
+      bmap_free (&bm);
+    }
+  if (m->fill > 0)
+    morph_fill (bg, m->fill);
+}
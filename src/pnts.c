@@ -12,6 +12,7 @@
  * <http://www.gnu.org/licenses/> 
  *--------------------------------------------------------------*/
 
+#include <pthread.h>
 #include "bounds.h"
 
 /* Line-Count 
@@ -91,8 +92,6 @@ int
 read_point (FILE *infile, point_t *rpnt, char** delimiter, char* pnt_recr, int dflag, int vflag) 
 {
   char tmp[MAX_RECORD_LENGTH] = {0x0};
-  char pntp, *strs;
-  int pf_length, j, status;
 
   /* Read in the file */
   if (infile == NULL) 
@@ -102,41 +101,55 @@ read_point (FILE *infile, point_t *rpnt, char** delimiter, char* pnt_recr, int d
     }
 
   /* read a record */
-  if (fgets (tmp, sizeof (tmp), infile) !=0) 
-    {
-      strs = malloc(strlen (tmp) + 1);
-      strcpy (strs, tmp);
-      status = 0;
-    }
-  else 
-    {
-      status = -1;
-      return status;
-    }
-
-  pf_length = strlen (pnt_recr);
+  if (fgets (tmp, sizeof (tmp), infile) == 0) 
+    return -1;
 
   if (!dflag)
     {
-      dflag = auto_delim_l (strs, delimiter);
+      dflag = auto_delim_l (tmp, delimiter);
       if (vflag > 0) fprintf(stderr,"bounds: delimiter is '%s'\n", *delimiter);
     }
-  
-  char* p = strtok (strs, *delimiter);
+
+  parse_point (tmp, rpnt, *delimiter, pnt_recr);
+  return 0;
+}
+
+/* Parse the x and y of the record `line` into `rpnt`, following `pnt_recr`;
+ * fields missing from the record are left as they were.  Returns 0 if both
+ * x and y were read as numbers (a blank line or a comment has neither),
+ * otherwise -1.
+ */
+int
+parse_point (char* line, point_t* rpnt, char* delimiter, char* pnt_recr)
+{
+  char tmp[MAX_RECORD_LENGTH];
+  char pntp, *p, *save, *end;
+  int pf_length, j, got = 0;
+
+  strncpy (tmp, line, sizeof (tmp) - 1);
+  tmp[sizeof (tmp) - 1] = '\0';
+  pf_length = strlen (pnt_recr);
+
+  p = strtok_r (tmp, delimiter, &save);
   for (j = 0; j < pf_length; j++) 
     {
       pntp = pnt_recr[j];
       if (p != NULL) 
 	{
 	  if (pntp == 'x') 
-	    rpnt->x = atof (p);
+	    {
+	      rpnt->x = strtod (p, &end);
+	      if (end != p) got |= 1;
+	    }
 	  else if (pntp == 'y') 
-	    rpnt->y = atof (p);
+	    {
+	      rpnt->y = strtod (p, &end);
+	      if (end != p) got |= 2;
+	    }
 	}
-      p = strtok (NULL, *delimiter);
+      p = strtok_r (NULL, delimiter, &save);
     }
-  free (strs);  
-  return status;
+  return (got == 3) ? 0 : -1;
 }
 
 /* Load points
@@ -168,3 +181,347 @@ load_pnts(FILE *infile, point_t **pnts, ssize_t *npr, char* pnt_recr, int vflag)
   if (vflag > 0)
     fprintf (stderr,"bounds: processing %d points\n", *npr);
 }
+
+/* Compare points by x, then y, for use in qsort
+ */
+int
+compare_xy (const void* a, const void* b)
+{
+  const point_t *elem1 = a;
+  const point_t *elem2 = b;
+
+  if (elem1->x < elem2->x) return -1;
+  if (elem1->x > elem2->x) return 1;
+  if (elem1->y < elem2->y) return -1;
+  if (elem1->y > elem2->y) return 1;
+  return 0;
+}
+
+/* Threaded Jobs
+ * -- Job `t` is the `size` bytes at `jobs` + `t` * `size`.  The first job
+ * runs on this thread, the rest each on one of their own; a job whose
+ * thread can't be started runs here instead, once the first is done.
+ */
+void
+run_jobs (void* jobs, size_t size, int n, void* (*fn) (void*))
+{
+  pthread_t tid[max (n, 1)];
+  int started[max (n, 1)];
+  int t;
+
+  for (t = 1; t < n; t++)
+    started[t] = pthread_create (&tid[t], NULL, fn, (char*) jobs + t * size) == 0;
+  if (n > 0) fn (jobs);
+
+  for (t = 1; t < n; t++)
+    if (started[t])
+      pthread_join (tid[t], NULL);
+    else
+      fn ((char*) jobs + t * size);
+}
+
+/* Index Rings
+ * -- A growable list of point indices.
+ */
+void
+ring_init (ring_t* ring)
+{
+  ring->idx = NULL, ring->n = 0, ring->cap = 0;
+}
+
+void
+ring_free (ring_t* ring)
+{
+  free (ring->idx);
+  ring->idx = NULL, ring->n = 0, ring->cap = 0;
+}
+
+void
+ring_push (ring_t* ring, pidx_t i)
+{
+  if (ring->n == ring->cap)
+    {
+      ring->cap = ring->cap ? ring->cap * 2 : 256;
+      ring->idx = (pidx_t*) realloc (ring->idx, ring->cap * sizeof (pidx_t));
+      if (!ring->idx)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  ring->idx[ring->n++] = i;
+}
+
+/* Rings
+ */
+void
+rings_init (rings_t* rings)
+{
+  rings->pnts = NULL, rings->npnts = 0, rings->pcap = 0;
+  rings->hole = NULL, rings->owner = NULL, rings->nrings = 0, rings->rcap = 0;
+  rings->start = (ssize_t*) malloc (sizeof (ssize_t));
+  rings->start[0] = 0;
+}
+
+void
+rings_free (rings_t* rings)
+{
+  free (rings->pnts);
+  free (rings->start);
+  free (rings->hole);
+  free (rings->owner);
+  rings->pnts = NULL, rings->start = NULL, rings->hole = NULL, rings->owner = NULL;
+  rings->npnts = 0, rings->nrings = 0;
+}
+
+/* Add a point to the ring currently being built
+ */
+void
+rings_add (rings_t* rings, point_t pnt)
+{
+  if (rings->npnts == rings->pcap)
+    {
+      rings->pcap = rings->pcap ? rings->pcap * 2 : 1024;
+      rings->pnts = (point_t*) realloc (rings->pnts, rings->pcap * sizeof (point_t));
+      if (!rings->pnts)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  rings->pnts[rings->npnts++] = pnt;
+}
+
+/* Finish the ring currently being built; `hole` is 1 if it is a hole.
+ * Holes belong to the outer ring recorded in `owner`, which defaults to
+ * the last outer ring.
+ * Returns the index of the ring.
+ */
+int
+rings_close (rings_t* rings, int hole)
+{
+  int r = rings->nrings;
+
+  if (r == rings->rcap)
+    {
+      rings->rcap = rings->rcap ? rings->rcap * 2 : 64;
+      rings->start = (ssize_t*) realloc (rings->start, (rings->rcap + 1) * sizeof (ssize_t));
+      rings->hole = (int*) realloc (rings->hole, rings->rcap * sizeof (int));
+      rings->owner = (int*) realloc (rings->owner, rings->rcap * sizeof (int));
+      if (!rings->start || !rings->hole || !rings->owner)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+
+  rings->hole[r] = hole;
+  rings->owner[r] = r;
+  if (hole)
+    while (rings->owner[r] > 0 && rings->hole[rings->owner[r]])
+      rings->owner[r]--;
+  rings->start[r + 1] = rings->npnts;
+  rings->nrings++;
+  return r;
+}
+
+/* Return the signed area of the points from `r0` to the end of `rings`;
+ * positive when they wind counter-clockwise.  The points are taken from
+ * the first, so large coordinates don't swamp the sum.
+ */
+double
+rings_area (rings_t* rings, ssize_t r0)
+{
+  ssize_t i;
+  double a = 0, ox, oy;
+
+  if (r0 >= rings->npnts) return 0;
+  ox = rings->pnts[r0].x, oy = rings->pnts[r0].y;
+  for (i = r0; i < rings->npnts - 1; i++)
+    a += ((rings->pnts[i].x - ox) * (rings->pnts[i + 1].y - oy))
+      - ((rings->pnts[i + 1].x - ox) * (rings->pnts[i].y - oy));
+  return a / 2;
+}
+
+/* Print the rings as a multipolygon, each outer ring followed by its holes.
+ * Polygons are separated by `>`, or `]],[[` with `jflag`;
+ * holes by `>` and a `# @H` line, or `],[` with `jflag`.
+ */
+void
+rings_print (rings_t* rings, int jflag)
+{
+  int r, h, p = 0;
+  int* holes;
+  int* next;
+  ssize_t i;
+
+  /* Chain the holes of each outer ring together */
+  holes = (int*) malloc ((rings->nrings + 1) * sizeof (int));
+  next = (int*) malloc ((rings->nrings + 1) * sizeof (int));
+  for (r = 0; r < rings->nrings; r++) holes[r] = -1;
+  for (r = rings->nrings - 1; r >= 0; r--)
+    if (rings->hole[r])
+      next[r] = holes[rings->owner[r]], holes[rings->owner[r]] = r;
+
+  for (r = 0; r < rings->nrings; r++)
+    if (!rings->hole[r])
+      for (h = r; h != -1; h = (h == r) ? holes[r] : next[h], p++)
+	{
+	  if (p > 0)
+	    {
+	      if (jflag > 0)
+		printf (h == r ? "]],[[" : "],[");
+	      else
+		printf (h == r ? ">\n" : ">\n# @H\n");
+	    }
+
+	  if (jflag > 0)
+	    {
+	      for (i = rings->start[h]; i < rings->start[h + 1] - 1; i++)
+		printf ("[%f, %f], ", rings->pnts[i].x, rings->pnts[i].y);
+	      printf ("[%f, %f]", rings->pnts[i].x, rings->pnts[i].y);
+	    }
+	  else
+	    for (i = rings->start[h]; i < rings->start[h + 1]; i++)
+	      printf ("%f %f\n", rings->pnts[i].x, rings->pnts[i].y);
+	}
+
+  free (holes);
+  free (next);
+}
+
+/* Finish the ring being loaded, closing it if its last point isn't its first
+ */
+static void
+rings_load_close (rings_t* rings, int hole)
+{
+  ssize_t r0 = rings->start[rings->nrings];
+
+  if (rings->npnts == r0) return;
+  if (!pnts_equal_p (rings->pnts[rings->npnts - 1], rings->pnts[r0]))
+    rings_add (rings, rings->pnts[r0]);
+  rings_close (rings, hole);
+}
+
+/* Return 1 if `c` can start a number
+ */
+static int
+number_p (char c)
+{
+  return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+}
+
+/* Load the rings of a GeoJSON boundary from `buf`
+ * -- Every array under a "coordinates" key whose first member is a number
+ * is a point; the array holding such points is a ring, and rings after
+ * the first in their polygon are holes.
+ */
+static void
+rings_load_json (char* buf, rings_t* rings)
+{
+  char *q = buf, *r;
+  int depth, rdepth, nring;
+  point_t pnt;
+
+  while ((q = strstr (q, "\"coordinates\"")) != NULL)
+    {
+      if ((q = strchr (q, '[')) == NULL) break;
+      depth = 0, rdepth = -1, nring = 0;
+      do
+	{
+	  if (*q == '[')
+	    {
+	      depth++;
+	      for (r = q + 1; *r == ' ' || *r == '\t' || *r == '\n' || *r == '\r'; r++);
+	      if (number_p (*r))
+		{
+		  pnt.x = strtod (r, &r);
+		  while (*r == ' ' || *r == '\t' || *r == '\n' || *r == '\r' || *r == ',') r++;
+		  pnt.y = strtod (r, &r);
+		  rings_add (rings, pnt);
+		  rdepth = depth - 1;
+		  if ((q = strchr (r, ']')) == NULL) return;
+		  depth--;
+		}
+	    }
+	  else if (*q == ']')
+	    {
+	      if (depth == rdepth)
+		rings_load_close (rings, nring++ > 0);
+	      else if (depth == rdepth - 1)
+		nring = 0;
+	      depth--;
+	    }
+	  q++;
+	}
+      while (depth > 0 && *q);
+    }
+}
+
+/* Load the rings of a GMT (or plain `>` separated xy) boundary from `buf`
+ */
+static void
+rings_load_gmt (char* buf, rings_t* rings)
+{
+  char *line, *r, *save;
+  int hole = 0;
+  point_t pnt;
+
+  for (line = strtok_r (buf, "\n", &save); line; line = strtok_r (NULL, "\n", &save))
+    {
+      while (*line == ' ' || *line == '\t') line++;
+      if (*line == '>')
+	rings_load_close (rings, hole), hole = 0;
+      else if (*line == '#')
+	{
+	  if (strncmp (line, "# @H", 4) == 0) hole = 1;
+	}
+      else if (number_p (*line))
+	{
+	  pnt.x = strtod (line, &r);
+	  while (*r == ' ' || *r == '\t' || *r == ',' || *r == '|') r++;
+	  if (!number_p (*r)) continue;
+	  pnt.y = strtod (r, &r);
+	  rings_add (rings, pnt);
+	}
+    }
+  rings_load_close (rings, hole);
+}
+
+/* Load the rings of a boundary, as `bounds` writes it in GMT or GeoJSON,
+ * from `infile` into `rings`.
+ * Returns the number of rings loaded.
+ */
+int
+rings_load (FILE* infile, rings_t* rings)
+{
+  char* buf = NULL;
+  char* q;
+  size_t n = 0, cap = 0, got;
+
+  do
+    {
+      if (cap - n < 65536)
+	{
+	  cap = cap ? cap * 2 : 65536 * 2;
+	  if ((buf = (char*) realloc (buf, cap)) == NULL)
+	    {
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	      exit (EXIT_FAILURE);
+	    }
+	}
+      got = fread (buf + n, 1, cap - n - 1, infile);
+      n += got;
+    }
+  while (got > 0);
+  buf[n] = '\0';
+
+  for (q = buf; *q == ' ' || *q == '\t' || *q == '\n' || *q == '\r'; q++);
+  if (*q == '{' || *q == '[')
+    rings_load_json (buf, rings);
+  else
+    rings_load_gmt (buf, rings);
+
+  free (buf);
+  return rings->nrings;
+}
@@ -0,0 +1,120 @@
+/*------------------------------------------------------------
+ * quant.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+/* Quantized points
+ * -- A point is held as the whole number of `scale` steps it is from the
+ * origin, the first point read, rounded to the nearest; 32 bits each way
+ * rather than a double.  The steps are kept under QUANT_MAX, so the
+ * differences of any two points and the products of those differences
+ * fit in 64 bits, and the orientation tests on them are exact.
+ */
+void
+quant_init (quant_t* q, double scale)
+{
+  q->ox = NAN, q->oy = NAN, q->scale = scale;
+}
+
+/* Snap `p` to the steps of `q` in `qp`; the first point sets the origin.
+ */
+static void
+quant_point (quant_t* q, point_t* p, qpoint_t* qp, ssize_t n)
+{
+  double sx, sy;
+
+  if (isnan (q->ox))
+    q->ox = p->x, q->oy = p->y;
+  sx = round ((p->x - q->ox) / q->scale), sy = round ((p->y - q->oy) / q->scale);
+  if (!(fabs (sx) < QUANT_MAX && fabs (sy) < QUANT_MAX))
+    {
+      fprintf (stderr, "bounds: point %zd is more than %d steps of %g from the first, try a coarser --quantize\n",
+	       n + 1, QUANT_MAX, q->scale);
+      exit (EXIT_FAILURE);
+    }
+  qp->x = (int32_t) sx, qp->y = (int32_t) sy;
+}
+
+point_t
+quant_unpoint (quant_t* q, double x, double y)
+{
+  point_t p;
+
+  p.x = q->ox + x * q->scale, p.y = q->oy + y * q->scale;
+  return p;
+}
+
+void
+load_qpnts (FILE *infile, qpoint_t **pnts, ssize_t *npr, char* pnt_recr, quant_t* q, int vflag)
+{
+  point_t rpnt;
+  ssize_t cap = 0;
+  int dflag = 0;
+  char* delim;
+
+  *npr = 0;
+  while (read_point (infile, &rpnt, &delim, pnt_recr, dflag, vflag) == 0)
+    {
+      if (*npr == cap)
+	{
+	  cap = cap ? cap * 2 : 4096;
+	  *pnts = (qpoint_t*) realloc (*pnts, cap * sizeof (qpoint_t));
+	  if (!*pnts)
+	    {
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the points\n");
+	      exit (EXIT_FAILURE);
+	    }
+	}
+      quant_point (q, &rpnt, &(*pnts)[*npr], *npr);
+      *npr = *npr + 1;
+      dflag++;
+    }
+  if (vflag > 0)
+    fprintf (stderr,"bounds: processing %zd points, quantized to %g\n", *npr, q->scale);
+}
+
+void
+quant_pnts (point_t* pnts, ssize_t npr, quant_t* q)
+{
+  qpoint_t qp;
+  ssize_t i;
+
+  for (i = 0; i < npr; i++)
+    {
+      quant_point (q, &pnts[i], &qp, i);
+      pnts[i].x = qp.x, pnts[i].y = qp.y;
+    }
+}
+
+void
+quant_rings (rings_t* rings, quant_t* q)
+{
+  ssize_t i;
+
+  for (i = 0; i < rings->npnts; i++)
+    rings->pnts[i] = quant_unpoint (q, rings->pnts[i].x, rings->pnts[i].y);
+}
+
+/* Compare quantized points by x, then y, for use in qsort
+ */
+int
+compare_qxy (const void* a, const void* b)
+{
+  const qpoint_t *elem1 = a;
+  const qpoint_t *elem2 = b;
+
+  if (elem1->x != elem2->x) return (elem1->x < elem2->x) ? -1 : 1;
+  if (elem1->y != elem2->y) return (elem1->y < elem2->y) ? -1 : 1;
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*------------------------------------------------------------
+ * query.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2011, 2012, 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+/* The number of records read and classified together */
+#define QUERY_BATCH 65536
+
+/* The fewest points worth a classification thread of their own */
+#define QUERY_CHUNK 4096
+
+typedef struct
+{
+  polyidx_t* pi;
+  point_t* pnts;
+  char* flag;
+  int n;
+} classify_t;
+
+static void*
+classify_run (void* arg)
+{
+  classify_t* c = (classify_t*) arg;
+  int i;
+
+  for (i = 0; i < c->n; i++)
+    c->flag[i] = polyidx_contains (c->pi, &c->pnts[i]);
+  return NULL;
+}
+
+/* Classify the `n` points in `pnts` into `flag`, split over the threads
+ */
+static void
+classify_all (polyidx_t* pi, point_t* pnts, char* flag, int n, int nthreads)
+{
+  classify_t c[64];
+  int t, threads, lo;
+
+  threads = max (1, min (min (nthreads, 64), n / QUERY_CHUNK));
+  for (t = 0; t < threads; t++)
+    {
+      lo = (int) ((long long) n * t / threads);
+      c[t].pi = pi, c[t].pnts = pnts + lo, c[t].flag = flag + lo;
+      c[t].n = (int) ((long long) n * (t + 1) / threads) - lo;
+    }
+  run_jobs (c, sizeof (classify_t), threads, classify_run);
+}
+
+/* Classify the xy records of `infile` against the rings of `boundary`
+ * -- The records are read in batches, parsed, then classified over
+ * `nthreads` threads against an edge index built once.
+ * With `select` 0 every record is written out with 1 (inside or on the
+ * boundary) or 0 appended; with 1 only the inside records are written,
+ * with -1 only the outside ones.  Records are written as they were read.
+ * Records without an x and y (blank lines, comments) aren't points: they
+ * are passed through as they are with `select` 0, and left out otherwise.
+ * If `delimiter` is NULL it is guessed from the first record.
+ * Returns the number of records inside.
+ */
+ssize_t
+query_points (FILE* infile, rings_t* boundary, char* pnt_recr, char* delimiter, int select, int nthreads, int vflag)
+{
+  polyidx_t pi;
+  point_t* pnts;
+  char* text;
+  char* flag;
+  char* ok;
+  ssize_t* line;
+  ssize_t tcap = (ssize_t) QUERY_BATCH * 64, tn, total = 0, ninside = 0, len;
+  int i, n, done = 0;
+  char sep;
+
+  polyidx_init_rings (&pi, boundary);
+
+  pnts = (point_t*) malloc (QUERY_BATCH * sizeof (point_t));
+  flag = (char*) malloc (QUERY_BATCH);
+  ok = (char*) malloc (QUERY_BATCH);
+  line = (ssize_t*) malloc ((QUERY_BATCH + 1) * sizeof (ssize_t));
+  text = (char*) malloc (tcap);
+  if (!pnts || !flag || !ok || !line || !text)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the query\n");
+      exit (EXIT_FAILURE);
+    }
+
+  while (!done)
+    {
+      /* Read a batch of records, one after the other in `text` */
+      for (n = 0, tn = 0; n < QUERY_BATCH; n++)
+	{
+	  if (tcap - tn < MAX_RECORD_LENGTH)
+	    {
+	      tcap *= 2;
+	      if ((text = (char*) realloc (text, tcap)) == NULL)
+		{
+		  fprintf (stderr, "bounds: failed to allocate needed memory for the query\n");
+		  exit (EXIT_FAILURE);
+		}
+	    }
+	  if (fgets (text + tn, MAX_RECORD_LENGTH, infile) == NULL)
+	    {
+	      done = 1;
+	      break;
+	    }
+	  line[n] = tn;
+	  tn += strlen (text + tn) + 1;
+	}
+      line[n] = tn;
+      if (n == 0) break;
+
+      if (!delimiter)
+	{
+	  delimiter = " \t";
+	  auto_delim_l (text, &delimiter);
+	  if (vflag > 0) fprintf (stderr, "bounds: delimiter is '%s'\n", delimiter);
+	}
+      sep = delimiter[0];
+
+      for (i = 0; i < n; i++)
+	{
+	  pnts[i].x = pnts[i].y = NAN;
+	  ok[i] = parse_point (text + line[i], &pnts[i], delimiter, pnt_recr) == 0;
+	}
+
+      classify_all (&pi, pnts, flag, n, nthreads);
+
+      for (i = 0; i < n; i++)
+	{
+	  if (!ok[i])
+	    {
+	      if (select == 0)
+		fputs (text + line[i], stdout);
+	      continue;
+	    }
+	  ninside += flag[i], total++;
+	  if (select == 0)
+	    {
+	      len = line[i + 1] - line[i] - 1;
+	      while (len > 0 && (text[line[i] + len - 1] == '\n' || text[line[i] + len - 1] == '\r'))
+		len--;
+	      fwrite (text + line[i], 1, len, stdout);
+	      putchar (sep);
+	      putchar (flag[i] ? '1' : '0');
+	      putchar ('\n');
+	    }
+	  else if ((select > 0) == (flag[i] != 0))
+	    fputs (text + line[i], stdout);
+	}
+    }
+
+  if (vflag > 0)
+    fprintf (stderr, "bounds: %zd of %zd points are inside the boundary\n", ninside, total);
+
+  free (pnts);
+  free (flag);
+  free (ok);
+  free (line);
+  free (text);
+  polyidx_free (&pi);
+  return ninside;
+}
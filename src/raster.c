@@ -0,0 +1,290 @@
+/*------------------------------------------------------------
+ * raster.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include "bounds.h"
+
+/* The size of a GMT native binary grid header */
+#define GMT_HEADER 892
+
+/* Raster masks of a block grid
+ * -- The occupied cells are written out a row at a time, from the top row
+ * down, as the rasters want them; nothing is traced.  A row is gathered
+ * into a bit row of its own, one word to every 64 columns, from the dense
+ * bits or from the tiles of its row of tiles.  On the lattice the tiles only
+ * bound the points to whole tiles, so the raster is cropped to the cells
+ * occupied: their extent is read off the tiles' rows first.
+ */
+int
+block_raster_format (const char* name)
+{
+  if (strcmp (name, "asc") == 0) return BRASTER_ASC;
+  if (strcmp (name, "gmt") == 0) return BRASTER_GMT;
+  if (strcmp (name, "rle") == 0) return BRASTER_RLE;
+  return 0;
+}
+
+/* The first of the (sealed) tiles of `bg` in row of tiles `ty` or above */
+static ssize_t
+raster_tile_row (bgrid_t* bg, int64_t ty)
+{
+  ssize_t lo = 0, hi = bg->ntiles, mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (bg->tiles[mid]->ty < ty) lo = mid + 1;
+      else hi = mid;
+    }
+  return lo;
+}
+
+/* Gather row `y` of `bg` into the `nw` words of `row` */
+static void
+raster_row (bgrid_t* bg, int y, uint64_t* row, size_t nw)
+{
+  size_t k, w, last = ((size_t) bg->nx * bg->ny + 63) >> 6;
+  ssize_t t;
+  int64_t ty;
+  int s;
+
+  memset (row, 0, nw * sizeof (uint64_t));
+  if (!bg->tiles)
+    {
+      if (!bg->occ) return;
+      k = (size_t) y * bg->nx, s = (int) (k & 63);
+      for (w = 0, k >>= 6; w < nw; w++, k++)
+	{
+	  row[w] = bg->occ[k] >> s;
+	  if (s > 0 && k + 1 < last)
+	    row[w] |= bg->occ[k + 1] << (64 - s);
+	}
+    }
+  else
+    {
+      /* A tile is a word wide, so its column of tiles is its word */
+      ty = bg->ty0 + (y >> BTILE_SHIFT);
+      for (t = raster_tile_row (bg, ty); t < bg->ntiles && bg->tiles[t]->ty == ty; t++)
+	if (bg->tiles[t]->tx >= bg->tx0 && (size_t) (bg->tiles[t]->tx - bg->tx0) < nw)
+	  row[bg->tiles[t]->tx - bg->tx0] = bg->tiles[t]->occ[y & (BTILE - 1)];
+    }
+  if (bg->nx & 63)
+    row[nw - 1] &= ((uint64_t) 1 << (bg->nx & 63)) - 1;
+}
+
+/* The columns `ext[0]` to `ext[2]` and rows `ext[1]` to `ext[3]` of the
+ * occupied cells of the (sealed) sparse grid `bg`; returns 0 if there are none.
+ */
+static int
+raster_extent (bgrid_t* bg, int* ext)
+{
+  uint64_t any;
+  ssize_t t;
+  int r, x, y;
+
+  ext[0] = ext[1] = INT_MAX, ext[2] = ext[3] = -1;
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      x = (int) ((bg->tiles[t]->tx - bg->tx0) << BTILE_SHIFT);
+      y = (int) ((bg->tiles[t]->ty - bg->ty0) << BTILE_SHIFT);
+      for (any = 0, r = 0; r < BTILE; r++)
+	if (bg->tiles[t]->occ[r])
+	  {
+	    any |= bg->tiles[t]->occ[r];
+	    ext[1] = min (ext[1], y + r), ext[3] = max (ext[3], y + r);
+	  }
+      if (any)
+	{
+	  ext[0] = min (ext[0], x + __builtin_ctzll (any));
+	  ext[2] = max (ext[2], x + 63 - __builtin_clzll (any));
+	}
+    }
+  return ext[2] >= 0;
+}
+
+/* Columns `x0` on of the bit row `row` of `nw` words, into the `cw` words of `out` */
+static void
+raster_crop (uint64_t* row, size_t nw, int x0, uint64_t* out, size_t cw)
+{
+  size_t w, k;
+  int s = x0 & 63;
+
+  for (w = 0, k = (size_t) x0 >> 6; w < cw; w++, k++)
+    {
+      out[w] = (k < nw) ? row[k] >> s : 0;
+      if (s > 0 && k + 1 < nw)
+	out[w] |= row[k + 1] << (64 - s);
+    }
+}
+
+static void
+raster_write (const void* p, size_t n)
+{
+  if (n > 0 && fwrite (p, 1, n, stdout) != n)
+    {
+      fprintf (stderr, "bounds: failed to write the raster\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* The GMT native binary grid header: the sizes and registration as 32 bit
+ * integers, then the extent, value range, increments, scale and offset as
+ * doubles, then the unit, title, command and remark strings, unpadded.
+ */
+static void
+raster_gmt_header (int nx, int ny, double inc, region_t xyi, double zmin, double zmax)
+{
+  unsigned char h[GMT_HEADER];
+  int32_t n[3] = {nx, ny, 1};
+  double d[10];
+  char* title = "bounds block mask";
+
+  d[0] = xyi.xmin, d[1] = xyi.xmin + nx * inc;
+  d[2] = xyi.ymin, d[3] = xyi.ymin + ny * inc;
+  d[4] = zmin, d[5] = zmax;
+  d[6] = inc, d[7] = inc;
+  d[8] = 1.0, d[9] = 0.0;
+
+  memset (h, 0, sizeof (h));
+  memcpy (h, n, sizeof (n));
+  memcpy (h + sizeof (n), d, sizeof (d));
+  memcpy (h + sizeof (n) + sizeof (d) + 3 * 80, title, strlen (title));
+  raster_write (h, sizeof (h));
+}
+
+ssize_t
+block_raster (bgrid_t* bg, double inc, region_t xyi, int lattice, int format, int vflag)
+{
+  uint64_t* full;
+  uint64_t* row;
+  char* out;
+  char zeros[128];
+  size_t nw = ((size_t) max (bg->nx, 0) + 63) >> 6, cw, ncells = 0, w, n;
+  ssize_t t;
+  int x, y, bit, c, nx = max (bg->nx, 0), ny = max (bg->ny, 0), x0 = 0, y0 = 0;
+  int ext[4];
+
+  if (lattice && bg->tiles)
+    {
+      if (raster_extent (bg, ext))
+	x0 = ext[0], y0 = ext[1], nx = ext[2] - ext[0] + 1, ny = ext[3] - ext[1] + 1;
+      else
+	nx = ny = 0;
+      xyi.xmin += x0 * inc, xyi.ymin += y0 * inc;
+      xyi.xmax = xyi.xmin + nx * inc, xyi.ymax = xyi.ymin + ny * inc;
+    }
+  cw = ((size_t) nx + 63) >> 6;
+
+  full = (uint64_t*) malloc ((nw + 1) * sizeof (uint64_t));
+  row = (uint64_t*) malloc ((cw + 1) * sizeof (uint64_t));
+  /* A run takes no more characters than twice its length (the first may be
+   * empty), so a row of any of the formats fits in two per cell.
+   */
+  out = (char*) malloc (2 * (size_t) nx + 16);
+  if (!full || !row || !out)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the raster\n");
+      exit (EXIT_FAILURE);
+    }
+
+  for (x = 0; x < 128; x++)
+    zeros[x] = (x & 1) ? ' ' : '0';
+
+  if (vflag > 0) fprintf (stderr, "bounds: writing a %d/%d cell raster\n", ny, nx);
+
+  if (format == BRASTER_GMT)
+    {
+      /* The value range wants the count of occupied cells first */
+      if (!bg->tiles)
+	for (w = 0; bg->occ && w < (((size_t) bg->nx * bg->ny + 63) >> 6); w++)
+	  ncells += __builtin_popcountll (bg->occ[w]);
+      else
+	for (t = 0; t < bg->ntiles; t++)
+	  for (y = 0; y < BTILE; y++)
+	    ncells += __builtin_popcountll (bg->tiles[t]->occ[y]);
+      raster_gmt_header (nx, ny, inc, xyi, ncells == (size_t) nx * ny ? 1.0 : 0.0, ncells > 0 ? 1.0 : 0.0);
+    }
+  else
+    {
+      printf ("ncols %d\nnrows %d\nxllcorner %.10f\nyllcorner %.10f\ncellsize %.10f\n",
+	      nx, ny, xyi.xmin, xyi.ymin, inc);
+      if (format == BRASTER_ASC)
+	printf ("NODATA_value -9999\n");
+    }
+
+  for (y = ny - 1; y >= 0; y--)
+    {
+      raster_row (bg, y0 + y, full, nw);
+      raster_crop (full, nw, x0, row, cw);
+      if (nx & 63)
+	row[cw - 1] &= ((uint64_t) 1 << (nx & 63)) - 1;
+      n = 0;
+      if (format == BRASTER_ASC)
+	{
+	  for (x = 0; x < nx; x += 64)
+	    {
+	      /* The empty words, mostly, are copied whole */
+	      c = min (64, nx - x);
+	      if (row[x >> 6] == 0)
+		memcpy (out + n, zeros, 2 * c), n += 2 * c;
+	      else
+		for (bit = 0; bit < c; bit++)
+		  {
+		    out[n++] = ((row[x >> 6] >> bit) & 1) ? '1' : '0';
+		    out[n++] = ' ';
+		  }
+	    }
+	  if (n > 0) out[n - 1] = '\n';
+	  else out[n++] = '\n';
+	}
+      else if (format == BRASTER_GMT)
+	{
+	  for (x = 0; x < nx; x += 64)
+	    {
+	      c = min (64, nx - x);
+	      if (row[x >> 6] == 0)
+		memset (out + n, 0, c), n += c;
+	      else
+		for (bit = 0; bit < c; bit++)
+		  out[n++] = (char) ((row[x >> 6] >> bit) & 1);
+	    }
+	}
+      else
+	{
+	  /* The lengths of the runs across the row, alternately empty and
+	   * occupied, starting with an empty run (which may be 0 long).
+	   */
+	  for (x = 0, bit = 0; x < nx || bit == 0; bit ^= 1)
+	    {
+	      for (c = x; c < nx && (int) ((row[c >> 6] >> (c & 63)) & 1) == bit; )
+		{
+		  /* Whole words of the same bit at a time */
+		  if ((c & 63) == 0 && c + 64 <= nx && row[c >> 6] == (bit ? ~(uint64_t) 0 : 0))
+		    c += 64;
+		  else
+		    c++;
+		}
+	      n += sprintf (out + n, n > 0 ? " %d" : "%d", c - x);
+	      x = c;
+	      if (x >= nx) break;
+	    }
+	  out[n++] = '\n';
+	}
+      raster_write (out, n);
+    }
+
+  free (full);
+  free (row);
+  free (out);
+  return (ssize_t) nx * ny;
+}
@@ -0,0 +1,975 @@
+/*------------------------------------------------------------
+ * tile.c
+ *
+ * This file is part of BOUNDS
+ *
+ * Copyright (c) 2016 - 2023 Matthew Love <matthew.love@colorado.edu>
+ * BOUNDS is liscensed under the GPL v.2 or later and
+ * is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * <http://www.gnu.org/licenses/>
+ *--------------------------------------------------------------*/
+
+#include <unistd.h>
+#include "bounds.h"
+
+/* The most spilled tiles read back from a run at a time */
+#define RUN_BUF 64
+
+/* The fewest tiles gridded before they are spilled */
+#define TILE_MIN 64
+
+/* A tile's occupancy, as it is spilled */
+typedef struct
+{
+  int64_t tx;
+  int64_t ty;
+  uint64_t occ[BTILE];
+} spill_t;
+
+/* A run of spilled tiles in row order; `n` more of them from `off`
+ * in the spill file, and `len` read into `buf`, of which `pos` are used.
+ */
+typedef struct
+{
+  off_t off;
+  ssize_t n;
+  spill_t* buf;
+  int pos;
+  int len;
+} run_t;
+
+/* The runs being merged, as a heap of the `nheap` runs with tiles left,
+ * ordered by their next tile.
+ */
+typedef struct
+{
+  FILE* spill;
+  run_t* runs;
+  int* heap;
+  int nheap;
+  int nbuf;
+} merge_t;
+
+/* The tiles of tile row `ty`, by column */
+typedef struct
+{
+  btile_t** tiles;
+  ssize_t n;
+  ssize_t cap;
+  int64_t ty;
+} trow_t;
+
+/* A chain of edges traced within a stripe of rows: `n` edge ids from `off`
+ * in the edges of chain set `set`, the least of them, `min`, at `minpos`.
+ * `next` is the edge following the last, the first of the chain it carries
+ * on into.  `area` is the chain's share of its ring's area in cells: the
+ * rows up to its top edges less the rows up to its bottom ones.
+ */
+typedef struct
+{
+  bedge_t first;
+  bedge_t next;
+  bedge_t min;
+  ssize_t minpos;
+  ssize_t n;
+  off_t off;
+  ssize_t ring;
+  int64_t area;
+  int set;
+} frag_t;
+
+/* The chains traced from a stripe of rows; their edges are written to `fp`
+ * if it is set, or else kept in `edges`.
+ */
+typedef struct
+{
+  frag_t* frags;
+  ssize_t nfrags;
+  ssize_t fcap;
+  bedge_t* edges;
+  ssize_t nedges;
+  ssize_t ecap;
+  FILE* fp;
+} chains_t;
+
+/* A stripe of rows `r0` to `r1-1` of a grid, and the chains traced from it */
+typedef struct
+{
+  bgrid_t* bg;
+  int r0;
+  int r1;
+  chains_t* ch;
+} stripe_t;
+
+/* The stripes a tracing thread takes: every `step`th from `first` */
+typedef struct
+{
+  stripe_t* stripes;
+  int nstripes;
+  int first;
+  int step;
+} stripe_job_t;
+
+/* A ring stitched from `nfrags` chains, from `fr` in the chain order;
+ * the first of them holds its least edge, `min`.  `poly` is the least edge
+ * of the outer ring of its polygon, and `hole` is set if it is a hole.
+ * `area` is the cells it encloses, less than 0 for a hole.
+ */
+typedef struct
+{
+  bedge_t min;
+  bedge_t poly;
+  int64_t area;
+  int hole;
+  ssize_t fr;
+  ssize_t nfrags;
+} tring_t;
+
+/* Open an anonymous temporary file under $TMPDIR (or /tmp)
+ */
+static FILE*
+tile_tmpfile (void)
+{
+  char path[4096];
+  char* dir = getenv ("TMPDIR");
+  FILE* fp = NULL;
+  int fd;
+
+  snprintf (path, sizeof (path), "%s/bounds-XXXXXX", (dir && *dir) ? dir : "/tmp");
+  if ((fd = mkstemp (path)) >= 0)
+    {
+      unlink (path);
+      fp = fdopen (fd, "w+b");
+    }
+  if (!fp)
+    {
+      fprintf (stderr, "bounds: failed to create a temporary file in %s\n", (dir && *dir) ? dir : "/tmp");
+      exit (EXIT_FAILURE);
+    }
+  return fp;
+}
+
+/* Read `len` bytes at `off` of `fp` into `buf`
+ */
+static void
+tile_pread (FILE* fp, void* buf, size_t len, off_t off)
+{
+  if (pread (fileno (fp), buf, len, off) != (ssize_t) len)
+    {
+      fprintf (stderr, "bounds: failed to read back a temporary file\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Widen the tile extent `ext` (west, south, east, north) to the tiles of `bg`
+ */
+static void
+tile_extent (bgrid_t* bg, int64_t* ext)
+{
+  ssize_t t;
+
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      ext[0] = min (ext[0], bg->tiles[t]->tx), ext[1] = min (ext[1], bg->tiles[t]->ty);
+      ext[2] = max (ext[2], bg->tiles[t]->tx), ext[3] = max (ext[3], bg->tiles[t]->ty);
+    }
+}
+
+/* Write the tiles of `bg` to the spill file as a run in row order,
+ * then empty it.
+ */
+static void
+tile_spill (bgrid_t* bg, FILE** spill, run_t** runs, int* nruns)
+{
+  spill_t s;
+  ssize_t t;
+
+  if (bg->ntiles == 0) return;
+  if (!*spill) *spill = tile_tmpfile ();
+
+  /* Sealing puts the tiles in row order */
+  bgrid_seal (bg);
+  if ((*runs = (run_t*) realloc (*runs, (*nruns + 1) * sizeof (run_t))) == NULL)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+      exit (EXIT_FAILURE);
+    }
+  (*runs)[*nruns].off = ftello (*spill);
+  (*runs)[*nruns].n = bg->ntiles;
+  (*runs)[*nruns].pos = (*runs)[*nruns].len = 0;
+  (*nruns)++;
+
+  for (t = 0; t < bg->ntiles; t++)
+    {
+      s.tx = bg->tiles[t]->tx, s.ty = bg->tiles[t]->ty;
+      memcpy (s.occ, bg->tiles[t]->occ, sizeof (s.occ));
+      if (fwrite (&s, sizeof (spill_t), 1, *spill) != 1)
+	{
+	  fprintf (stderr, "bounds: failed to write to a temporary file\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  bgrid_free (bg);
+  bgrid_init_sparse (bg);
+}
+
+/* The next tile of run `r`, or NULL when it is done
+ */
+static spill_t*
+run_peek (merge_t* mg, run_t* r)
+{
+  if (r->pos == r->len)
+    {
+      if (r->n == 0) return NULL;
+      r->len = (int) min (r->n, mg->nbuf);
+      tile_pread (mg->spill, r->buf, r->len * sizeof (spill_t), r->off);
+      r->off += r->len * sizeof (spill_t), r->n -= r->len, r->pos = 0;
+    }
+  return &r->buf[r->pos];
+}
+
+/* Whether the next tile of run `a` comes before that of run `b`
+ */
+static int
+run_before (merge_t* mg, int a, int b)
+{
+  spill_t* s1 = run_peek (mg, &mg->runs[a]);
+  spill_t* s2 = run_peek (mg, &mg->runs[b]);
+
+  return s1->ty < s2->ty || (s1->ty == s2->ty && s1->tx < s2->tx);
+}
+
+static void
+merge_sift (merge_t* mg, int k)
+{
+  int c, h;
+
+  for (; (c = 2 * k + 1) < mg->nheap; k = c)
+    {
+      if (c + 1 < mg->nheap && run_before (mg, mg->heap[c + 1], mg->heap[c])) c++;
+      if (!run_before (mg, mg->heap[c], mg->heap[k])) break;
+      h = mg->heap[k], mg->heap[k] = mg->heap[c], mg->heap[c] = h;
+    }
+}
+
+/* Start merging the `nruns` runs, reading back `nbuf` tiles of each at a time
+ */
+static void
+merge_init (merge_t* mg, FILE* spill, run_t* runs, int nruns, int nbuf)
+{
+  int r;
+
+  fflush (spill);
+  mg->spill = spill, mg->runs = runs, mg->nbuf = max (1, min (nbuf, RUN_BUF));
+  mg->heap = (int*) malloc (nruns * sizeof (int));
+  if (!mg->heap)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+      exit (EXIT_FAILURE);
+    }
+  for (r = 0; r < nruns; r++)
+    {
+      if ((runs[r].buf = (spill_t*) malloc (mg->nbuf * sizeof (spill_t))) == NULL)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+	  exit (EXIT_FAILURE);
+	}
+      mg->heap[r] = r;
+    }
+  mg->nheap = nruns;
+  for (r = nruns / 2; r >= 0; r--)
+    merge_sift (mg, r);
+}
+
+static void
+merge_free (merge_t* mg, int nruns)
+{
+  int r;
+
+  for (r = 0; r < nruns; r++)
+    free (mg->runs[r].buf);
+  free (mg->heap);
+}
+
+/* Merge the next row of tiles out of the runs into `row`;
+ * a tile spilled in more than one run has its occupancy ORed together.
+ * Returns the number of tiles in the row.
+ */
+static ssize_t
+tile_read_row (merge_t* mg, trow_t* row)
+{
+  spill_t* best;
+  btile_t* tile;
+  run_t* r;
+  int k;
+
+  row->n = 0;
+  while (mg->nheap > 0)
+    {
+      r = &mg->runs[mg->heap[0]];
+      best = run_peek (mg, r);
+      if (row->n > 0 && best->ty != row->ty) break;
+
+      if (row->n > 0 && row->tiles[row->n - 1]->tx == best->tx)
+	tile = row->tiles[row->n - 1];
+      else
+	{
+	  if (row->n == row->cap)
+	    {
+	      row->cap = row->cap ? row->cap * 2 : 256;
+	      row->tiles = (btile_t**) realloc (row->tiles, row->cap * sizeof (btile_t*));
+	    }
+	  tile = row->tiles ? (btile_t*) calloc (1, sizeof (btile_t)) : NULL;
+	  if (!tile)
+	    {
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the block tiles\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  tile->tx = best->tx, tile->ty = row->ty = best->ty;
+	  row->tiles[row->n++] = tile;
+	}
+      for (k = 0; k < BTILE; k++)
+	tile->occ[k] |= best->occ[k];
+
+      r->pos++;
+      if (run_peek (mg, r) == NULL)
+	mg->heap[0] = mg->heap[--mg->nheap];
+      merge_sift (mg, 0);
+    }
+  return row->n;
+}
+
+static void
+tile_free_row (trow_t* row)
+{
+  ssize_t t;
+
+  for (t = 0; t < row->n; t++)
+    free (row->tiles[t]);
+  row->n = 0;
+}
+
+/* Add the `n` edges of `chain` to the chain set `ch` as chain `fr`
+ */
+static void
+chains_add (chains_t* ch, frag_t* fr, bedge_t* chain, ssize_t n)
+{
+  fr->n = n;
+  if (ch->fp)
+    {
+      fr->off = ftello (ch->fp);
+      if (fwrite (chain, sizeof (bedge_t), n, ch->fp) != (size_t) n)
+	{
+	  fprintf (stderr, "bounds: failed to write to a temporary file\n");
+	  exit (EXIT_FAILURE);
+	}
+      return;
+    }
+  if (ch->nedges + n > ch->ecap)
+    {
+      ch->ecap = max (ch->ecap * 2, ch->nedges + n);
+      if ((ch->edges = (bedge_t*) realloc (ch->edges, ch->ecap * sizeof (bedge_t))) == NULL)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  fr->off = ch->nedges;
+  memcpy (ch->edges + ch->nedges, chain, n * sizeof (bedge_t));
+  ch->nedges += n;
+}
+
+/* Read `n` edges of chain `fr` from its `from`th into `buf`
+ */
+static void
+chains_read (chains_t* sets, frag_t* fr, bedge_t* buf, ssize_t from, ssize_t n)
+{
+  chains_t* ch = &sets[fr->set];
+
+  if (ch->fp)
+    tile_pread (ch->fp, buf, n * sizeof (bedge_t), fr->off + from * sizeof (bedge_t));
+  else
+    memcpy (buf, ch->edges + fr->off + from, n * sizeof (bedge_t));
+}
+
+static void
+chains_free (chains_t* ch)
+{
+  free (ch->frags);
+  free (ch->edges);
+  ch->frags = NULL, ch->edges = NULL;
+  ch->nfrags = ch->fcap = ch->nedges = ch->ecap = 0;
+}
+
+/* Trace the chain through edge (j, i, f) of `bg`, from where it comes into
+ * rows `r0` to `r1-1` to where it leaves them (or all the way around), and
+ * add it to `ch`; `chain` is scratch space of `cap` edges.
+ */
+static void
+tile_trace_chain (bgrid_t* bg, int j, int i, int f, int r0, int r1, chains_t* ch, bedge_t** chain, ssize_t* cap)
+{
+  bedge_t e, s, p, e0 = BEDGE (j, i, f);
+  uint8_t* cell;
+  frag_t* fr;
+  ssize_t n;
+  int shift;
+
+  /* Back up to where the chain comes into the rows */
+  for (s = e0; ; s = p)
+    {
+      p = block_prev (bg, s);
+      if (BEDGE_Y (p) < r0 || BEDGE_Y (p) >= r1) break;
+      if (p == e0)
+	{
+	  s = e0;
+	  break;
+	}
+    }
+
+  if (ch->nfrags == ch->fcap)
+    {
+      ch->fcap = ch->fcap ? ch->fcap * 2 : 1024;
+      if ((ch->frags = (frag_t*) realloc (ch->frags, ch->fcap * sizeof (frag_t))) == NULL)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	  exit (EXIT_FAILURE);
+	}
+    }
+  fr = &ch->frags[ch->nfrags++];
+  fr->first = fr->min = s, fr->minpos = 0, fr->ring = -1, fr->set = 0, fr->area = 0;
+
+  e = s, n = 0;
+  do
+    {
+      if (n == *cap)
+	{
+	  *cap = *cap ? *cap * 2 : 1024;
+	  if ((*chain = (bedge_t*) realloc (*chain, *cap * sizeof (bedge_t))) == NULL)
+	    {
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	      exit (EXIT_FAILURE);
+	    }
+	}
+      if (e < fr->min) fr->min = e, fr->minpos = n;
+      if (BEDGE_F (e) == 2) fr->area += BEDGE_Y (e) + 1;
+      else if (BEDGE_F (e) == 0) fr->area -= BEDGE_Y (e);
+      (*chain)[n++] = e;
+      cell = bgrid_cell (bg, BEDGE_X (e), BEDGE_Y (e), &shift);
+      *cell &= ~((1 << BEDGE_F (e)) << shift);
+      e = block_next (bg, e);
+    }
+  while (BEDGE_Y (e) >= r0 && BEDGE_Y (e) < r1 && e != s);
+
+  fr->next = e;
+  chains_add (ch, fr, *chain, n);
+}
+
+/* Trace the recorded edges of rows `r0` to `r1-1` of `bg` into chains
+ * and add them to `ch`; only the edge bits of those rows are cleared.
+ * In a sparse grid the rows are whole rows of tiles.
+ */
+static void
+tile_trace_rows (bgrid_t* bg, int r0, int r1, chains_t* ch)
+{
+  btile_t* tile;
+  bedge_t* chain = NULL;
+  ssize_t lo, hi, mid, cap = 0;
+  size_t k;
+  int i, j, c, bits;
+
+  if (!bg->tiles)
+    {
+      for (i = r0; i < r1; i++)
+	for (j = 0, k = (size_t) i * bg->nx; j < bg->nx; j++, k++)
+	  {
+	    /* Step over runs of cells without edges a word at a time */
+	    while ((k & 15) == 0 && j + 16 <= bg->nx && ((uint64_t*) bg->edge)[k >> 4] == 0)
+	      j += 16, k += 16;
+	    if (j < bg->nx)
+	      while ((bits = bgrid_edges (bg, k)))
+		for (c = 0; c < 4; c++)
+		  if (bits & (1 << c))
+		    {
+		      tile_trace_chain (bg, j, i, c, r0, r1, ch, &chain, &cap);
+		      break;
+		    }
+	  }
+      free (chain);
+      return;
+    }
+
+  for (lo = 0, hi = bg->ntiles; lo < hi; )
+    {
+      mid = (lo + hi) / 2;
+      if (((bg->tiles[mid]->ty - bg->ty0) << BTILE_SHIFT) < r0) lo = mid + 1;
+      else hi = mid;
+    }
+  for (; lo < bg->ntiles && ((bg->tiles[lo]->ty - bg->ty0) << BTILE_SHIFT) < r1; lo++)
+    {
+      tile = bg->tiles[lo];
+      for (k = 0; k < BTILE * BTILE; k++)
+	while ((bits = (tile->edge[k >> 1] >> ((k & 1) << 2)) & 15))
+	  {
+	    for (c = 0; !(bits & (1 << c)); c++);
+	    j = (int) ((tile->tx - bg->tx0) << BTILE_SHIFT) + (int) (k & (BTILE - 1));
+	    i = (int) ((tile->ty - bg->ty0) << BTILE_SHIFT) + (int) (k >> BTILE_SHIFT);
+	    tile_trace_chain (bg, j, i, c, r0, r1, ch, &chain, &cap);
+	  }
+    }
+  free (chain);
+}
+
+static int
+compare_frags (const void* a, const void* b)
+{
+  const frag_t* f1 = (const frag_t*) a;
+  const frag_t* f2 = (const frag_t*) b;
+
+  return (f1->first > f2->first) - (f1->first < f2->first);
+}
+
+static int
+compare_trings (const void* a, const void* b)
+{
+  const tring_t* r1 = (const tring_t*) a;
+  const tring_t* r2 = (const tring_t*) b;
+
+  if (r1->poly != r2->poly) return (r1->poly > r2->poly) - (r1->poly < r2->poly);
+  if (r1->hole != r2->hole) return r1->hole - r2->hole;
+  return (r1->min > r2->min) - (r1->min < r2->min);
+}
+
+/* Stitch the chains of the `nsets` chain sets into rings, across the
+ * seams between their stripes, and print them as polygons, each ring from
+ * its least edge.
+ * A ring whose least edge is the bottom of a cell is an outer ring (the
+ * cell below it is outside); any other is a hole, of the polygon whose
+ * component in `lab` holds the cell of its least edge.  Outer rings of
+ * fewer than `min_area` cells are left out with their holes, as are holes
+ * of fewer.
+ * Returns the number of boundary points.
+ */
+static ssize_t
+tile_stitch (chains_t* sets, int nsets, blabel_t* lab, ssize_t min_area, double inc, region_t xyi, int jflag)
+{
+  tring_t* rings;
+  frag_t* frags;
+  ssize_t* order;
+  ssize_t i, c, r, lo, hi, mid, m, n, nfrags = 0, nrings = 0, norder = 0, cap = 0, fcount = 0, nprint = 0;
+  int drop = 0;
+  bedge_t* ring = NULL;
+  int set;
+
+  /* Gather the chains of every set together */
+  if (nsets == 1)
+    frags = sets[0].frags, nfrags = sets[0].nfrags;
+  else
+    {
+      for (set = 0; set < nsets; set++)
+	nfrags += sets[set].nfrags;
+      if ((frags = (frag_t*) malloc ((nfrags + 1) * sizeof (frag_t))) == NULL)
+	{
+	  fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	  exit (EXIT_FAILURE);
+	}
+      for (set = 0, nfrags = 0; set < nsets; set++)
+	for (i = 0; i < sets[set].nfrags; i++)
+	  {
+	    frags[nfrags] = sets[set].frags[i];
+	    frags[nfrags++].set = set;
+	  }
+    }
+  for (set = 0; set < nsets; set++)
+    if (sets[set].fp) fflush (sets[set].fp);
+
+  qsort (frags, nfrags, sizeof (frag_t), compare_frags);
+  rings = (tring_t*) malloc ((nfrags + 1) * sizeof (tring_t));
+  order = (ssize_t*) malloc ((nfrags + 1) * sizeof (ssize_t));
+  if (!rings || !order)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* Follow each chain on to the next until the ring closes */
+  for (i = 0; i < nfrags; i++)
+    if (frags[i].ring < 0)
+      {
+	rings[nrings].min = frags[i].min, rings[nrings].fr = norder, rings[nrings].nfrags = 0;
+	rings[nrings].area = 0;
+	for (c = i; frags[c].ring < 0; )
+	  {
+	    frags[c].ring = nrings;
+	    order[norder++] = c, rings[nrings].nfrags++;
+	    rings[nrings].area += frags[c].area;
+	    if (frags[c].min < rings[nrings].min)
+	      rings[nrings].min = frags[c].min;
+
+	    for (lo = 0, hi = nfrags; lo < hi; )
+	      {
+		mid = (lo + hi) / 2;
+		if (frags[mid].first < frags[c].next) lo = mid + 1;
+		else hi = mid;
+	      }
+	    if (lo == nfrags || frags[lo].first != frags[c].next)
+	      {
+		fprintf (stderr, "bounds: failed to stitch the block boundary together\n");
+		exit (EXIT_FAILURE);
+	      }
+	    c = lo;
+	  }
+	rings[nrings].hole = (BEDGE_F (rings[nrings].min) != 0);
+	rings[nrings].poly = rings[nrings].hole
+	  ? blabel_root (lab, BEDGE_X (rings[nrings].min), BEDGE_Y (rings[nrings].min))
+	  : rings[nrings].min;
+	nrings++;
+      }
+  qsort (rings, nrings, sizeof (tring_t), compare_trings);
+
+  for (r = 0; r < nrings; r++)
+    {
+      /* A small outer ring takes its holes with it */
+      if (!rings[r].hole)
+	drop = (llabs (rings[r].area) < min_area);
+      if (drop || llabs (rings[r].area) < min_area)
+	continue;
+
+      /* Find the chain holding the ring's least edge */
+      for (m = 0; frags[order[rings[r].fr + m]].min != rings[r].min; m++);
+
+      for (c = 0, n = 0; c < rings[r].nfrags; c++)
+	n += frags[order[rings[r].fr + c]].n;
+      if (n > cap)
+	{
+	  cap = n;
+	  if ((ring = (bedge_t*) realloc (ring, cap * sizeof (bedge_t))) == NULL)
+	    {
+	      fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+	      exit (EXIT_FAILURE);
+	    }
+	}
+
+      /* Read the chains in from the least edge, coming back round to
+       * the start of its chain last.
+       */
+      i = order[rings[r].fr + m];
+      chains_read (sets, &frags[i], ring, frags[i].minpos, frags[i].n - frags[i].minpos);
+      for (c = 1, n = frags[i].n - frags[i].minpos; c < rings[r].nfrags; c++)
+	{
+	  i = order[rings[r].fr + (m + c) % rings[r].nfrags];
+	  chains_read (sets, &frags[i], ring + n, 0, frags[i].n);
+	  n += frags[i].n;
+	}
+      i = order[rings[r].fr + m];
+      chains_read (sets, &frags[i], ring + n, 0, frags[i].minpos);
+      n += frags[i].minpos;
+
+      fcount += block_print_ring (ring, n, inc, xyi, jflag, nprint++ == 0 ? 0 : rings[r].hole ? 2 : 1);
+    }
+
+  if (nsets > 1) free (frags);
+  free (ring);
+  free (rings);
+  free (order);
+  return fcount;
+}
+
+static void*
+stripe_run (void* arg)
+{
+  stripe_job_t* job = (stripe_job_t*) arg;
+  stripe_t* st;
+  int k;
+
+  for (k = job->first; k < job->nstripes; k += job->step)
+    {
+      st = &job->stripes[k];
+      tile_trace_rows (st->bg, st->r0, st->r1, st->ch);
+    }
+  return NULL;
+}
+
+/* Trace the recorded edges of `bg` into rings and print them, with the
+ * rows split into stripes traced over `nthreads` threads and the chains
+ * stitched together across the stripe borders.  The output doesn't depend
+ * on the number of threads.
+ * Returns the number of boundary points.
+ */
+ssize_t
+block_trace_stripes (bgrid_t* bg, double inc, region_t xyi, ssize_t min_area, int nthreads, int jflag)
+{
+  stripe_job_t jobs[64];
+  stripe_t* stripes;
+  chains_t* sets;
+  blabel_t lab;
+  ssize_t fcount;
+  int t, k, h, threads, nstripes;
+
+  /* Stripes are whole rows of tiles (which keeps two stripes from sharing
+   * a byte of a dense grid's edge bits), a few for each thread.
+   */
+  nthreads = min (nthreads, 64);
+  h = (int) ((((int64_t) bg->ny / max (nthreads * 4, 1)) + BTILE - 1) & ~(int64_t) (BTILE - 1));
+  h = max (h, BTILE);
+  nstripes = (int) (((int64_t) bg->ny + h - 1) / h);
+  if (nthreads < 2 || nstripes < 2)
+    nthreads = nstripes = 1, h = bg->ny;
+
+  stripes = (stripe_t*) calloc (nstripes, sizeof (stripe_t));
+  sets = (chains_t*) calloc (nstripes, sizeof (chains_t));
+  if (!stripes || !sets)
+    {
+      fprintf (stderr, "bounds: failed to allocate needed memory for the boundary\n");
+      exit (EXIT_FAILURE);
+    }
+  for (k = 0; k < nstripes; k++)
+    {
+      stripes[k].bg = bg, stripes[k].ch = &sets[k];
+      stripes[k].r0 = k * h;
+      stripes[k].r1 = (int) min ((int64_t) (k + 1) * h, bg->ny);
+    }
+
+  threads = max (1, min (nthreads, nstripes));
+  for (t = 0; t < threads; t++)
+    jobs[t].stripes = stripes, jobs[t].nstripes = nstripes, jobs[t].first = t, jobs[t].step = threads;
+  run_jobs (jobs, sizeof (stripe_job_t), threads, stripe_run);
+
+  blabel_init (&lab);
+  blabel_grid (&lab, bg, 0, bg->ny);
+  fcount = tile_stitch (sets, nstripes, &lab, min_area, inc, xyi, jflag);
+  blabel_free (&lab);
+  for (k = 0; k < nstripes; k++)
+    chains_free (&sets[k]);
+  free (sets);
+  free (stripes);
+  return fcount;
+}
+
+/* Trace the spilled tiles a row of tiles at a time, keeping only the rows
+ * on either side in memory, and stitch the rings back together.
+ * Returns the number of boundary points.
+ */
+static ssize_t
+tile_trace_runs (FILE* spill, run_t* runs, int nruns, ssize_t maxtiles, bgrid_t* shape, double inc, region_t xyi, ssize_t min_area, int vflag, int jflag)
+{
+  trow_t rows[3] = {{NULL, 0, 0, 0}, {NULL, 0, 0, 0}, {NULL, 0, 0, 0}};
+  trow_t tmp;
+  bgrid_t w;
+  chains_t ch = {NULL, 0, 0, NULL, 0, 0, NULL};
+  blabel_t lab;
+  ssize_t t, t0, t1, fcount;
+  merge_t mg;
+
+  /* The read buffers share the budget between the runs */
+  merge_init (&mg, spill, runs, nruns, (int) min (maxtiles / nruns, RUN_BUF));
+  ch.fp = tile_tmpfile ();
+  blabel_init (&lab);
+  bgrid_init_sparse (&w);
+  w.nx = shape->nx, w.ny = shape->ny, w.tx0 = shape->tx0, w.ty0 = shape->ty0;
+
+  /* rows[0] is the row before the one being traced, rows[2] the one after */
+  tile_read_row (&mg, &rows[1]);
+  tile_read_row (&mg, &rows[2]);
+  while (rows[1].n > 0)
+    {
+      bgrid_clear (&w);
+      if (rows[0].n > 0 && rows[0].ty == rows[1].ty - 1)
+	for (t = 0; t < rows[0].n; t++) bgrid_insert (&w, rows[0].tiles[t]);
+      t0 = w.ntiles;
+      for (t = 0; t < rows[1].n; t++) bgrid_insert (&w, rows[1].tiles[t]);
+      t1 = w.ntiles;
+      if (rows[2].n > 0 && rows[2].ty == rows[1].ty + 1)
+	for (t = 0; t < rows[2].n; t++) bgrid_insert (&w, rows[2].tiles[t]);
+
+      bgrid_record_edges (&w, t0, t1);
+      t = (rows[1].ty - w.ty0) << BTILE_SHIFT;
+      tile_trace_rows (&w, (int) t, (int) t + BTILE, &ch);
+      blabel_grid (&lab, &w, (int) t, (int) t + BTILE);
+
+      tile_free_row (&rows[0]);
+      tmp = rows[0], rows[0] = rows[1], rows[1] = rows[2], rows[2] = tmp;
+      tile_read_row (&mg, &rows[2]);
+    }
+  merge_free (&mg, nruns);
+  bgrid_clear (&w);
+  bgrid_free (&w);
+  for (t = 0; t < 3; t++)
+    {
+      tile_free_row (&rows[t]);
+      free (rows[t].tiles);
+    }
+
+  if (vflag > 0)
+    fprintf (stderr, "bounds: stitching %zd chains of edges\n", ch.nfrags);
+  fcount = tile_stitch (&ch, 1, &lab, min_area, inc, xyi, jflag);
+  fclose (ch.fp);
+  chains_free (&ch);
+  blabel_free (&lab);
+  return fcount;
+}
+
+/* "Bounding Block", over a sparse grid of tiles
+ * With a region, cells are counted from its lower-left corner as
+ * bbs_block counts them; without one the points are gridded on the lattice
+ * of whole multiples of `inc`, and the region is the extent of the tiles
+ * they touch.  If `max_memory` is more than 0 and the tiles outgrow it, they
+ * are spilled to a temporary file in sorted runs, traced back a row of
+ * tiles at a time and the rings stitched together across the rows; the
+ * boundary is the same as it would be traced in memory.  Only the runs of
+ * occupied cells, which place the holes in their polygons, are kept whole.
+ */
+int
+bbs_block_tiles (FILE *infile, bbatch_t* bb, double inc, region_t region, size_t max_memory, bpyramid_t* pyr, bmorph_t* morph, int raster, int nthreads, int vflag, int jflag)
+{
+  int i, nruns = 0, xsize = 0, ysize = 0, nx, ny;
+  int have_region = region_valid_p (&region);
+  int64_t ext[4] = {INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN};
+  int64_t tx0, ty0;
+  ssize_t fcount, maxtiles = SSIZE_MAX, npr = 0;
+  region_t xyi = region;
+  char* ptrec = "xy";
+  FILE* spill = NULL;
+  run_t* runs = NULL;
+  bgrid_t bg;
+
+  if (have_region)
+    {
+      if (vflag > 0) fprintf (stderr, "bounds: using user supplied region: %f/%f/%f/%f\n",
+			      xyi.xmin, xyi.xmax, xyi.ymin, xyi.ymax);
+      ysize = fabs ((xyi.ymax - xyi.ymin) / inc);
+      xsize = fabs ((xyi.xmax - xyi.xmin) / inc);
+    }
+
+  if (max_memory > 0 && pyr && pyr->levels > 1)
+    {
+      fprintf (stderr, "bounds: a block pyramid can't be made with --max-memory\n");
+      exit (EXIT_FAILURE);
+    }
+  if (max_memory > 0 && morph && (morph->min_count > 1 || morph->dilate > 0 || morph->erode > 0
+				   || morph->close > 0 || morph->fill > 0))
+    {
+      fprintf (stderr, "bounds: the block grid can't be shaped with --max-memory\n");
+      exit (EXIT_FAILURE);
+    }
+  if (max_memory > 0 && raster)
+    {
+      fprintf (stderr, "bounds: a raster can't be written with --max-memory\n");
+      exit (EXIT_FAILURE);
+    }
+
+  /* A tile costs its own size and its share of the tile list and hash */
+  if (max_memory > 0)
+    maxtiles = max (TILE_MIN, (ssize_t) (max_memory / (sizeof (btile_t) + 4 * sizeof (ssize_t))));
+
+  if (vflag > 0) fprintf (stderr, "bounds: gridding points into sparse tiles\n");
+
+  /* Points are read, parsed and turned into cells a batch at a time over
+   * the threads, then set in the tiles.
+   */
+  bgrid_init_sparse (&bg);
+  if (morph && morph->min_count > 1)
+    bgrid_count_init (&bg, morph->min_count);
+  while (bbatch_read (bb, infile, ptrec, nthreads, vflag) > 0)
+    {
+      if (have_region)
+	bbatch_cells (bb, inc, xyi.xmin, xyi.ymin, xsize, ysize, NULL, nthreads);
+      else
+	bbatch_cells (bb, inc, 0.0, 0.0, -1, -1, NULL, nthreads);
+      for (i = 0; i < bb->n; i++)
+	{
+	  if (bb->cx[i] != INT64_MIN && bg.cmax > 0)
+	    bgrid_count (&bg, bb->cx[i], bb->cy[i]);
+	  else if (bb->cx[i] != INT64_MIN)
+	    bgrid_set (&bg, bb->cx[i], bb->cy[i]);
+	  if (morph && morph->track > 0)
+	    bbatch_track (bb, i, morph->track, &bg);
+
+	  if (bg.ntiles >= maxtiles)
+	    {
+	      if (vflag > 0 && nruns == 0)
+		fprintf (stderr, "bounds: the block tiles need more than %zu bytes, spilling them to disk\n", max_memory);
+	      tile_extent (&bg, ext);
+	      tile_spill (&bg, &spill, &runs, &nruns);
+	    }
+	}
+      npr += bb->n;
+    }
+  if (bg.cmax > 0)
+    bgrid_threshold (&bg, morph->min_count);
+  tile_extent (&bg, ext);
+  if (nruns > 0)
+    tile_spill (&bg, &spill, &runs, &nruns);
+
+  if (vflag > 0)
+    fprintf (stderr, "bounds: %zd points gridded\n", npr);
+
+  /* Size the grid from the region, or from the tiles */
+  if (have_region)
+    tx0 = 0, ty0 = 0, nx = xsize, ny = ysize;
+  else if (ext[0] > ext[2])
+    tx0 = 0, ty0 = 0, nx = 0, ny = 0;
+  else if (ext[2] - ext[0] >= (INT_MAX >> BTILE_SHIFT) || ext[3] - ext[1] >= (INT_MAX >> BTILE_SHIFT))
+    {
+      fprintf (stderr,"bounds: the points span too many cells, try increasing the distance value (%f)\n", inc);
+      exit (EXIT_FAILURE);
+    }
+  else
+    {
+      tx0 = ext[0], ty0 = ext[1];
+      nx = (int) (ext[2] - ext[0] + 1) << BTILE_SHIFT;
+      ny = (int) (ext[3] - ext[1] + 1) << BTILE_SHIFT;
+      xyi.xmin = (double) (tx0 << BTILE_SHIFT) * inc;
+      xyi.ymin = (double) (ty0 << BTILE_SHIFT) * inc;
+      xyi.xmax = xyi.xmin + nx * inc;
+      xyi.ymax = xyi.ymin + ny * inc;
+      if (vflag > 0)
+	fprintf (stderr,"bounds: region is %f/%f/%f/%f, %d/%d cells\n",
+		 xyi.xmin, xyi.xmax, xyi.ymin, xyi.ymax, ny, nx);
+    }
+
+  if (nruns > 0)
+    {
+      if (vflag > 0)
+	fprintf (stderr,"bounds: tracing %d spilled runs of tiles\n", nruns);
+      bg.tx0 = tx0, bg.ty0 = ty0, bg.nx = nx, bg.ny = ny;
+      fcount = tile_trace_runs (spill, runs, nruns, maxtiles, &bg, inc, xyi, morph ? morph->min_area : 0, vflag, jflag);
+      fclose (spill);
+      free (runs);
+    }
+  else
+    {
+      if (vflag > 0 && !raster)
+	fprintf (stderr,"bounds: recording edges from %zd tiles\n", bg.ntiles);
+
+      /* Sealing puts the tiles in row order */
+      bgrid_seal (&bg);
+      bg.tx0 = tx0, bg.ty0 = ty0, bg.nx = nx, bg.ny = ny;
+      if (morph)
+	{
+	  if (vflag > 0) fprintf (stderr, "bounds: shaping the grid\n");
+	  bgrid_morph (&bg, morph, !have_region);
+
+	  /* On the lattice, the region follows the tiles */
+	  if (!have_region)
+	    {
+	      xyi.xmin = (double) (bg.tx0 << BTILE_SHIFT) * inc;
+	      xyi.ymin = (double) (bg.ty0 << BTILE_SHIFT) * inc;
+	      xyi.xmax = xyi.xmin + bg.nx * inc;
+	      xyi.ymax = xyi.ymin + bg.ny * inc;
+	    }
+	}
+      if (raster)
+	fcount = block_raster (&bg, inc, xyi, !have_region, raster, vflag);
+      else
+	fcount = block_levels (&bg, inc, xyi, !have_region, pyr, morph ? morph->min_area : 0, nthreads, vflag, jflag);
+    }
+  bgrid_free (&bg);
+
+  if (vflag > 0 && !raster)
+    fprintf (stderr,"bounds: found %zd total boundary points\n", fcount);
+
+  return (0);
+}